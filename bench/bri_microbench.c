@@ -0,0 +1,382 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri_microbench - times the index kernels (name storage, sort,
+//                  comparison and lookup) in isolation on
+//                  synthetic in-memory indices, without any
+//                  file I/O. Built and run by "make bench".
+//
+
+// avoid warnings in qsort_r, and for syscall
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <unistd.h>
+#include "bri_index.h"
+#include "bri_get.h"
+#include "bri_stats.h"
+#include "sort_r.h"
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+//
+// Allocation counting. When linked with -Wl,--wrap for the allocation
+// functions (see the Makefile) every call made by the bri code is
+// counted before being passed to the C library.
+//
+static size_t alloc_count = 0;
+
+#ifdef BRI_MICROBENCH_COUNT_ALLOCS
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size)
+{
+    alloc_count += 1;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t n, size_t size)
+{
+    alloc_count += 1;
+    return __real_calloc(n, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    alloc_count += 1;
+    return __real_realloc(ptr, size);
+}
+#endif
+
+//
+// Cache miss counting through perf_event_open, when the kernel allows it
+//
+typedef struct microbench_counter
+{
+    int fd;
+} microbench_counter;
+
+static void microbench_counter_open(microbench_counter* counter)
+{
+    counter->fd = -1;
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    counter->fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+}
+
+static void microbench_counter_start(microbench_counter* counter)
+{
+#ifdef __linux__
+    if(counter->fd >= 0) {
+        ioctl(counter->fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter->fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+// returns the number of cache misses since start, or -1 if unavailable
+static long long microbench_counter_stop(microbench_counter* counter)
+{
+#ifdef __linux__
+    if(counter->fd >= 0) {
+        ioctl(counter->fd, PERF_EVENT_IOC_DISABLE, 0);
+        long long count = 0;
+        if(read(counter->fd, &count, sizeof(count)) == sizeof(count)) {
+            return count;
+        }
+    }
+#endif
+    return -1;
+}
+
+static void microbench_counter_close(microbench_counter* counter)
+{
+    if(counter->fd >= 0) {
+        close(counter->fd);
+    }
+}
+
+//
+// Timing of one kernel
+//
+typedef struct microbench_result
+{
+    double start_time;
+    size_t start_allocs;
+    double seconds;
+    long long cache_misses;
+    size_t allocs;
+} microbench_result;
+
+static void microbench_begin(microbench_result* result, microbench_counter* counter)
+{
+    result->start_allocs = alloc_count;
+    microbench_counter_start(counter);
+    result->start_time = bri_stats_now();
+}
+
+static void microbench_end(microbench_result* result, microbench_counter* counter)
+{
+    result->seconds = bri_stats_now() - result->start_time;
+    result->cache_misses = microbench_counter_stop(counter);
+    result->allocs = alloc_count - result->start_allocs;
+}
+
+static void microbench_report(const char* kernel, size_t ops, const microbench_result* result)
+{
+    double per_op = ops > 0 ? 1.0 / ops : 0.0;
+    printf("%-16s %12zu %12.1f", kernel, ops, result->seconds * 1e9 * per_op);
+    if(result->cache_misses >= 0) {
+        printf(" %16.2f", result->cache_misses * per_op);
+    } else {
+        printf(" %16s", "n/a");
+    }
+#ifdef BRI_MICROBENCH_COUNT_ALLOCS
+    printf(" %12zu\n", result->allocs);
+#else
+    printf(" %12s\n", "n/a");
+#endif
+}
+
+//
+// Synthetic data
+//
+
+// splitmix64, so runs with the same seed see the same names
+static uint64_t microbench_rand(uint64_t* state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// write a uuid-style name (36 characters plus the terminator) into out
+static void microbench_name(uint64_t* state, char* out)
+{
+    static const char* hex = "0123456789abcdef";
+    uint64_t hi = microbench_rand(state);
+    uint64_t lo = microbench_rand(state);
+    size_t j = 0;
+    for(size_t i = 0; i < 32; ++i) {
+        if(i == 8 || i == 12 || i == 16 || i == 20) {
+            out[j++] = '-';
+        }
+        uint64_t w = i < 16 ? hi : lo;
+        out[j++] = hex[(w >> (4 * (i % 16))) & 0xf];
+    }
+    out[j] = '\0';
+}
+
+// convert a sorted index under construction into the form used after
+// loading: distinct names stored once, with records pointing at them.
+// Returns the new name block, which the caller must free.
+static char* microbench_finalize(bam_read_idx* bri)
+{
+    char* names = malloc(bri->name_count_bytes);
+    if(names == NULL) {
+        fprintf(stderr, "[bri_microbench] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t bytes = 0;
+    const char* prev = NULL;
+    char* prev_ptr = NULL;
+    for(size_t i = 0; i < bri->record_count; ++i) {
+        const char* name = bam_read_idx_build_name(bri, bri->records[i].read_name.offset);
+        if(prev == NULL || strcmp(prev, name) != 0) {
+            size_t len = strlen(name) + 1;
+            prev_ptr = names + bytes;
+            memcpy(prev_ptr, name, len);
+            bytes += len;
+            prev = name;
+        }
+        bri->records[i].read_name.ptr = prev_ptr;
+    }
+    return names;
+}
+
+//
+// Getopt
+//
+enum {
+    OPT_HELP = 1,
+};
+
+static const char* shortopts = ":n:q:s:";
+static const struct option longopts[] = {
+    { "help",                      no_argument,       NULL, OPT_HELP },
+    { "num-names",           required_argument,       NULL,      'n' },
+    { "num-queries",         required_argument,       NULL,      'q' },
+    { "seed",                required_argument,       NULL,      's' },
+    { NULL, 0, NULL, 0 }
+};
+
+void print_usage_microbench()
+{
+    fprintf(stderr, "usage: bri_microbench [-n num_names] [-q num_queries] [-s seed]\n");
+}
+
+int main(int argc, char** argv)
+{
+    size_t num_names = 1000000;
+    size_t num_queries = 1000000;
+    uint64_t seed = 1;
+
+    int die = 0;
+    for (char c; (c = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1;) {
+        switch (c) {
+            case OPT_HELP:
+                print_usage_microbench();
+                exit(EXIT_SUCCESS);
+            case 'n':
+                num_names = strtoull(optarg, NULL, 10);
+                break;
+            case 'q':
+                num_queries = strtoull(optarg, NULL, 10);
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 10);
+                break;
+            default:
+                die = 1;
+        }
+    }
+
+    if(die || optind != argc || num_names == 0) {
+        print_usage_microbench();
+        exit(EXIT_FAILURE);
+    }
+
+    // Generate the names up front so generation isn't timed. About a third
+    // of the names get a second record, like paired or supplementary alignments.
+    size_t name_stride = 37;
+    char* input_names = malloc(num_names * name_stride);
+    if(input_names == NULL) {
+        fprintf(stderr, "[bri_microbench] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t state = seed;
+    for(size_t i = 0; i < num_names; ++i) {
+        microbench_name(&state, input_names + i * name_stride);
+    }
+
+    microbench_counter counter;
+    microbench_counter_open(&counter);
+    if(counter.fd < 0) {
+        fprintf(stderr, "[bri_microbench] cache miss counters are unavailable\n");
+    }
+
+    printf("%-16s %12s %12s %16s %12s\n", "kernel", "ops", "ns/op", "cache-misses/op", "allocs");
+
+    //
+    // add: append names and records, allocating from the arenas
+    //
+    bam_read_idx* bri = bam_read_idx_init();
+    if(bri == NULL) {
+        fprintf(stderr, "[bri_microbench] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    microbench_result result;
+    microbench_begin(&result, &counter);
+    for(size_t i = 0; i < num_names; ++i) {
+        const char* name = input_names + i * name_stride;
+        bam_read_idx_add(bri, name, i << 16);
+        if(i % 3 == 0) {
+            bam_read_idx_add(bri, name, (i << 16) + 1);
+        }
+    }
+    microbench_end(&result, &counter);
+    microbench_report("add", bri->record_count, &result);
+
+    // move the records out of the arena, as bam_read_idx_save does
+    bam_read_idx_compact_records(bri);
+
+    //
+    // compare: the sort comparator on random pairs of records
+    //
+    size_t num_compares = bri->record_count;
+    int checksum = 0;
+    state = seed;
+    microbench_begin(&result, &counter);
+    for(size_t i = 0; i < num_compares; ++i) {
+        uint64_t r = microbench_rand(&state);
+        const bam_read_idx_record* r1 = &bri->records[(r & 0xffffffff) % bri->record_count];
+        const bam_read_idx_record* r2 = &bri->records[(r >> 32) % bri->record_count];
+        checksum += compare_records_by_readname_offset(r1, r2, &bri->name_arena) < 0;
+    }
+    microbench_end(&result, &counter);
+    microbench_report("compare", num_compares, &result);
+
+    //
+    // sort: order the records by name, as done before writing the index
+    //
+    microbench_begin(&result, &counter);
+    sort_r(bri->records, bri->record_count, sizeof(bam_read_idx_record), compare_records_by_readname_offset, &bri->name_arena);
+    microbench_end(&result, &counter);
+    microbench_report("sort", bri->record_count, &result);
+
+    // switch to the loaded representation for the lookups
+    bri->readnames = microbench_finalize(bri);
+    bri_arena_destroy(&bri->name_arena);
+
+    //
+    // get_range: lookups of names in the index, then of absent names
+    //
+    size_t found = 0;
+    state = seed + 1;
+    microbench_begin(&result, &counter);
+    for(size_t i = 0; i < num_queries; ++i) {
+        const char* name = input_names + (microbench_rand(&state) % num_names) * name_stride;
+        bam_read_idx_record* start;
+        bam_read_idx_record* end;
+        bam_read_idx_get_range(bri, name, &start, &end);
+        found += end - start;
+    }
+    microbench_end(&result, &counter);
+    microbench_report("get_range_hit", num_queries, &result);
+
+    // absent names come from a different stream of the generator
+    char query[64];
+    state = seed ^ 0x5555555555555555ull;
+    microbench_begin(&result, &counter);
+    for(size_t i = 0; i < num_queries; ++i) {
+        microbench_name(&state, query);
+        bam_read_idx_record* start;
+        bam_read_idx_record* end;
+        bam_read_idx_get_range(bri, query, &start, &end);
+        found += end - start;
+    }
+    microbench_end(&result, &counter);
+    microbench_report("get_range_miss", num_queries, &result);
+
+    // printing the results also stops the loops being optimized away
+    fprintf(stderr, "[bri_microbench] %d ordered pairs, %zu records found\n", checksum, found);
+
+    microbench_counter_close(&counter);
+    bam_read_idx_destroy(bri);
+    free(input_names);
+    return 0;
+}
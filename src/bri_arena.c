@@ -0,0 +1,134 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+
+// for MAP_ANONYMOUS
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include "bri_arena.h"
+
+// the size, and alignment, of a transparent huge page on x86-64
+#define BRI_ARENA_HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+//
+void bri_arena_init(bri_arena* arena, size_t chunk_bits, int huge_pages)
+{
+    memset(arena, 0, sizeof(bri_arena));
+    arena->chunk_bits = chunk_bits;
+    arena->huge_pages = huge_pages;
+}
+
+// allocate a chunk, either from malloc or, for huge pages, mapped directly.
+// mmap only aligns to the base page size, so the mapping is made one huge
+// page larger and trimmed to a chunk that starts on a huge page boundary,
+// which lets the kernel back all of it with huge pages.
+static char* bri_arena_new_chunk(const bri_arena* arena)
+{
+    size_t chunk_size = (size_t)1 << arena->chunk_bits;
+    if(!arena->huge_pages) {
+        return malloc(chunk_size);
+    }
+
+    size_t mapped_size = chunk_size + BRI_ARENA_HUGE_PAGE_SIZE;
+    char* mapped = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mapped == MAP_FAILED) {
+        return NULL;
+    }
+
+    uintptr_t address = (uintptr_t)mapped;
+    char* chunk = (char*)((address + BRI_ARENA_HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(BRI_ARENA_HUGE_PAGE_SIZE - 1));
+    size_t head = chunk - mapped;
+    size_t tail = mapped_size - head - chunk_size;
+    if(head > 0) {
+        munmap(mapped, head);
+    }
+    if(tail > 0) {
+        munmap(chunk + chunk_size, tail);
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(chunk, chunk_size, MADV_HUGEPAGE);
+#endif
+    return chunk;
+}
+
+//
+size_t bri_arena_alloc(bri_arena* arena, size_t bytes)
+{
+    size_t chunk_size = (size_t)1 << arena->chunk_bits;
+    if(bytes > chunk_size) {
+        fprintf(stderr, "[bri] allocation of %zu bytes is larger than the arena chunk size\n", bytes);
+        exit(EXIT_FAILURE);
+    }
+
+    // allocations don't span chunks, skip to the next chunk if this one is full
+    size_t chunk = arena->next >> arena->chunk_bits;
+    if(chunk < arena->num_chunks && (arena->next & (chunk_size - 1)) + bytes > chunk_size) {
+        chunk += 1;
+        arena->next = chunk << arena->chunk_bits;
+    }
+
+    if(chunk == arena->num_chunks) {
+        if(arena->num_chunks == arena->chunk_capacity) {
+            arena->chunk_capacity = arena->chunk_capacity > 0 ? 2 * arena->chunk_capacity : 64;
+            arena->chunks = realloc(arena->chunks, arena->chunk_capacity * sizeof(char*));
+            if(arena->chunks == NULL) {
+                fprintf(stderr, "[bri] malloc failed\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        arena->chunks[arena->num_chunks] = bri_arena_new_chunk(arena);
+        if(arena->chunks[arena->num_chunks] == NULL) {
+            fprintf(stderr, "[bri] malloc failed\n");
+            exit(EXIT_FAILURE);
+        }
+        arena->num_chunks += 1;
+    }
+
+    size_t offset = arena->next;
+    arena->next += bytes;
+    arena->used += bytes;
+    return offset;
+}
+
+//
+size_t bri_arena_reserved(const bri_arena* arena)
+{
+    return arena->num_chunks << arena->chunk_bits;
+}
+
+//
+void bri_arena_free_chunk(bri_arena* arena, size_t index)
+{
+    if(arena->chunks[index] == NULL) {
+        return;
+    }
+
+    if(arena->huge_pages) {
+        munmap(arena->chunks[index], (size_t)1 << arena->chunk_bits);
+    } else {
+        free(arena->chunks[index]);
+    }
+    arena->chunks[index] = NULL;
+}
+
+//
+void bri_arena_destroy(bri_arena* arena)
+{
+    for(size_t i = 0; i < arena->num_chunks; ++i) {
+        bri_arena_free_chunk(arena, i);
+    }
+    free(arena->chunks);
+    memset(arena, 0, sizeof(bri_arena));
+}
@@ -0,0 +1,64 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+// A chunked arena for the names and records of an index being built.
+// Memory is allocated in fixed size chunks that are never moved, so
+// the arena grows without copying and without needing the old and new
+// storage at once. Allocations are identified by their offset in the
+// arena, which increases in allocation order and is converted to a
+// pointer with bri_arena_ptr.
+//
+#ifndef BAM_READ_IDX_ARENA
+#define BAM_READ_IDX_ARENA
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// default size of each chunk (16MB)
+#define BRI_ARENA_CHUNK_BITS 24
+
+typedef struct bri_arena
+{
+    // chunks are (1 << chunk_bits) bytes
+    size_t chunk_bits;
+    size_t num_chunks;
+    size_t chunk_capacity;
+    char** chunks;
+
+    // offset of the next allocation, and the bytes allocated, which
+    // is less than next when allocations skip the end of a chunk
+    size_t next;
+    size_t used;
+
+    // back chunks with transparent huge pages where supported
+    int huge_pages;
+} bri_arena;
+
+//
+void bri_arena_init(bri_arena* arena, size_t chunk_bits, int huge_pages);
+
+// allocate bytes, which must be at most the chunk size, within a single
+// chunk and return its offset. Exits if out of memory.
+size_t bri_arena_alloc(bri_arena* arena, size_t bytes);
+
+// the memory at offset
+static inline char* bri_arena_ptr(const bri_arena* arena, size_t offset)
+{
+    return arena->chunks[offset >> arena->chunk_bits] + (offset & (((size_t)1 << arena->chunk_bits) - 1));
+}
+
+// the bytes allocated from the system for the arena
+size_t bri_arena_reserved(const bri_arena* arena);
+
+// free the chunk at index, which must not be used again
+void bri_arena_free_chunk(bri_arena* arena, size_t index);
+
+// free all chunks
+void bri_arena_destroy(bri_arena* arena);
+
+#endif
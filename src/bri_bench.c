@@ -0,0 +1,576 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+
+// for stat and unlink
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "bri_index.h"
+#include "bri_get.h"
+#include "bri_reader.h"
+#include "bri_stats.h"
+#include "bri_bench.h"
+
+enum {
+    BENCH_NAMES_UUID = 0,
+    BENCH_NAMES_ILLUMINA = 1
+};
+
+// the synthetic reads are spread over this many chromosomes
+#define BENCH_NUM_CHROMOSOMES 4
+#define BENCH_CHROMOSOME_LENGTH 250000000
+
+typedef struct bench_options
+{
+    size_t num_reads;
+    size_t read_length;
+    int name_style;
+    double supplementary_rate;
+    size_t num_queries;
+    size_t batch_size;
+    uint64_t seed;
+    const char* prefix;
+    int keep;
+    int io_policy;
+    int cold;
+} bench_options;
+
+// splitmix64, a small deterministic generator so runs
+// with the same seed produce the same data on every platform
+static uint64_t bench_rand(uint64_t* state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// uniform double in [0, 1)
+static double bench_rand_double(uint64_t* state)
+{
+    return (bench_rand(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// generate the name of read_id into out, which must hold at least 64 bytes.
+// names are a function of the seed and id only so they can be regenerated
+// when choosing queries without storing every name
+static void bench_read_name(const bench_options* opts, size_t read_id, char* out)
+{
+    uint64_t state = opts->seed ^ (read_id * 0xd1b54a32d192ed03ull);
+    if(opts->name_style == BENCH_NAMES_UUID) {
+        uint64_t a = bench_rand(&state);
+        uint64_t b = bench_rand(&state);
+        sprintf(out, "%08x-%04x-4%03x-%04x-%012llx",
+            (unsigned)(a >> 32), (unsigned)((a >> 16) & 0xFFFF), (unsigned)(a & 0xFFF),
+            (unsigned)(0x8000 | ((b >> 48) & 0x3FFF)), (unsigned long long)(b & 0xFFFFFFFFFFFFull));
+    } else {
+        // instrument:run:flowcell:lane:tile:x:y, with lane/tile/x/y a
+        // decomposition of the read id so every name is unique
+        size_t lane = 1 + read_id % 4;
+        size_t rest = read_id / 4;
+        size_t tile = 1101 + rest % 64;
+        rest /= 64;
+        size_t x = 1000 + rest % 32000;
+        size_t y = 1000 + rest / 32000;
+        sprintf(out, "A00123:8:H%07XDSX:%zu:%zu:%zu:%zu",
+            (unsigned)(opts->seed & 0xFFFFFFF), lane, tile, x, y);
+    }
+}
+
+// write a coordinate-sorted bam with one primary alignment per read
+// and a supplementary alignment for a fraction of the reads
+static void bench_write_bam(const bench_options* opts, const char* filename)
+{
+    htsFile* fp = hts_open(filename, "wb");
+    if(fp == NULL) {
+        fprintf(stderr, "[bri-bench] could not open %s for writing\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    char header_text[1024];
+    size_t hl = sprintf(header_text, "@HD\tVN:1.6\tSO:coordinate\n");
+    for(int i = 0; i < BENCH_NUM_CHROMOSOMES; ++i) {
+        hl += sprintf(header_text + hl, "@SQ\tSN:chr%d\tLN:%d\n", i + 1, BENCH_CHROMOSOME_LENGTH);
+    }
+    bam_hdr_t* h = sam_hdr_parse(hl, header_text);
+    if(h == NULL || sam_hdr_write(fp, h) < 0) {
+        fprintf(stderr, "[bri-bench] could not write header\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // list the alignments, as (read_id << 1 | is_supplementary), then
+    // shuffle them to give each its position in the file
+    uint64_t state = opts->seed;
+    size_t capacity = opts->num_reads + (size_t)(opts->num_reads * opts->supplementary_rate) + 1024;
+    size_t num_alignments = 0;
+    uint64_t* alignments = malloc(capacity * sizeof(uint64_t));
+    if(alignments == NULL) {
+        fprintf(stderr, "[bri-bench] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(size_t i = 0; i < opts->num_reads; ++i) {
+        int supplementary = bench_rand_double(&state) < opts->supplementary_rate;
+        if(num_alignments + 2 > capacity) {
+            capacity *= 2;
+            alignments = realloc(alignments, capacity * sizeof(uint64_t));
+            if(alignments == NULL) {
+                fprintf(stderr, "[bri-bench] malloc failed\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        alignments[num_alignments++] = (uint64_t)i << 1;
+        if(supplementary) {
+            alignments[num_alignments++] = ((uint64_t)i << 1) | 1;
+        }
+    }
+
+    for(size_t i = num_alignments; i > 1; --i) {
+        size_t j = bench_rand(&state) % i;
+        uint64_t tmp = alignments[i - 1];
+        alignments[i - 1] = alignments[j];
+        alignments[j] = tmp;
+    }
+
+    size_t length = opts->read_length;
+    char* seq = malloc(length + 1);
+    char* qual = malloc(length);
+    if(seq == NULL || qual == NULL) {
+        fprintf(stderr, "[bri-bench] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(qual, 20, length);
+
+    // evenly spread the alignments over the chromosomes with random gaps
+    double step = (double)BENCH_NUM_CHROMOSOMES * BENCH_CHROMOSOME_LENGTH / (num_alignments + 1);
+    int32_t tid = 0;
+    double pos = 0;
+
+    bam1_t* b = bam_init1();
+    char name[64];
+    for(size_t i = 0; i < num_alignments; ++i) {
+        pos += bench_rand_double(&state) * 2.0 * step;
+        while(pos >= BENCH_CHROMOSOME_LENGTH && tid + 1 < BENCH_NUM_CHROMOSOMES) {
+            pos -= BENCH_CHROMOSOME_LENGTH;
+            tid += 1;
+        }
+
+        size_t read_id = alignments[i] >> 1;
+        int supplementary = alignments[i] & 1;
+        bench_read_name(opts, read_id, name);
+
+        for(size_t j = 0; j < length; ++j) {
+            seq[j] = "ACGT"[bench_rand(&state) & 3];
+        }
+
+        uint16_t flag = bench_rand(&state) & 1 ? BAM_FREVERSE : 0;
+        uint32_t cigar[2];
+        size_t n_cigar = 0;
+        if(supplementary) {
+            // the first half of the read is clipped in the supplementary alignment
+            flag |= BAM_FSUPPLEMENTARY;
+            cigar[n_cigar++] = (length / 2) << 4 | 4; // S
+            cigar[n_cigar++] = (length - length / 2) << 4 | 0; // M
+        } else {
+            cigar[n_cigar++] = length << 4 | 0; // M
+        }
+
+        hts_pos_t aln_pos = (hts_pos_t)pos;
+        if(aln_pos + (hts_pos_t)length > BENCH_CHROMOSOME_LENGTH) {
+            aln_pos = BENCH_CHROMOSOME_LENGTH - length;
+        }
+
+        int ret = bam_set1(b, strlen(name), name, flag, tid, aln_pos, 60,
+                           n_cigar, cigar, -1, -1, 0, length, seq, qual, 0);
+        if(ret < 0 || sam_write1(fp, h, b) < 0) {
+            fprintf(stderr, "[bri-bench] failed to write record\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    bam_destroy1(b);
+    free(seq);
+    free(qual);
+    free(alignments);
+    bam_hdr_destroy(h);
+    hts_close(fp);
+}
+
+// size of a file in bytes, or 0 if it doesn't exist
+static size_t bench_file_size(const char* filename)
+{
+    struct stat st;
+    return stat(filename, &st) == 0 ? (size_t)st.st_size : 0;
+}
+
+//
+static int compare_doubles(const void* a, const void* b)
+{
+    double d1 = *(const double*)a;
+    double d2 = *(const double*)b;
+    return d1 < d2 ? -1 : (d1 > d2);
+}
+
+//
+static int compare_names(const void* a, const void* b)
+{
+    return strcmp((const char*)a, (const char*)b);
+}
+
+// write summary statistics of n latencies (in seconds) as a json object, in microseconds
+static void bench_write_latencies(FILE* out, const char* key, double* latencies, size_t n, int last)
+{
+    double total = 0.0;
+    for(size_t i = 0; i < n; ++i) {
+        total += latencies[i];
+    }
+
+    qsort(latencies, n, sizeof(double), compare_doubles);
+    double p50 = n > 0 ? latencies[(size_t)(0.50 * (n - 1))] : 0.0;
+    double p99 = n > 0 ? latencies[(size_t)(0.99 * (n - 1))] : 0.0;
+    double max = n > 0 ? latencies[n - 1] : 0.0;
+    fprintf(out, "    \"%s\": { \"count\": %zu, \"mean_us\": %.3f, \"p50_us\": %.3f, \"p99_us\": %.3f, \"max_us\": %.3f }%s\n",
+        key, n, n > 0 ? 1e6 * total / n : 0.0, 1e6 * p50, 1e6 * p99, 1e6 * max, last ? "" : ",");
+}
+
+//
+// Getopt
+//
+enum {
+    OPT_HELP = 1,
+    OPT_STATS,
+    OPT_IO,
+    OPT_COLD,
+};
+
+static const char* shortopts = "n:l:N:s:q:b:S:p:o:k";
+static const struct option longopts[] = {
+    { "help",                      no_argument,       NULL, OPT_HELP },
+    { "num-reads",           required_argument,       NULL,      'n' },
+    { "read-length",         required_argument,       NULL,      'l' },
+    { "name-style",          required_argument,       NULL,      'N' },
+    { "supplementary-rate",  required_argument,       NULL,      's' },
+    { "num-queries",         required_argument,       NULL,      'q' },
+    { "batch-size",          required_argument,       NULL,      'b' },
+    { "seed",                required_argument,       NULL,      'S' },
+    { "prefix",              required_argument,       NULL,      'p' },
+    { "output",              required_argument,       NULL,      'o' },
+    { "keep",                      no_argument,       NULL,      'k' },
+    { "stats",               required_argument,       NULL, OPT_STATS },
+    { "io",                  required_argument,       NULL, OPT_IO },
+    { "cold",                      no_argument,       NULL, OPT_COLD },
+    { NULL, 0, NULL, 0 }
+};
+
+void print_usage_bench()
+{
+    fprintf(stderr, "usage: bri bench [options]\n");
+    fprintf(stderr, "  generate a synthetic bam, then time building, loading and querying its index\n");
+    fprintf(stderr, "  -n, --num-reads N             number of reads to generate (default: 100000)\n");
+    fprintf(stderr, "  -l, --read-length N           length of each read (default: 1000)\n");
+    fprintf(stderr, "  -N, --name-style STYLE        read name style, uuid or illumina (default: uuid)\n");
+    fprintf(stderr, "  -s, --supplementary-rate F    fraction of reads with a supplementary alignment (default: 0.1)\n");
+    fprintf(stderr, "  -q, --num-queries N           number of lookups to time for each query type (default: 10000)\n");
+    fprintf(stderr, "  -b, --batch-size N            number of names per batched lookup (default: 100)\n");
+    fprintf(stderr, "  -S, --seed N                  random seed (default: 1)\n");
+    fprintf(stderr, "  -p, --prefix PREFIX           write the synthetic bam to PREFIX.bam (default: bri_bench)\n");
+    fprintf(stderr, "  -o, --output FILE             write the json report to FILE (default: stdout)\n");
+    fprintf(stderr, "  -k, --keep                    keep the synthetic bam and index\n");
+    fprintf(stderr, "      --io POLICY               I/O policy of the build's scan, buffered or stream (default: buffered)\n");
+    fprintf(stderr, "      --cold                    drop the synthetic bam from the page cache before building\n");
+    fprintf(stderr, "      --stats FILE              write timing and I/O statistics for the whole run to FILE as JSON\n");
+}
+
+//
+int bam_read_idx_bench_main(int argc, char** argv)
+{
+    bench_options opts;
+    opts.num_reads = 100000;
+    opts.read_length = 1000;
+    opts.name_style = BENCH_NAMES_UUID;
+    opts.supplementary_rate = 0.1;
+    opts.num_queries = 10000;
+    opts.batch_size = 100;
+    opts.seed = 1;
+    opts.prefix = "bri_bench";
+    opts.keep = 0;
+    opts.io_policy = BRI_IO_BUFFERED;
+    opts.cold = 0;
+    const char* output = NULL;
+    const char* stats_file = NULL;
+
+    int die = 0;
+    for (char c; (c = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1;) {
+        switch (c) {
+            case OPT_HELP:
+                print_usage_bench();
+                exit(EXIT_SUCCESS);
+            case 'n':
+                opts.num_reads = strtoull(optarg, NULL, 10);
+                break;
+            case 'l':
+                opts.read_length = strtoull(optarg, NULL, 10);
+                break;
+            case 'N':
+                if(strcmp(optarg, "uuid") == 0) {
+                    opts.name_style = BENCH_NAMES_UUID;
+                } else if(strcmp(optarg, "illumina") == 0) {
+                    opts.name_style = BENCH_NAMES_ILLUMINA;
+                } else {
+                    fprintf(stderr, "bri bench: unknown name style %s\n", optarg);
+                    die = 1;
+                }
+                break;
+            case 's':
+                opts.supplementary_rate = atof(optarg);
+                break;
+            case 'q':
+                opts.num_queries = strtoull(optarg, NULL, 10);
+                break;
+            case 'b':
+                opts.batch_size = strtoull(optarg, NULL, 10);
+                break;
+            case 'S':
+                opts.seed = strtoull(optarg, NULL, 10);
+                break;
+            case 'p':
+                opts.prefix = optarg;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'k':
+                opts.keep = 1;
+                break;
+            case OPT_STATS:
+                stats_file = optarg;
+                break;
+            case OPT_IO:
+                opts.io_policy = bri_io_policy_parse(optarg);
+                if(opts.io_policy < 0) {
+                    fprintf(stderr, "bri bench: unknown I/O policy %s\n", optarg);
+                    die = 1;
+                }
+                break;
+            case OPT_COLD:
+                opts.cold = 1;
+                break;
+            default:
+                die = 1;
+        }
+    }
+
+    if(opts.num_reads == 0 || opts.read_length < 2 || opts.batch_size == 0 ||
+       opts.supplementary_rate < 0.0 || opts.supplementary_rate > 1.0) {
+        fprintf(stderr, "bri bench: invalid arguments\n");
+        die = 1;
+    }
+
+    if(die) {
+        print_usage_bench();
+        exit(EXIT_FAILURE);
+    }
+
+    FILE* out = stdout;
+    if(output != NULL) {
+        out = fopen(output, "w");
+        if(out == NULL) {
+            fprintf(stderr, "[bri-bench] could not open %s for writing\n", output);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    char* bam_fn = malloc(strlen(opts.prefix) + 5);
+    char* bri_fn = malloc(strlen(opts.prefix) + 9);
+    if(bam_fn == NULL || bri_fn == NULL) {
+        fprintf(stderr, "[bri-bench] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+    sprintf(bam_fn, "%s.bam", opts.prefix);
+    sprintf(bri_fn, "%s.bam.bri", opts.prefix);
+
+    //
+    // generate data and build the index
+    //
+    double t0 = bri_stats_now();
+    bench_write_bam(&opts, bam_fn);
+    double generate_time = bri_stats_now() - t0;
+
+    // a cold build reads the bam from the device rather than the page cache
+    if(opts.cold && bri_io_drop_cached(bam_fn) != 0) {
+        fprintf(stderr, "[bri-bench] could not drop %s from the page cache\n", bam_fn);
+    }
+    size_t bam_bytes = 0;
+    int64_t cached_before = bri_io_cached_bytes(bam_fn, &bam_bytes);
+
+    // the build phases are always timed for the report, the
+    // lookups only when requested as timing them adds overhead
+    bam_read_idx_build_options build_opts;
+    bam_read_idx_build_options_init(&build_opts);
+    build_opts.io_policy = opts.io_policy;
+    bri_stats_reset();
+    bri_stats_enable(1);
+    t0 = bri_stats_now();
+    bam_read_idx_build_files((const char**)&bam_fn, 1, bri_fn, &build_opts);
+    double build_time = bri_stats_now() - t0;
+
+    // how much of the bam the scan left in the page cache
+    int64_t cached_after = bri_io_cached_bytes(bam_fn, &bam_bytes);
+    double scan_time = bri_stats_elapsed(BRI_PHASE_SCAN);
+
+    t0 = bri_stats_now();
+    bri_reader_t* reader = bri_reader_open(bam_fn, bri_fn, NULL);
+    double load_time = bri_stats_now() - t0;
+    if(reader == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    bri_stats_enable(stats_file != NULL);
+    const bam_read_idx* bri = bri_reader_index(reader);
+
+    //
+    // time lookups
+    //
+    size_t nq = opts.num_queries;
+    size_t num_batches = (nq + opts.batch_size - 1) / opts.batch_size;
+    double* hit_latencies = malloc(nq * sizeof(double));
+    double* miss_latencies = malloc(nq * sizeof(double));
+    double* fetch_latencies = malloc(nq * sizeof(double));
+    double* batch_latencies = malloc(num_batches * sizeof(double));
+    char (*batch_names)[64] = malloc(opts.batch_size * sizeof(*batch_names));
+    bri_itr_t* itr = bri_itr_init(reader);
+    bam1_t* b = bam_init1();
+    if(hit_latencies == NULL || miss_latencies == NULL || fetch_latencies == NULL ||
+       batch_latencies == NULL || batch_names == NULL || itr == NULL) {
+        fprintf(stderr, "[bri-bench] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // queries use their own generator so they don't depend on how
+    // many random numbers were used to generate the bam
+    uint64_t state = opts.seed ^ 0x5bd1e995ull;
+    char name[72];
+    size_t found = 0;
+    bam_read_idx_record* start;
+    bam_read_idx_record* end;
+
+    // index search only, for names that are and aren't in the index
+    for(size_t i = 0; i < nq; ++i) {
+        bench_read_name(&opts, bench_rand(&state) % opts.num_reads, name);
+        t0 = bri_stats_now();
+        bam_read_idx_get_range(bri, name, &start, &end);
+        hit_latencies[i] = bri_stats_now() - t0;
+        found += start != end;
+
+        strcat(name, "_x");
+        t0 = bri_stats_now();
+        bam_read_idx_get_range(bri, name, &start, &end);
+        miss_latencies[i] = bri_stats_now() - t0;
+    }
+
+    // search and read every alignment of the read
+    size_t fetched = 0;
+    for(size_t i = 0; i < nq; ++i) {
+        bench_read_name(&opts, bench_rand(&state) % opts.num_reads, name);
+        t0 = bri_stats_now();
+        int ret = bri_itr_query(itr, name);
+        while(ret >= 0 && (ret = bri_itr_next(itr, b)) >= 0) {
+            fetched += 1;
+        }
+        fetch_latencies[i] = bri_stats_now() - t0;
+        if(ret < BRI_ITR_END) {
+            fprintf(stderr, "[bri-bench] failed to fetch %s\n", name);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // batches of random names, searched in sorted order
+    for(size_t bi = 0; bi < num_batches; ++bi) {
+        size_t n = bi + 1 < num_batches ? opts.batch_size : nq - bi * opts.batch_size;
+        for(size_t i = 0; i < n; ++i) {
+            bench_read_name(&opts, bench_rand(&state) % opts.num_reads, batch_names[i]);
+        }
+
+        t0 = bri_stats_now();
+        qsort(batch_names, n, sizeof(*batch_names), compare_names);
+        for(size_t i = 0; i < n; ++i) {
+            int ret = bri_itr_query(itr, batch_names[i]);
+            while(ret >= 0 && (ret = bri_itr_next(itr, b)) >= 0) {
+            }
+            if(ret < BRI_ITR_END) {
+                fprintf(stderr, "[bri-bench] failed to fetch %s\n", batch_names[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        batch_latencies[bi] = bri_stats_now() - t0;
+    }
+
+    //
+    // report
+    //
+    const char* name_styles[] = { "uuid", "illumina" };
+    fprintf(out, "{\n");
+    fprintf(out, "  \"version\": \"%s\",\n", BRI_VERSION);
+    fprintf(out, "  \"parameters\": { \"num_reads\": %zu, \"read_length\": %zu, \"name_style\": \"%s\", \"supplementary_rate\": %g, \"num_queries\": %zu, \"batch_size\": %zu, \"seed\": %llu },\n",
+        opts.num_reads, opts.read_length, name_styles[opts.name_style], opts.supplementary_rate,
+        opts.num_queries, opts.batch_size, (unsigned long long)opts.seed);
+    fprintf(out, "  \"data\": { \"records\": %zu, \"bam_bytes\": %zu, \"index_bytes\": %zu, \"generate_s\": %.6f },\n",
+        bri->record_count, bench_file_size(bam_fn), bench_file_size(bri_fn), generate_time);
+    fprintf(out, "  \"build\": { \"total_s\": %.6f", build_time);
+    for(int p = BRI_PHASE_SCAN; p <= BRI_PHASE_RECORD_WRITE; ++p) {
+        fprintf(out, ", \"%s_s\": %.6f", bri_stats_phase_name(p), bri_stats_elapsed(p));
+    }
+    fprintf(out, " },\n");
+    fprintf(out, "  \"scan\": { \"io\": \"%s\", \"cold\": %s, \"bytes_per_s\": %.0f, \"cached_bytes_before\": %lld, \"cached_bytes_after\": %lld },\n",
+        bri_io_policy_name(opts.io_policy), opts.cold ? "true" : "false", scan_time > 0.0 ? bam_bytes / scan_time : 0.0,
+        (long long)cached_before, (long long)cached_after);
+    fprintf(out, "  \"load\": { \"total_s\": %.6f, \"%s_s\": %.6f, \"%s_s\": %.6f },\n", load_time,
+        bri_stats_phase_name(BRI_PHASE_LOAD), bri_stats_elapsed(BRI_PHASE_LOAD),
+        bri_stats_phase_name(BRI_PHASE_FIXUP), bri_stats_elapsed(BRI_PHASE_FIXUP));
+    fprintf(out, "  \"lookup\": {\n");
+    fprintf(out, "    \"hits_found\": %zu,\n", found);
+    fprintf(out, "    \"alignments_fetched\": %zu,\n", fetched);
+    bench_write_latencies(out, "search_hit", hit_latencies, nq, 0);
+    bench_write_latencies(out, "search_miss", miss_latencies, nq, 0);
+    bench_write_latencies(out, "fetch", fetch_latencies, nq, 0);
+    bench_write_latencies(out, "fetch_batch", batch_latencies, num_batches, 1);
+    fprintf(out, "  }\n");
+    fprintf(out, "}\n");
+
+    if(out != stdout) {
+        fclose(out);
+    }
+
+    bam_destroy1(b);
+    bri_itr_destroy(itr);
+    bri_reader_close(reader);
+    free(hit_latencies);
+    free(miss_latencies);
+    free(fetch_latencies);
+    free(batch_latencies);
+    free(batch_names);
+
+    if(!opts.keep) {
+        unlink(bam_fn);
+        unlink(bri_fn);
+    }
+    free(bam_fn);
+    free(bri_fn);
+
+    if(stats_file != NULL && bri_stats_write_json(stats_file, "bench") != 0) {
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
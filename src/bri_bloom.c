@@ -0,0 +1,163 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+
+// for posix_memalign
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "bri_index.h"
+#include "bri_bloom.h"
+
+// the filter never uses more than this many bits per name
+#define BRI_BLOOM_MAX_HASHES 16
+
+//
+bam_read_idx_bloom* bam_read_idx_bloom_init_sized(size_t num_blocks, size_t num_hashes)
+{
+    bam_read_idx_bloom* bloom = malloc(sizeof(bam_read_idx_bloom));
+    if(bloom == NULL) {
+        return NULL;
+    }
+
+    bloom->num_blocks = num_blocks > 0 ? num_blocks : 1;
+    bloom->num_hashes = num_hashes;
+
+    // align to the block size so each block is exactly one cache line
+    size_t bytes = bloom->num_blocks * BRI_BLOOM_BLOCK_WORDS * sizeof(uint64_t);
+    void* bits = NULL;
+    if(posix_memalign(&bits, BRI_BLOOM_BLOCK_WORDS * sizeof(uint64_t), bytes) != 0) {
+        free(bloom);
+        return NULL;
+    }
+    memset(bits, 0, bytes);
+    bloom->bits = bits;
+    return bloom;
+}
+
+//
+bam_read_idx_bloom* bam_read_idx_bloom_init(size_t num_names, double fpr)
+{
+    // standard sizing for a bloom filter with n elements and false positive rate p:
+    // m = -n ln(p) / ln(2)^2 bits and k = (m / n) ln(2) hash functions.
+    // Confining the bits to one block raises the false positive rate over
+    // a standard filter of the same size so we size for a lower rate.
+    double bits_per_name = -log(fpr / 2) / (M_LN2 * M_LN2);
+    size_t num_hashes = (size_t)round(bits_per_name * M_LN2);
+    if(num_hashes < 1) {
+        num_hashes = 1;
+    }
+
+    if(num_hashes > BRI_BLOOM_MAX_HASHES) {
+        num_hashes = BRI_BLOOM_MAX_HASHES;
+    }
+
+    size_t num_bits = (size_t)ceil(bits_per_name * num_names);
+    size_t num_blocks = (num_bits + BRI_BLOOM_BLOCK_BITS - 1) / BRI_BLOOM_BLOCK_BITS;
+    return bam_read_idx_bloom_init_sized(num_blocks, num_hashes);
+}
+
+// pick the block for a name from the high bits of its hash
+static inline uint64_t* bam_read_idx_bloom_block(const bam_read_idx_bloom* bloom, uint64_t h)
+{
+    // map the upper 32 bits onto [0, num_blocks) without a division
+    size_t block = (size_t)(((h >> 32) * (uint64_t)bloom->num_blocks) >> 32);
+    return bloom->bits + block * BRI_BLOOM_BLOCK_WORDS;
+}
+
+// advance the state used to choose the bits set within a block (xorshift64*)
+static inline uint64_t bam_read_idx_bloom_next(uint64_t* state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1dull;
+}
+
+//
+void bam_read_idx_bloom_add(bam_read_idx_bloom* bloom, const char* name)
+{
+    uint64_t h = bam_read_idx_hash_name(name);
+    uint64_t* block = bam_read_idx_bloom_block(bloom, h);
+    uint64_t state = h | 1;
+    for(size_t i = 0; i < bloom->num_hashes; ++i) {
+        size_t bit = (bam_read_idx_bloom_next(&state) >> 32) % BRI_BLOOM_BLOCK_BITS;
+        block[bit / 64] |= (uint64_t)1 << (bit % 64);
+    }
+}
+
+//
+int bam_read_idx_bloom_maybe_contains(const bam_read_idx_bloom* bloom, const char* name)
+{
+    uint64_t h = bam_read_idx_hash_name(name);
+    const uint64_t* block = bam_read_idx_bloom_block(bloom, h);
+    uint64_t state = h | 1;
+    for(size_t i = 0; i < bloom->num_hashes; ++i) {
+        size_t bit = (bam_read_idx_bloom_next(&state) >> 32) % BRI_BLOOM_BLOCK_BITS;
+        if((block[bit / 64] & ((uint64_t)1 << (bit % 64))) == 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+//
+size_t bam_read_idx_bloom_bytes(const bam_read_idx_bloom* bloom)
+{
+    return 2 * sizeof(size_t) + bloom->num_blocks * BRI_BLOOM_BLOCK_WORDS * sizeof(uint64_t);
+}
+
+//
+void bam_read_idx_bloom_write(const bam_read_idx_bloom* bloom, FILE* fp)
+{
+    fwrite(&bloom->num_blocks, sizeof(bloom->num_blocks), 1, fp);
+    fwrite(&bloom->num_hashes, sizeof(bloom->num_hashes), 1, fp);
+    fwrite(bloom->bits, sizeof(uint64_t), bloom->num_blocks * BRI_BLOOM_BLOCK_WORDS, fp);
+}
+
+//
+bam_read_idx_bloom* bam_read_idx_bloom_read(FILE* fp, size_t bytes)
+{
+    size_t dims[2];
+    if(bytes < sizeof(dims) || fread(dims, sizeof(size_t), 2, fp) != 2) {
+        return NULL;
+    }
+
+    // a filter with no hashes would accept every name, and
+    // one with very many would make every lookup slow
+    size_t max_blocks = (SIZE_MAX - sizeof(dims)) / (BRI_BLOOM_BLOCK_WORDS * sizeof(uint64_t));
+    if(dims[0] == 0 || dims[0] > max_blocks || dims[1] < 1 || dims[1] > BRI_BLOOM_MAX_HASHES) {
+        return NULL;
+    }
+
+    size_t num_words = dims[0] * BRI_BLOOM_BLOCK_WORDS;
+    if(bytes != sizeof(dims) + num_words * sizeof(uint64_t)) {
+        return NULL;
+    }
+
+    bam_read_idx_bloom* bloom = bam_read_idx_bloom_init_sized(dims[0], dims[1]);
+    if(bloom == NULL) {
+        return NULL;
+    }
+
+    if(fread(bloom->bits, sizeof(uint64_t), num_words, fp) != num_words) {
+        bam_read_idx_bloom_destroy(bloom);
+        return NULL;
+    }
+    return bloom;
+}
+
+//
+void bam_read_idx_bloom_destroy(bam_read_idx_bloom* bloom)
+{
+    free(bloom->bits);
+    free(bloom);
+}
@@ -0,0 +1,58 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+#ifndef BAM_READ_IDX_BLOOM
+#define BAM_READ_IDX_BLOOM
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+// The filter is split into blocks the size of one cache line.
+// All of the bits for a name are set within a single block so
+// testing a name touches one cache line of the filter.
+#define BRI_BLOOM_BLOCK_WORDS 8
+#define BRI_BLOOM_BLOCK_BITS (BRI_BLOOM_BLOCK_WORDS * 64)
+
+// A blocked bloom filter over the distinct read names in the index,
+// used to reject names that are not in the index without searching
+typedef struct bam_read_idx_bloom
+{
+    size_t num_blocks;
+    size_t num_hashes;
+    uint64_t* bits;
+} bam_read_idx_bloom;
+
+// allocate an empty filter sized for num_names names
+// at the requested false positive rate, returns NULL if out of memory
+bam_read_idx_bloom* bam_read_idx_bloom_init(size_t num_names, double fpr);
+
+// allocate an empty filter with the given dimensions, used when loading
+// from disk. Returns NULL if out of memory.
+bam_read_idx_bloom* bam_read_idx_bloom_init_sized(size_t num_blocks, size_t num_hashes);
+
+// add a name to the filter
+void bam_read_idx_bloom_add(bam_read_idx_bloom* bloom, const char* name);
+
+// returns 0 if name is definitely not in the filter, 1 if it might be
+int bam_read_idx_bloom_maybe_contains(const bam_read_idx_bloom* bloom, const char* name);
+
+// write the filter as an index section payload, see bri_index.h
+void bam_read_idx_bloom_write(const bam_read_idx_bloom* bloom, FILE* fp);
+
+// size in bytes of the section payload written by bam_read_idx_bloom_write
+size_t bam_read_idx_bloom_bytes(const bam_read_idx_bloom* bloom);
+
+// read a filter from a section payload, returns NULL on a read error,
+// if the filter's dimensions are invalid or if out of memory
+bam_read_idx_bloom* bam_read_idx_bloom_read(FILE* fp, size_t bytes);
+
+// deallocate the filter
+void bam_read_idx_bloom_destroy(bam_read_idx_bloom* bloom);
+
+#endif
@@ -0,0 +1,301 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+
+// for fsync, getdelim and ftruncate
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "bri_checkpoint.h"
+
+extern char verbose;
+
+// version of the state file
+#define BRI_CHECKPOINT_VERSION 2
+
+// only look at the clock every this many records
+#define BRI_CHECKPOINT_CHECK_RECORDS 4096
+
+//
+static char* bam_read_idx_checkpoint_filename(const char* dir, const char* name)
+{
+    size_t len = strlen(dir) + strlen(name) + 2;
+    char* filename = malloc(len);
+    if(filename == NULL) {
+        fprintf(stderr, "[bri] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(filename, len, "%s/%s", dir, name);
+    return filename;
+}
+
+// describe the inputs of the build: each file with its size and modification
+// time, so a changed file isn't resumed, followed by the filter and key tag
+static void bam_read_idx_checkpoint_describe(bam_read_idx_checkpoint* ckpt, const char** input_files, size_t num_files)
+{
+    size_t capacity = 128;
+    for(size_t fi = 0; fi < num_files; ++fi) {
+        capacity += strlen(input_files[fi]) + 64;
+    }
+
+    ckpt->description = malloc(capacity);
+    if(ckpt->description == NULL) {
+        fprintf(stderr, "[bri] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t len = 0;
+    for(size_t fi = 0; fi < num_files; ++fi) {
+        struct stat st;
+        if(stat(input_files[fi], &st) != 0) {
+            fprintf(stderr, "[bri] could not open %s\n", input_files[fi]);
+            exit(EXIT_FAILURE);
+        }
+        len += snprintf(ckpt->description + len, capacity - len, "%s\t%lld\t%lld\n",
+            input_files[fi], (long long)st.st_size, (long long)st.st_mtime);
+    }
+
+    const bam_read_idx_filter* filter = &ckpt->bri->filter;
+    len += snprintf(ckpt->description + len, capacity - len, "exclude_flags=%zu min_read_length=%zu key_tag=%s\n",
+        filter->exclude_flags, filter->min_read_length, ckpt->bri->key_tag);
+    ckpt->description_bytes = len;
+}
+
+// read the state file, returning 0 if it is a checkpoint of this build
+static int bam_read_idx_checkpoint_read_state(bam_read_idx_checkpoint* ckpt, size_t* record_count, size_t* resume_offset)
+{
+    FILE* fp = fopen(ckpt->state_fn, "rb");
+    if(fp == NULL) {
+        return -1;
+    }
+
+    int ret = -1;
+    size_t header[3];
+    char* description = malloc(ckpt->description_bytes);
+    if(description != NULL &&
+       fread(header, sizeof(size_t), 3, fp) == 3 &&
+       header[0] == BRI_CHECKPOINT_VERSION && header[1] == ckpt->description_bytes &&
+       fread(description, 1, header[1], fp) == header[1] &&
+       memcmp(description, ckpt->description, header[1]) == 0) {
+
+        // the file being scanned, the offset to resume from, the number of
+        // records, the bytes of the records file, then where each file started
+        // and the source of each file that has been scanned
+        size_t progress[5];
+        bam_read_idx_source* sources = ckpt->bri->sources;
+        if(fread(progress, sizeof(size_t), 5, fp) == 5 && progress[0] < ckpt->num_files && progress[4] == ckpt->num_files &&
+           fread(ckpt->file_first_record, sizeof(size_t), ckpt->num_files, fp) == ckpt->num_files &&
+           fread(sources, sizeof(bam_read_idx_source), ckpt->num_files, fp) == ckpt->num_files) {
+            ckpt->file = progress[0];
+            *resume_offset = progress[1];
+            *record_count = progress[2];
+            ckpt->records_bytes = progress[3];
+            ret = 0;
+        }
+    }
+
+    free(description);
+    fclose(fp);
+    return ret;
+}
+
+// set the start of the names of the files that start at the current record
+static void bam_read_idx_checkpoint_start_names(bam_read_idx_checkpoint* ckpt, size_t* next_file)
+{
+    bam_read_idx* bri = ckpt->bri;
+    while(*next_file <= ckpt->file && ckpt->file_first_record[*next_file] == bri->record_count) {
+        if(bri->file_count > 0) {
+            bri->file_name_starts[*next_file] = bri->name_arena.next;
+        }
+        *next_file += 1;
+    }
+}
+
+// add the records of the checkpoint back to the index, in the order they were added
+static void bam_read_idx_checkpoint_replay(bam_read_idx_checkpoint* ckpt, size_t record_count)
+{
+    FILE* fp = fopen(ckpt->records_fn, "rb");
+    if(fp == NULL) {
+        fprintf(stderr, "[bri] could not open checkpoint %s\n", ckpt->records_fn);
+        exit(EXIT_FAILURE);
+    }
+
+    char* name = NULL;
+    size_t name_capacity = 0;
+    size_t bytes = 0;
+    size_t next_file = 0;
+    while(ckpt->bri->record_count < record_count) {
+        bam_read_idx_checkpoint_start_names(ckpt, &next_file);
+
+        size_t file_offset;
+        ssize_t len = 0;
+        if(fread(&file_offset, sizeof(file_offset), 1, fp) != 1 ||
+           (len = getdelim(&name, &name_capacity, '\0', fp)) <= 0 || name[len - 1] != '\0') {
+            fprintf(stderr, "[bri] checkpoint %s is truncated\n", ckpt->records_fn);
+            exit(EXIT_FAILURE);
+        }
+        bytes += sizeof(file_offset) + len;
+
+        bam_read_idx_add(ckpt->bri, name, file_offset);
+    }
+    bam_read_idx_checkpoint_start_names(ckpt, &next_file);
+
+    if(bytes != ckpt->records_bytes) {
+        fprintf(stderr, "[bri] checkpoint %s doesn't match its state\n", ckpt->records_fn);
+        exit(EXIT_FAILURE);
+    }
+
+    free(name);
+    fclose(fp);
+}
+
+//
+int bam_read_idx_checkpoint_open(bam_read_idx_checkpoint* ckpt, const char* dir, size_t interval,
+                                 const char** input_files, size_t num_files, bam_read_idx* bri,
+                                 size_t* resume_file, size_t* resume_offset)
+{
+    memset(ckpt, 0, sizeof(bam_read_idx_checkpoint));
+    ckpt->bri = bri;
+    ckpt->interval = interval;
+    ckpt->num_files = num_files;
+
+    if(mkdir(dir, 0777) != 0 && errno != EEXIST) {
+        fprintf(stderr, "[bri] could not create checkpoint directory %s\n", dir);
+        exit(EXIT_FAILURE);
+    }
+
+    ckpt->records_fn = bam_read_idx_checkpoint_filename(dir, "records");
+    ckpt->state_fn = bam_read_idx_checkpoint_filename(dir, "state");
+    ckpt->state_tmp_fn = bam_read_idx_checkpoint_filename(dir, "state.tmp");
+    ckpt->file_first_record = calloc(num_files, sizeof(size_t));
+    if(ckpt->file_first_record == NULL) {
+        fprintf(stderr, "[bri] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+    bam_read_idx_checkpoint_describe(ckpt, input_files, num_files);
+
+    size_t record_count = 0;
+    *resume_file = 0;
+    *resume_offset = 0;
+    int resumed = bam_read_idx_checkpoint_read_state(ckpt, &record_count, resume_offset) == 0;
+    if(resumed) {
+        bam_read_idx_checkpoint_replay(ckpt, record_count);
+        *resume_file = ckpt->file;
+        fprintf(stderr, "[bri] resuming from the checkpoint in %s at record %zu of file %s\n", dir, record_count, input_files[ckpt->file]);
+    } else {
+        ckpt->records_bytes = 0;
+        ckpt->file = 0;
+    }
+    ckpt->records_written = record_count;
+
+    // anything written to the records file after the state was saved is discarded
+    ckpt->records_fp = fopen(ckpt->records_fn, resumed ? "r+b" : "wb");
+    if(ckpt->records_fp == NULL || ftruncate(fileno(ckpt->records_fp), ckpt->records_bytes) != 0 ||
+       fseek(ckpt->records_fp, ckpt->records_bytes, SEEK_SET) != 0) {
+        fprintf(stderr, "[bri] could not open checkpoint %s for writing\n", ckpt->records_fn);
+        exit(EXIT_FAILURE);
+    }
+
+    ckpt->last_time = time(NULL);
+    return resumed;
+}
+
+// append the new records then replace the state. The records are synced
+// before the state refers to them, so the state is always consistent.
+static void bam_read_idx_checkpoint_write(bam_read_idx_checkpoint* ckpt, size_t resume_offset)
+{
+    bam_read_idx* bri = ckpt->bri;
+    for(; ckpt->records_written < bri->record_count; ++ckpt->records_written) {
+        const bam_read_idx_record* record = bam_read_idx_build_record(bri, ckpt->records_written);
+        const char* name = bam_read_idx_build_name(bri, record->read_name.offset);
+        size_t len = strlen(name) + 1;
+        if(fwrite(&record->file_offset, sizeof(record->file_offset), 1, ckpt->records_fp) != 1 ||
+           fwrite(name, 1, len, ckpt->records_fp) != len) {
+            break;
+        }
+        ckpt->records_bytes += sizeof(record->file_offset) + len;
+    }
+
+    if(ckpt->records_written < bri->record_count || fflush(ckpt->records_fp) != 0 || fsync(fileno(ckpt->records_fp)) != 0) {
+        fprintf(stderr, "[bri] failed to write checkpoint %s\n", ckpt->records_fn);
+        exit(EXIT_FAILURE);
+    }
+
+    FILE* fp = fopen(ckpt->state_tmp_fn, "wb");
+    size_t header[3] = { BRI_CHECKPOINT_VERSION, ckpt->description_bytes, 0 };
+    size_t progress[5] = { ckpt->file, resume_offset, bri->record_count, ckpt->records_bytes, ckpt->num_files };
+    int ret = fp != NULL &&
+        fwrite(header, sizeof(size_t), 3, fp) == 3 &&
+        fwrite(ckpt->description, 1, ckpt->description_bytes, fp) == ckpt->description_bytes &&
+        fwrite(progress, sizeof(size_t), 5, fp) == 5 &&
+        fwrite(ckpt->file_first_record, sizeof(size_t), ckpt->num_files, fp) == ckpt->num_files &&
+        fwrite(bri->sources, sizeof(bam_read_idx_source), ckpt->num_files, fp) == ckpt->num_files &&
+        fflush(fp) == 0 && fsync(fileno(fp)) == 0 ? 0 : -1;
+
+    if(fp != NULL && fclose(fp) != 0) {
+        ret = -1;
+    }
+
+    if(ret != 0 || rename(ckpt->state_tmp_fn, ckpt->state_fn) != 0) {
+        fprintf(stderr, "[bri] failed to write checkpoint %s\n", ckpt->state_fn);
+        exit(EXIT_FAILURE);
+    }
+
+    if(verbose) {
+        fprintf(stderr, "[bri-build] checkpoint at record %zu\n", bri->record_count);
+    }
+    ckpt->last_time = time(NULL);
+}
+
+//
+void bam_read_idx_checkpoint_start_file(bam_read_idx_checkpoint* ckpt, size_t file)
+{
+    ckpt->file = file;
+    ckpt->file_first_record[file] = ckpt->bri->record_count;
+    bam_read_idx_checkpoint_write(ckpt, 0);
+}
+
+//
+void bam_read_idx_checkpoint_add(void* data, const bam1_t* b, size_t file_offset)
+{
+    bam_read_idx_checkpoint* ckpt = (bam_read_idx_checkpoint*)data;
+
+    // the checkpoint is written before adding this record, so a
+    // resumed build continues by reading it again
+    ckpt->calls += 1;
+    if(ckpt->calls % BRI_CHECKPOINT_CHECK_RECORDS == 0 && (size_t)(time(NULL) - ckpt->last_time) >= ckpt->interval) {
+        bam_read_idx_checkpoint_write(ckpt, file_offset);
+    }
+
+    char buffer[BRI_KEY_BUFFER_SIZE];
+    const char* key = bam_read_idx_key(b, ckpt->bri->key_tag, buffer);
+    if(key != NULL) {
+        bam_read_idx_add(ckpt->bri, key, file_offset);
+        bam_read_idx_build_progress(ckpt->bri);
+    }
+}
+
+//
+void bam_read_idx_checkpoint_finish(bam_read_idx_checkpoint* ckpt)
+{
+    fclose(ckpt->records_fp);
+    remove(ckpt->state_fn);
+    remove(ckpt->records_fn);
+    free(ckpt->records_fn);
+    free(ckpt->state_fn);
+    free(ckpt->state_tmp_fn);
+    free(ckpt->description);
+    free(ckpt->file_first_record);
+    memset(ckpt, 0, sizeof(bam_read_idx_checkpoint));
+}
@@ -0,0 +1,87 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+// Checkpoints of an index build, so a build that is interrupted can be
+// resumed rather than started again. The checkpoint directory holds two
+// files:
+//
+//   records   the records added so far, in the order they were added, as
+//             the file offset followed by the null terminated read name.
+//             New records are appended at each checkpoint.
+//   state     the input files and filter the build was started with,
+//             the file being scanned and the offset of the next alignment
+//             to read from it, how much of the records file is valid and
+//             the sources (see bri_update.h) of the files scanned so far.
+//             It is replaced atomically at each checkpoint.
+//
+// A resumed build adds the checkpointed records back in the same order
+// and continues scanning from the saved offset, so the index it writes
+// is identical to that of an uninterrupted build. Checkpoints are only
+// supported for bam files, without a region filter, as they need the
+// BGZF virtual offset of each alignment.
+//
+#ifndef BAM_READ_IDX_CHECKPOINT
+#define BAM_READ_IDX_CHECKPOINT
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "bri_index.h"
+
+// default number of seconds between checkpoints
+#define BRI_CHECKPOINT_INTERVAL 300
+
+typedef struct bam_read_idx_checkpoint
+{
+    bam_read_idx* bri;
+    char* records_fn;
+    char* state_fn;
+    char* state_tmp_fn;
+
+    // the records file, and the number of records and bytes written to it
+    FILE* records_fp;
+    size_t records_written;
+    size_t records_bytes;
+
+    // the input files and filter, which must match to resume
+    char* description;
+    size_t description_bytes;
+
+    // the file being scanned and the record each file's names start at
+    size_t num_files;
+    size_t file;
+    size_t* file_first_record;
+
+    // time of the last checkpoint and the seconds between them
+    time_t last_time;
+    size_t interval;
+    size_t calls;
+} bam_read_idx_checkpoint;
+
+// start checkpointing the build of bri from input_files into dir, which is
+// created if it doesn't exist. If dir has a checkpoint of a build of the
+// same files with the same filter, its records are added to bri and the
+// file and offset to continue scanning from are returned in resume_file
+// and resume_offset, where an offset of 0 means from the start of the
+// file. The sources of bri must be allocated for num_files, and are
+// restored too. Returns 1 if the build was resumed and 0 if not. Exits on error.
+int bam_read_idx_checkpoint_open(bam_read_idx_checkpoint* ckpt, const char* dir, size_t interval,
+                                 const char** input_files, size_t num_files, bam_read_idx* bri,
+                                 size_t* resume_file, size_t* resume_offset);
+
+// record that scanning of file is starting, checkpointing the records so far
+void bam_read_idx_checkpoint_start_file(bam_read_idx_checkpoint* ckpt, size_t file);
+
+// add a record found while scanning to the index, first writing a
+// checkpoint if it is due. data is the checkpoint, see bam_read_idx_scan_fn.
+void bam_read_idx_checkpoint_add(void* data, const bam1_t* b, size_t file_offset);
+
+// remove the checkpoint once the index has been written
+void bam_read_idx_checkpoint_finish(bam_read_idx_checkpoint* ckpt);
+
+#endif
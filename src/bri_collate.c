@@ -0,0 +1,419 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+// Write every alignment grouped by read name, in index order. The
+// index is walked in windows of records: the alignments of a window
+// are read in file order by a set of worker threads, each with its
+// own file handles, into a reorder buffer which is then written out
+// in name order. A block of the input is inflated about once for each
+// window with alignments in it, so the window is sized to fill a memory
+// budget, making the windows as few and as dense as possible.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <getopt.h>
+#include <pthread.h>
+#include "bri_index.h"
+#include "bri_get.h"
+#include "bri_collate.h"
+#include "bri_stats.h"
+
+// number of bytes of decompressed blocks each worker keeps cached per bam file
+#define BRI_COLLATE_CACHE_SIZE (16 * 1024 * 1024)
+
+// default memory used by the reorder buffer
+#define BRI_COLLATE_MEMORY ((size_t)4 << 30)
+
+// number of alignments read from the start of the first file to
+// estimate how much memory each buffered alignment needs
+#define BRI_COLLATE_SAMPLE_ALIGNMENTS 10000
+
+// an alignment of the current window, to be read into buffer[slot]
+typedef struct collate_entry
+{
+    size_t file_id;
+    size_t file_offset;
+    const bam_read_idx_record* record;
+    size_t slot;
+} collate_entry;
+
+// a thread reading a contiguous range of the window's entries
+typedef struct collate_worker
+{
+    pthread_t thread;
+    bam_read_idx_handles* handles;
+    size_t* positions;
+
+    const collate_entry* entries;
+    size_t start;
+    size_t end;
+    bam1_t** buffer;
+    int ret;
+} collate_worker;
+
+// order entries by file then by offset within the file
+static int compare_collate_entries(const void* a, const void* b)
+{
+    const collate_entry* e1 = a;
+    const collate_entry* e2 = b;
+    if(e1->file_id != e2->file_id) {
+        return e1->file_id < e2->file_id ? -1 : 1;
+    }
+    return e1->file_offset < e2->file_offset ? -1 : (e1->file_offset > e2->file_offset);
+}
+
+// parse a number of bytes with an optional K, M or G suffix.
+// Returns 0 on success and -1 if str isn't a size.
+static int collate_parse_bytes(const char* str, size_t* bytes)
+{
+    char* end = NULL;
+    unsigned long long n = strtoull(str, &end, 10);
+    if(end == str || *str == '-') {
+        return -1;
+    }
+
+    int shift = 0;
+    switch(*end) {
+        case 'k': case 'K': shift = 10; end++; break;
+        case 'm': case 'M': shift = 20; end++; break;
+        case 'g': case 'G': shift = 30; end++; break;
+    }
+
+    if(*end != '\0' || n > (SIZE_MAX >> shift)) {
+        return -1;
+    }
+    *bytes = (size_t)n << shift;
+    return 0;
+}
+
+// estimate the memory a buffered alignment takes from the first alignments
+// of fp, which is left positioned after them. The data of a bam1_t is
+// allocated in powers of two.
+static size_t collate_alignment_bytes(htsFile* fp, bam_hdr_t* h)
+{
+    bam1_t* b = bam_init1();
+    size_t n = 0;
+    size_t data_bytes = 0;
+    while(n < BRI_COLLATE_SAMPLE_ALIGNMENTS && sam_read1(fp, h, b) >= 0) {
+        size_t m = 1;
+        while(m < (size_t)b->l_data) {
+            m <<= 1;
+        }
+        data_bytes += m;
+        n += 1;
+    }
+    bam_destroy1(b);
+    return sizeof(bam1_t) + sizeof(bam1_t*) + sizeof(collate_entry) + (n > 0 ? data_bytes / n : 0);
+}
+
+// read the worker's entries into the reorder buffer
+static void* collate_worker_run(void* arg)
+{
+    collate_worker* worker = arg;
+    worker->ret = 0;
+    for(size_t i = worker->start; i < worker->end; ++i) {
+        const collate_entry* entry = &worker->entries[i];
+        int new_handle = worker->handles->fps[entry->file_id] == NULL;
+
+        bam_hdr_t* h;
+        htsFile* fp = bam_read_idx_handles_get(worker->handles, entry->file_id, &h);
+        if(fp == NULL) {
+            worker->ret = -1;
+            break;
+        }
+
+        if(new_handle && fp->format.format != cram) {
+            hts_set_cache_size(fp, BRI_COLLATE_CACHE_SIZE);
+        }
+
+        if(bam_read_idx_read_record_from(fp, h, worker->buffer[entry->slot], entry->record, &worker->positions[entry->file_id]) != 0) {
+            worker->ret = -1;
+            break;
+        }
+    }
+    return NULL;
+}
+
+//
+// Getopt
+//
+enum {
+    OPT_HELP = 1,
+    OPT_STATS,
+};
+
+static const char* shortopts = ":i:r:o:t:w:m:"; // placeholder
+static const struct option longopts[] = {
+    { "help",                      no_argument,       NULL, OPT_HELP },
+    { "index",               required_argument,       NULL,      'i' },
+    { "reference",           required_argument,       NULL,      'r' },
+    { "output",              required_argument,       NULL,      'o' },
+    { "threads",             required_argument,       NULL,      't' },
+    { "window",              required_argument,       NULL,      'w' },
+    { "memory",              required_argument,       NULL,      'm' },
+    { "stats",               required_argument,       NULL, OPT_STATS },
+    { NULL, 0, NULL, 0 }
+};
+
+void print_usage_collate()
+{
+    fprintf(stderr, "usage: bri collate [-t <threads>] [-m <memory>] [-w <window>] [-o <output.bam>] [-i <index_filename.bri>] [-r <reference.fa>] [--stats <stats.json>] <input.bam|input.cram>\n");
+    fprintf(stderr, "       bri collate [-t <threads>] [-m <memory>] [-w <window>] [-o <output.bam>] -i <multi_file_index.bri> [-r <reference.fa>] [--stats <stats.json>]\n");
+    fprintf(stderr, "  write every indexed alignment to a bam with the alignments of each read together\n");
+    fprintf(stderr, "  -o, --output FILE   write the bam to FILE (default: stdout)\n");
+    fprintf(stderr, "  -t, --threads N     read with N threads and compress the output with N threads (default: 1)\n");
+    fprintf(stderr, "  -m, --memory SIZE   memory used to buffer alignments for reordering, with a K, M or G suffix (default: 4G).\n");
+    fprintf(stderr, "                      Each block of the input is read about once per window of buffered alignments\n");
+    fprintf(stderr, "  -w, --window N      buffer N alignments for reordering, rather than as many as fit in -m\n");
+    fprintf(stderr, "  --stats FILE        write timing and I/O statistics to FILE as JSON\n");
+}
+
+//
+int bam_read_idx_collate_main(int argc, char** argv)
+{
+    char* input_bri = NULL;
+    char* reference = NULL;
+    char* output = "-";
+    char* stats_file = NULL;
+    int num_threads = 1;
+    size_t window = 0;
+    size_t memory = BRI_COLLATE_MEMORY;
+
+    int die = 0;
+    for (char c; (c = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1;) {
+        switch (c) {
+            case OPT_HELP:
+                print_usage_collate();
+                exit(EXIT_SUCCESS);
+            case OPT_STATS:
+                stats_file = optarg;
+                break;
+            case 'i':
+                input_bri = optarg;
+                break;
+            case 'r':
+                reference = optarg;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 't':
+                num_threads = atoi(optarg);
+                break;
+            case 'w':
+                window = strtoull(optarg, NULL, 10);
+                if(window == 0) {
+                    fprintf(stderr, "bri collate: the window must be positive\n");
+                    die = 1;
+                }
+                break;
+            case 'm':
+                if(collate_parse_bytes(optarg, &memory) != 0 || memory == 0) {
+                    fprintf(stderr, "bri collate: %s is not a valid amount of memory\n", optarg);
+                    die = 1;
+                }
+                break;
+            default:
+                die = 1;
+                break;
+        }
+    }
+
+    if (argc - optind < 1 && input_bri == NULL) {
+        fprintf(stderr, "bri collate: not enough arguments\n");
+        die = 1;
+    }
+
+    if(num_threads < 1) {
+        fprintf(stderr, "bri collate: the number of threads must be positive\n");
+        die = 1;
+    }
+
+    if(die) {
+        print_usage_collate();
+        exit(EXIT_FAILURE);
+    }
+
+    bri_stats_enable(stats_file != NULL);
+
+    // an index covering multiple files stores their paths
+    char* input_bam = optind < argc ? argv[optind] : NULL;
+    bam_read_idx* bri = bam_read_idx_load(input_bam, input_bri);
+    if(bri->sparse_interval > 0) {
+        fprintf(stderr, "bri collate: a sparse index doesn't have a record for every alignment\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(bri->format == BRI_FORMAT_FASTQ) {
+        fprintf(stderr, "bri collate: fastq files can't be collated\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(bri->file_count == 0 && input_bam == NULL) {
+        fprintf(stderr, "bri collate: the input bam must be given for a single file index\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // each worker has its own handles so files are read independently
+    collate_worker* workers = calloc(num_threads, sizeof(collate_worker));
+    if(workers == NULL) {
+        fprintf(stderr, "[bri] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(int ti = 0; ti < num_threads; ++ti) {
+        workers[ti].handles = bam_read_idx_handles_init(bri, input_bam, reference);
+        workers[ti].positions = workers[ti].handles != NULL ? malloc(workers[ti].handles->count * sizeof(size_t)) : NULL;
+        if(workers[ti].positions == NULL) {
+            fprintf(stderr, "[bri] malloc failed\n");
+            exit(EXIT_FAILURE);
+        }
+
+        for(size_t fi = 0; fi < workers[ti].handles->count; ++fi) {
+            workers[ti].positions[fi] = BRI_NO_POSITION;
+        }
+    }
+
+    // the output uses the header of the first file, the others must match it
+    bam_read_idx_handles* headers = workers[0].handles;
+    bam_hdr_t* first_hdr = NULL;
+    for(size_t fi = 0; fi < headers->count; ++fi) {
+        bam_hdr_t* h;
+        if(bam_read_idx_handles_get(headers, fi, &h) == NULL) {
+            exit(EXIT_FAILURE);
+        }
+
+        // these handles are read by the first worker
+        if(headers->fps[fi]->format.format != cram) {
+            hts_set_cache_size(headers->fps[fi], BRI_COLLATE_CACHE_SIZE);
+        }
+
+        if(first_hdr == NULL) {
+            first_hdr = h;
+        } else if(!bam_read_idx_headers_compatible(first_hdr, h)) {
+            fprintf(stderr, "[bri] %s has different reference sequences to %s\n", headers->filenames[fi], headers->filenames[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    bam_hdr_t* out_hdr = bam_hdr_dup(first_hdr);
+    if(sam_hdr_update_hd(out_hdr, "SO", "unsorted", "GO", "query") != 0) {
+        sam_hdr_add_line(out_hdr, "HD", "VN", "1.6", "SO", "unsorted", "GO", "query", NULL);
+    }
+
+    htsFile* out_fp = hts_open(output, "wb");
+    if(out_fp == NULL) {
+        fprintf(stderr, "[bri] could not open %s for writing\n", output);
+        exit(EXIT_FAILURE);
+    }
+
+    if(num_threads > 1) {
+        hts_set_threads(out_fp, num_threads);
+    }
+
+    if(sam_hdr_write(out_fp, out_hdr) != 0) {
+        fprintf(stderr, "[bri] could not write the header to %s\n", output);
+        exit(EXIT_FAILURE);
+    }
+
+    // the reorder buffer, reused for every window. Sampling moves the first
+    // file's stream, which the first worker seeks in as its position is unknown.
+    if(window == 0) {
+        size_t alignment_bytes = collate_alignment_bytes(headers->fps[0], first_hdr);
+        window = memory / alignment_bytes > 0 ? memory / alignment_bytes : 1;
+    }
+    window = window < bri->record_count ? window : bri->record_count;
+    collate_entry* entries = malloc((window > 0 ? window : 1) * sizeof(collate_entry));
+    bam1_t** buffer = malloc((window > 0 ? window : 1) * sizeof(bam1_t*));
+    if(entries == NULL || buffer == NULL) {
+        fprintf(stderr, "[bri] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(size_t i = 0; i < window; ++i) {
+        buffer[i] = bam_init1();
+    }
+
+    for(size_t wstart = 0; wstart < bri->record_count; wstart += window) {
+        size_t n = bri->record_count - wstart < window ? bri->record_count - wstart : window;
+        for(size_t i = 0; i < n; ++i) {
+            const bam_read_idx_record* record = &bri->records[wstart + i];
+            entries[i].file_id = bam_read_idx_record_file_id(bri, record);
+            entries[i].file_offset = record->file_offset;
+            entries[i].record = record;
+            entries[i].slot = i;
+        }
+
+        // reading in file order turns the window into a forward scan of each file,
+        // which is split into contiguous pieces for the workers
+        qsort(entries, n, sizeof(collate_entry), compare_collate_entries);
+        for(int ti = 0; ti < num_threads; ++ti) {
+            workers[ti].entries = entries;
+            workers[ti].start = n * ti / num_threads;
+            workers[ti].end = n * (ti + 1) / num_threads;
+            workers[ti].buffer = buffer;
+        }
+
+        if(num_threads == 1) {
+            collate_worker_run(&workers[0]);
+        } else {
+            for(int ti = 0; ti < num_threads; ++ti) {
+                if(pthread_create(&workers[ti].thread, NULL, collate_worker_run, &workers[ti]) != 0) {
+                    fprintf(stderr, "[bri] could not create thread\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+
+            for(int ti = 0; ti < num_threads; ++ti) {
+                pthread_join(workers[ti].thread, NULL);
+            }
+        }
+
+        for(int ti = 0; ti < num_threads; ++ti) {
+            if(workers[ti].ret != 0) {
+                fprintf(stderr, "[bri] failed to read alignments\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        // the buffer is in index order, with alignments grouped by name
+        for(size_t i = 0; i < n; ++i) {
+            if(sam_write1(out_fp, out_hdr, buffer[i]) < 0) {
+                fprintf(stderr, "[bri] sam_write1 failed\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    if(hts_close(out_fp) != 0) {
+        fprintf(stderr, "[bri] could not close %s\n", output);
+        exit(EXIT_FAILURE);
+    }
+
+    for(size_t i = 0; i < window; ++i) {
+        bam_destroy1(buffer[i]);
+    }
+    free(buffer);
+    free(entries);
+    bam_hdr_destroy(out_hdr);
+
+    for(int ti = 0; ti < num_threads; ++ti) {
+        bam_read_idx_handles_destroy(workers[ti].handles);
+        free(workers[ti].positions);
+    }
+    free(workers);
+    bam_read_idx_destroy(bri);
+
+    if(stats_file != NULL && bri_stats_write_json(stats_file, "collate") != 0) {
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
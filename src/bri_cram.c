@@ -0,0 +1,116 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <htslib/hfile.h>
+#include "bri_cram.h"
+#include "bri_stats.h"
+
+//
+size_t* bam_read_idx_cram_container_offsets(const char* filename, size_t* n)
+{
+    // opening the file reads the cram file definition and header container,
+    // leaving the stream at the first data container
+    htsFile* fp = hts_open(filename, "r");
+    if(fp == NULL || fp->format.format != cram) {
+        fprintf(stderr, "[bri] could not open %s as cram\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    cram_fd* fd = fp->fp.cram;
+    hFILE* hfp = cram_fd_get_fp(fd);
+
+    size_t capacity = 1024;
+    size_t count = 0;
+    size_t* offsets = malloc(capacity * sizeof(size_t));
+    if(offsets == NULL) {
+        fprintf(stderr, "[bri] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    while(1) {
+        off_t container_offset = htell(hfp);
+        cram_container* c = cram_read_container(fd);
+        if(c == NULL) {
+            break;
+        }
+
+        // the container length is the size of its payload, which immediately
+        // follows the header we just read
+        int32_t length = cram_container_get_length(c);
+        cram_free_container(c);
+
+        if(count == capacity) {
+            capacity *= 2;
+            offsets = realloc(offsets, capacity * sizeof(size_t));
+            if(offsets == NULL) {
+                fprintf(stderr, "[bri] malloc failed\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        offsets[count++] = container_offset;
+
+        if(hseek(hfp, length, SEEK_CUR) < 0) {
+            fprintf(stderr, "[bri] failed to skip cram container at %zu\n", (size_t)container_offset);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    hts_close(fp);
+    *n = count;
+    return offsets;
+}
+
+// reopen fp and seek to the container at container_offset
+static int bam_read_idx_cram_reopen(htsFile* fp, size_t container_offset)
+{
+    // htslib keeps the most recently decoded container in the cram_fd and continues
+    // reading from it after cram_seek. To make sure the requested container is
+    // decoded we swap in a freshly opened descriptor, which only parses the
+    // (small) file header, before seeking.
+    hFILE* hfp = hopen(fp->fn, "r");
+    if(hfp == NULL) {
+        fprintf(stderr, "[bri] could not reopen %s\n", fp->fn);
+        return -1;
+    }
+
+    cram_fd* fd = cram_dopen(hfp, fp->fn, "r");
+    if(fd == NULL) {
+        fprintf(stderr, "[bri] could not reopen %s\n", fp->fn);
+        hclose(hfp);
+        return -1;
+    }
+
+    if(fp->fn_aux != NULL && cram_set_option(fd, CRAM_OPT_REFERENCE, fp->fn_aux) != 0) {
+        fprintf(stderr, "[bri] could not load reference %s\n", fp->fn_aux);
+        cram_close(fd);
+        return -1;
+    }
+
+    cram_close(fp->fp.cram);
+    fp->fp.cram = fd;
+
+    if(cram_seek(fd, container_offset, SEEK_SET) != 0) {
+        fprintf(stderr, "[bri] cram_seek failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+//
+int bam_read_idx_cram_seek(htsFile* fp, size_t container_offset)
+{
+    bri_stats_start(BRI_PHASE_SEEK);
+    int ret = bam_read_idx_cram_reopen(fp, container_offset);
+    bri_stats_stop(BRI_PHASE_SEEK);
+    bri_stats_count(BRI_COUNTER_SEEKS, 1);
+    return ret;
+}
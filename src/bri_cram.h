@@ -0,0 +1,41 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+#ifndef BAM_READ_IDX_CRAM
+#define BAM_READ_IDX_CRAM
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <htslib/sam.h>
+#include <htslib/hts.h>
+#include <htslib/cram.h>
+
+// CRAM records can't be addressed by a BGZF virtual offset. Instead
+// file_offset stores the offset of the container holding the record
+// in the upper bits and the ordinal of the record within that container
+// in the lower BRI_CRAM_ORDINAL_BITS bits. Slices aren't addressed, so
+// fetching a record decodes the slices of its container up to the one
+// holding it, which is at most the whole container.
+#define BRI_CRAM_ORDINAL_BITS 20
+#define BRI_CRAM_MAX_ORDINAL ((1ul << BRI_CRAM_ORDINAL_BITS) - 1)
+#define BRI_CRAM_OFFSET(container, ordinal) (((size_t)(container) << BRI_CRAM_ORDINAL_BITS) | (size_t)(ordinal))
+#define BRI_CRAM_CONTAINER(file_offset) ((size_t)(file_offset) >> BRI_CRAM_ORDINAL_BITS)
+#define BRI_CRAM_ORDINAL(file_offset) ((size_t)(file_offset) & BRI_CRAM_MAX_ORDINAL)
+
+// scan the container headers of the cram file and return the offset of each container,
+// skipping over the container payloads. The number of containers is written to n.
+// The caller must free the returned pointer.
+size_t* bam_read_idx_cram_container_offsets(const char* filename, size_t* n);
+
+// position fp at the start of the container at container_offset,
+// discarding any partially read container. Returns 0 on success, -1 on error.
+int bam_read_idx_cram_seek(htsFile* fp, size_t container_offset);
+
+#endif
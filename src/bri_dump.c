@@ -0,0 +1,608 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <getopt.h>
+#include <pthread.h>
+#include "bri_index.h"
+#include "bri_dump.h"
+#include "bri_stats.h"
+
+// names are read from the index in chunks of at least this many bytes
+#define BRI_DUMP_NAME_CHUNK (16 * 1024 * 1024)
+
+// records are read and formatted this many at a time
+#define BRI_DUMP_BATCH_RECORDS (1024 * 1024)
+
+// the index file, read through a stream for each of the names, the
+// records and the record file IDs
+typedef struct bri_dump_input
+{
+    FILE* names_fp;
+    FILE* records_fp;
+    FILE* ids_fp;
+
+    // layout of the file
+    size_t name_bytes;
+    size_t record_count;
+    size_t file_count;
+    size_t shard_count;
+    size_t shard;
+
+    // bytes of the name block and records read so far
+    size_t names_read;
+    size_t records_read;
+
+    // names read from the file, names[0] is at names_start in the name block
+    char* names;
+    size_t names_start;
+    size_t names_length;
+    size_t names_capacity;
+
+    // records of the current batch
+    bam_read_idx_record* records;
+    uint16_t* file_ids;
+} bri_dump_input;
+
+// the rows to output for the current batch
+typedef struct bri_dump_batch
+{
+    size_t n;
+    const char** names;
+    const uint64_t* offsets;
+    const uint16_t* file_ids;
+} bri_dump_batch;
+
+// a range of the batch to format, and the output it was formatted into
+typedef struct bri_dump_part
+{
+    const bri_dump_batch* batch;
+    size_t start;
+    size_t end;
+    int columns;
+    int binary;
+
+    char* out;
+    size_t out_length;
+    size_t out_capacity;
+} bri_dump_part;
+
+//
+static int bri_dump_open(bri_dump_input* input, const char* filename)
+{
+    memset(input, 0, sizeof(bri_dump_input));
+    input->names_fp = fopen(filename, "rb");
+    input->records_fp = fopen(filename, "rb");
+    if(input->names_fp == NULL || input->records_fp == NULL) {
+        fprintf(stderr, "[bri] index file %s not found\n", filename);
+        return -1;
+    }
+
+    size_t header[3];
+    if(fread(header, sizeof(size_t), 3, input->names_fp) != 3) {
+        fprintf(stderr, "[bri] failed to read index file %s\n", filename);
+        return -1;
+    }
+
+    if(header[0] > BRI_FILE_VERSION) {
+        fprintf(stderr, "[bri] index version %zu is newer than supported (%d)\n", header[0], BRI_FILE_VERSION);
+        return -1;
+    }
+    input->name_bytes = header[1];
+    input->record_count = header[2];
+
+    // find the sections needed, the number of files and where the file IDs are stored
+    size_t records_start = sizeof(header) + input->name_bytes;
+    size_t ids_start = 0;
+    size_t section_header[2];
+    if(header[0] >= 2 && fseek(input->names_fp, records_start + input->record_count * sizeof(bam_read_idx_record), SEEK_SET) == 0) {
+        while(fread(section_header, sizeof(size_t), 2, input->names_fp) == 2) {
+            size_t tag = section_header[0];
+            size_t bytes = section_header[1];
+            int ret = 0;
+            if(tag == BRI_SECTION_FILES) {
+                for(size_t i = 0; i < bytes && ret == 0; ++i) {
+                    int c = fgetc(input->names_fp);
+                    input->file_count += c == '\0';
+                    ret = c == EOF ? -1 : 0;
+                }
+            } else if(tag == BRI_SECTION_SHARDS && bytes == 2 * sizeof(size_t)) {
+                size_t shards[2];
+                ret = fread(shards, sizeof(size_t), 2, input->names_fp) == 2 ? 0 : -1;
+                input->shard_count = shards[0];
+                input->shard = shards[1];
+            } else {
+                if(tag == BRI_SECTION_FILE_IDS && bytes == input->record_count * sizeof(uint16_t)) {
+                    ids_start = ftell(input->names_fp);
+                }
+                ret = fseek(input->names_fp, bytes, SEEK_CUR);
+            }
+
+            if(ret != 0) {
+                fprintf(stderr, "[bri] failed to read index file %s\n", filename);
+                return -1;
+            }
+        }
+    }
+
+    if(input->shard_count > 0 && input->shard == input->shard_count) {
+        fprintf(stderr, "[bri] %s is the manifest of a sharded index, dump each of its shards (%s.0 ...)\n", filename, filename);
+        return -1;
+    }
+
+    if(ids_start > 0) {
+        input->ids_fp = fopen(filename, "rb");
+        if(input->ids_fp == NULL || fseek(input->ids_fp, ids_start, SEEK_SET) != 0) {
+            fprintf(stderr, "[bri] failed to read index file %s\n", filename);
+            return -1;
+        }
+    }
+
+    if(fseek(input->names_fp, sizeof(header), SEEK_SET) != 0 || fseek(input->records_fp, records_start, SEEK_SET) != 0) {
+        fprintf(stderr, "[bri] failed to read index file %s\n", filename);
+        return -1;
+    }
+
+    input->records = malloc(BRI_DUMP_BATCH_RECORDS * sizeof(bam_read_idx_record));
+    input->file_ids = malloc(BRI_DUMP_BATCH_RECORDS * sizeof(uint16_t));
+    if(input->records == NULL || input->file_ids == NULL) {
+        fprintf(stderr, "[bri] malloc failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+//
+static void bri_dump_close(bri_dump_input* input)
+{
+    if(input->names_fp != NULL) {
+        fclose(input->names_fp);
+    }
+
+    if(input->records_fp != NULL) {
+        fclose(input->records_fp);
+    }
+
+    if(input->ids_fp != NULL) {
+        fclose(input->ids_fp);
+    }
+    free(input->names);
+    free(input->records);
+    free(input->file_ids);
+}
+
+// discard the names before offset in the name block, then read
+// at least one more chunk of names. Returns 0 if there were no
+// more names to read. Exits if the file can't be read.
+static int bri_dump_read_names(bri_dump_input* input, size_t offset)
+{
+    if(input->names_read == input->name_bytes) {
+        return 0;
+    }
+
+    // the names are read in order, so names past those read so far can't be skipped
+    assert(offset >= input->names_start);
+    size_t discard = offset - input->names_start;
+    discard = discard < input->names_length ? discard : input->names_length;
+    if(discard > 0) {
+        memmove(input->names, input->names + discard, input->names_length - discard);
+        input->names_start += discard;
+        input->names_length -= discard;
+    }
+
+    if(input->names_capacity - input->names_length < BRI_DUMP_NAME_CHUNK) {
+        input->names_capacity = input->names_length + BRI_DUMP_NAME_CHUNK;
+        input->names = realloc(input->names, input->names_capacity);
+        if(input->names == NULL) {
+            fprintf(stderr, "[bri] malloc failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    size_t n = input->names_capacity - input->names_length;
+    n = n < input->name_bytes - input->names_read ? n : input->name_bytes - input->names_read;
+    if(fread(input->names + input->names_length, 1, n, input->names_fp) != n) {
+        fprintf(stderr, "[bri] failed to read names from index file\n");
+        exit(EXIT_FAILURE);
+    }
+    input->names_length += n;
+    input->names_read += n;
+    return 1;
+}
+
+// fill batch with the next distinct names, returns the number of names
+static size_t bri_dump_next_names(bri_dump_input* input, bri_dump_batch* batch, const char** names)
+{
+    // the names of the last batch have been written, keep the partial name after them
+    const char* next = input->names;
+    if(batch->n > 0) {
+        next = batch->names[batch->n - 1] + strlen(batch->names[batch->n - 1]) + 1;
+    }
+    size_t offset = input->names_start + (next - input->names);
+
+    batch->n = 0;
+    while(1) {
+        const char* name = input->names + (offset - input->names_start);
+        const char* end = input->names + input->names_length;
+        const char* name_end;
+        while(batch->n < BRI_DUMP_BATCH_RECORDS && name < end && (name_end = memchr(name, '\0', end - name)) != NULL) {
+            names[batch->n++] = name;
+            name = name_end + 1;
+        }
+
+        if(batch->n > 0) {
+            break;
+        }
+
+        // only part of a name is left, read more
+        if(!bri_dump_read_names(input, offset)) {
+            if(input->names_start + input->names_length != offset) {
+                fprintf(stderr, "[bri] the last name in the index is not terminated\n");
+                exit(EXIT_FAILURE);
+            }
+            return 0;
+        }
+    }
+    batch->names = names;
+    return batch->n;
+}
+
+// fill batch with the next records and their names, returns the number of records
+static size_t bri_dump_next_records(bri_dump_input* input, bri_dump_batch* batch, const char** names, uint64_t* offsets)
+{
+    size_t n = input->record_count - input->records_read;
+    n = n < BRI_DUMP_BATCH_RECORDS ? n : BRI_DUMP_BATCH_RECORDS;
+    batch->n = n;
+    if(n == 0) {
+        return 0;
+    }
+
+    if(fread(input->records, sizeof(bam_read_idx_record), n, input->records_fp) != n ||
+       (input->ids_fp != NULL && fread(input->file_ids, sizeof(uint16_t), n, input->ids_fp) != n)) {
+        fprintf(stderr, "[bri] failed to read records from index file\n");
+        exit(EXIT_FAILURE);
+    }
+    input->records_read += n;
+
+    // the records are in name order so their names are in the order they
+    // are stored, read until the name of the last record is complete
+    size_t first = input->records[0].read_name.offset;
+    size_t last = input->records[n - 1].read_name.offset;
+    if(first < input->names_start || last >= input->name_bytes) {
+        fprintf(stderr, "[bri] the records of the index are not in name order\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t keep = first;
+    while(last >= input->names_start + input->names_length ||
+          memchr(input->names + (last - input->names_start), '\0', input->names_start + input->names_length - last) == NULL) {
+        if(!bri_dump_read_names(input, keep)) {
+            fprintf(stderr, "[bri] the last name in the index is not terminated\n");
+            exit(EXIT_FAILURE);
+        }
+        keep = input->names_start;
+    }
+
+    size_t prev = first;
+    for(size_t i = 0; i < n; ++i) {
+        size_t offset = input->records[i].read_name.offset;
+        if(offset < prev) {
+            fprintf(stderr, "[bri] the records of the index are not in name order\n");
+            exit(EXIT_FAILURE);
+        }
+        names[i] = input->names + (offset - input->names_start);
+        offsets[i] = input->records[i].file_offset;
+        prev = offset;
+    }
+
+    batch->names = names;
+    batch->offsets = offsets;
+    batch->file_ids = input->ids_fp != NULL ? input->file_ids : NULL;
+    return n;
+}
+
+//
+// Formatting
+//
+
+// make room for bytes more output
+static char* bri_dump_reserve(bri_dump_part* part, size_t bytes)
+{
+    if(part->out_length + bytes > part->out_capacity) {
+        part->out_capacity = 2 * (part->out_length + bytes);
+        part->out = realloc(part->out, part->out_capacity);
+        if(part->out == NULL) {
+            fprintf(stderr, "[bri] malloc failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return part->out + part->out_length;
+}
+
+// write v in decimal to out, returns the number of digits
+static size_t bri_dump_format_uint(uint64_t v, char* out)
+{
+    char digits[20];
+    size_t n = 0;
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while(v > 0);
+
+    for(size_t i = 0; i < n; ++i) {
+        out[i] = digits[n - 1 - i];
+    }
+    return n;
+}
+
+//
+static void bri_dump_format_tsv(bri_dump_part* part)
+{
+    const bri_dump_batch* batch = part->batch;
+    for(size_t i = part->start; i < part->end; ++i) {
+        size_t len = strlen(batch->names[i]);
+
+        // name, then a tab and up to 20 digits for each number
+        char* out = bri_dump_reserve(part, len + 2 * 21 + 1);
+        char* p = out;
+        memcpy(p, batch->names[i], len);
+        p += len;
+
+        if(part->columns & BRI_DUMP_COLUMN_FILE_ID) {
+            *p++ = '\t';
+            p += bri_dump_format_uint(batch->file_ids != NULL ? batch->file_ids[i] : 0, p);
+        }
+
+        if(part->columns & BRI_DUMP_COLUMN_OFFSET) {
+            *p++ = '\t';
+            p += bri_dump_format_uint(batch->offsets[i], p);
+        }
+        *p++ = '\n';
+        part->out_length += p - out;
+    }
+}
+
+//
+static void bri_dump_format_binary(bri_dump_part* part)
+{
+    const bri_dump_batch* batch = part->batch;
+    uint64_t block[2] = { part->end - part->start, 0 };
+    for(size_t i = part->start; i < part->end; ++i) {
+        block[1] += strlen(batch->names[i]) + 1;
+    }
+
+    memcpy(bri_dump_reserve(part, sizeof(block)), block, sizeof(block));
+    part->out_length += sizeof(block);
+
+    for(size_t i = part->start; i < part->end; ++i) {
+        size_t len = strlen(batch->names[i]) + 1;
+        memcpy(bri_dump_reserve(part, len), batch->names[i], len);
+        part->out_length += len;
+    }
+
+    if(part->columns & BRI_DUMP_COLUMN_OFFSET) {
+        size_t bytes = block[0] * sizeof(uint64_t);
+        memcpy(bri_dump_reserve(part, bytes), batch->offsets + part->start, bytes);
+        part->out_length += bytes;
+    }
+
+    if(part->columns & BRI_DUMP_COLUMN_FILE_ID) {
+        size_t bytes = block[0] * sizeof(uint16_t);
+        char* out = bri_dump_reserve(part, bytes);
+        if(batch->file_ids != NULL) {
+            memcpy(out, batch->file_ids + part->start, bytes);
+        } else {
+            memset(out, 0, bytes);
+        }
+        part->out_length += bytes;
+    }
+}
+
+//
+static void* bri_dump_format(void* data)
+{
+    bri_dump_part* part = (bri_dump_part*)data;
+    part->out_length = 0;
+    if(part->start == part->end) {
+        return NULL;
+    }
+
+    if(part->binary) {
+        bri_dump_format_binary(part);
+    } else {
+        bri_dump_format_tsv(part);
+    }
+    return NULL;
+}
+
+//
+static void bri_dump_write(const void* data, size_t bytes)
+{
+    if(fwrite(data, 1, bytes, stdout) != bytes) {
+        fprintf(stderr, "[bri] failed to write output\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// format the batch in num_parts ranges, each in its own thread,
+// then write them out in order
+static void bri_dump_batch_write(const bri_dump_batch* batch, bri_dump_part* parts, size_t num_parts)
+{
+    pthread_t* threads = num_parts > 1 ? malloc((num_parts - 1) * sizeof(pthread_t)) : NULL;
+    for(size_t i = 0; i < num_parts; ++i) {
+        parts[i].batch = batch;
+        parts[i].start = batch->n * i / num_parts;
+        parts[i].end = batch->n * (i + 1) / num_parts;
+        if(i > 0 && (threads == NULL || pthread_create(&threads[i - 1], NULL, bri_dump_format, &parts[i]) != 0)) {
+            fprintf(stderr, "[bri] failed to start formatting thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    bri_dump_format(&parts[0]);
+    for(size_t i = 1; i < num_parts; ++i) {
+        pthread_join(threads[i - 1], NULL);
+    }
+    free(threads);
+
+    for(size_t i = 0; i < num_parts; ++i) {
+        bri_dump_write(parts[i].out, parts[i].out_length);
+    }
+}
+
+//
+// Getopt
+//
+enum {
+    OPT_HELP = 1,
+    OPT_STATS,
+};
+
+static const char* shortopts = ":obt:"; // placeholder
+static const struct option longopts[] = {
+    { "help",                      no_argument,       NULL, OPT_HELP },
+    { "offsets",                   no_argument,       NULL,      'o' },
+    { "binary",                    no_argument,       NULL,      'b' },
+    { "threads",             required_argument,       NULL,      't' },
+    { "stats",               required_argument,       NULL, OPT_STATS },
+    { NULL, 0, NULL, 0 }
+};
+
+//
+void print_usage_dump()
+{
+    fprintf(stderr, "usage: bri dump [-o] [-b] [-t <threads>] [--stats <stats.json>] <index_filename.bri>\n");
+    fprintf(stderr, "  -o, --offsets       write a row for each record with its name, file ID (for a multi-file index)\n");
+    fprintf(stderr, "                      and offset, rather than a row for each distinct name\n");
+    fprintf(stderr, "  -b, --binary        write the rows in blocks of columns, see bri_dump.h, rather than as tsv\n");
+    fprintf(stderr, "  -t, --threads N     format the rows with N threads\n");
+    fprintf(stderr, "  --stats FILE        write timing statistics to FILE as JSON\n");
+}
+
+//
+int bam_read_idx_dump_main(int argc, char** argv)
+{
+    char* stats_file = NULL;
+    int offsets = 0;
+    int binary = 0;
+    int threads = 1;
+
+    int die = 0;
+    for (char c; (c = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1;) {
+        switch (c) {
+            case OPT_HELP:
+                print_usage_dump();
+                exit(EXIT_SUCCESS);
+            case OPT_STATS:
+                stats_file = optarg;
+                break;
+            case 'o':
+                offsets = 1;
+                break;
+            case 'b':
+                binary = 1;
+                break;
+            case 't':
+                threads = atoi(optarg);
+                if(threads < 1) {
+                    fprintf(stderr, "bri dump: the number of threads must be positive\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                die = 1;
+        }
+    }
+
+    if (argc - optind != 1) {
+        fprintf(stderr, "bri dump: expected one index file\n");
+        die = 1;
+    }
+
+    if(die) {
+        print_usage_dump();
+        exit(EXIT_FAILURE);
+    }
+
+    bri_stats_enable(stats_file != NULL);
+    const char* input_bri = argv[optind++];
+
+    bri_dump_input input;
+    if(bri_dump_open(&input, input_bri) != 0) {
+        bri_dump_close(&input);
+        exit(EXIT_FAILURE);
+    }
+
+    int columns = BRI_DUMP_COLUMN_NAME;
+    if(offsets) {
+        columns |= BRI_DUMP_COLUMN_OFFSET;
+        columns |= input.file_count > 1 ? BRI_DUMP_COLUMN_FILE_ID : 0;
+    }
+
+    const char** names = malloc(BRI_DUMP_BATCH_RECORDS * sizeof(const char*));
+    uint64_t* file_offsets = offsets ? malloc(BRI_DUMP_BATCH_RECORDS * sizeof(uint64_t)) : NULL;
+    bri_dump_part* parts = calloc(threads, sizeof(bri_dump_part));
+    if(names == NULL || (offsets && file_offsets == NULL) || parts == NULL) {
+        fprintf(stderr, "[bri] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(int i = 0; i < threads; ++i) {
+        parts[i].columns = columns;
+        parts[i].binary = binary;
+    }
+
+    if(binary) {
+        uint32_t header[2] = { BRI_DUMP_VERSION, columns };
+        bri_dump_write("BRID", 4);
+        bri_dump_write(header, sizeof(header));
+    }
+
+    bri_dump_batch batch;
+    memset(&batch, 0, sizeof(batch));
+    while(1) {
+        bri_stats_start(BRI_PHASE_LOAD);
+        size_t n = offsets ? bri_dump_next_records(&input, &batch, names, file_offsets)
+                           : bri_dump_next_names(&input, &batch, names);
+        bri_stats_stop(BRI_PHASE_LOAD);
+        if(n == 0) {
+            break;
+        }
+
+        bri_stats_start(BRI_PHASE_OUTPUT);
+        bri_dump_batch_write(&batch, parts, threads);
+        bri_stats_stop(BRI_PHASE_OUTPUT);
+    }
+
+    if(binary) {
+        uint64_t end_block[2] = { 0, 0 };
+        bri_dump_write(end_block, sizeof(end_block));
+    }
+
+    if(fflush(stdout) != 0) {
+        fprintf(stderr, "[bri] failed to write output\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(int i = 0; i < threads; ++i) {
+        free(parts[i].out);
+    }
+    free(parts);
+    free(names);
+    free(file_offsets);
+    bri_dump_close(&input);
+
+    if(stats_file != NULL && bri_stats_write_json(stats_file, "dump") != 0) {
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
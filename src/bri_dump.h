@@ -0,0 +1,43 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+// Export the contents of an index without loading it. The names and
+// records are both stored in name order, so they are read from the
+// file in parallel streams, a batch at a time, and memory use doesn't
+// depend on the size of the index.
+//
+// The binary output is a header followed by blocks of rows, which
+// are stored column by column:
+//
+//   char magic[4] = "BRID", uint32_t version = 1, uint32_t columns
+//   then for each block:
+//     uint64_t rows, uint64_t name_bytes
+//     char names[name_bytes]             rows null terminated names
+//     uint64_t offsets[rows]             if columns has BRI_DUMP_COLUMN_OFFSET
+//     uint16_t file_ids[rows]            if columns has BRI_DUMP_COLUMN_FILE_ID
+//   ending with a block of 0 rows
+//
+// Integers are written in the byte order of the machine.
+//
+#ifndef BAM_READ_IDX_DUMP
+#define BAM_READ_IDX_DUMP
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BRI_DUMP_VERSION 1
+
+// the columns present in the output
+#define BRI_DUMP_COLUMN_NAME 1
+#define BRI_DUMP_COLUMN_OFFSET 2
+#define BRI_DUMP_COLUMN_FILE_ID 4
+
+// main of the "dump" subprogram
+int bam_read_idx_dump_main(int argc, char** argv);
+
+#endif
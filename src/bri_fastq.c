@@ -0,0 +1,95 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "bri_fastq.h"
+#include "bri_stats.h"
+
+// the number of lines in a fastq record
+#define BRI_FASTQ_LINES 4
+
+// read the lines of the record following its header into line, checking the
+// separator. Returns 0 on success, -1 if the record is truncated or malformed.
+static int bam_read_idx_fastq_read_body(BGZF* fp, kstring_t* line, kstring_t* out)
+{
+    for(int i = 1; i < BRI_FASTQ_LINES; ++i) {
+        if(bgzf_getline(fp, '\n', line) < 0 || (i == 2 && (line->l == 0 || line->s[0] != '+'))) {
+            return -1;
+        }
+
+        if(out != NULL) {
+            kputsn(line->s, line->l, out);
+            kputc('\n', out);
+        }
+    }
+    return 0;
+}
+
+//
+void bam_read_idx_scan_fastq(const char* filename, BGZF* fp, bri_io_stream* stream, bam_read_idx* bri)
+{
+    kstring_t line = { 0, 0, NULL };
+    size_t start_offset = bgzf_tell(fp);
+    size_t records = 0;
+    while(1) {
+        size_t offset = bgzf_tell(fp);
+        int ret = bgzf_getline(fp, '\n', &line);
+        if(ret == -1) {
+            break;
+        }
+
+        if(ret < -1 || line.l < 2 || line.s[0] != '@') {
+            fprintf(stderr, "[bri] %s: expected a fastq header for record %zu\n", filename, records + 1);
+            exit(EXIT_FAILURE);
+        }
+
+        // the read ID ends at the first whitespace, which starts the comment
+        size_t len = strcspn(line.s + 1, " \t");
+        line.s[len + 1] = '\0';
+        bam_read_idx_add(bri, line.s + 1, offset);
+        bam_read_idx_build_progress(bri);
+        bri_io_stream_update(stream, fp->fp);
+
+        if(bam_read_idx_fastq_read_body(fp, &line, NULL) != 0) {
+            fprintf(stderr, "[bri] %s: fastq record %zu is truncated or not four lines\n", filename, records + 1);
+            exit(EXIT_FAILURE);
+        }
+        records += 1;
+    }
+
+    // virtual offsets of the same block differ by the offset within the block
+    bri_stats_count(BRI_COUNTER_BYTES_READ, (bgzf_tell(fp) >> 16) - (start_offset >> 16));
+    free(line.s);
+}
+
+//
+int bam_read_idx_fastq_read_record(BGZF* fp, size_t offset, kstring_t* str)
+{
+    if(bri_stats_bgzf_seek(fp, offset) != 0) {
+        fprintf(stderr, "[bri] bgzf_seek failed\n");
+        return -1;
+    }
+
+    kstring_t line = { 0, 0, NULL };
+    str->l = 0;
+    int ret = -1;
+    if(bgzf_getline(fp, '\n', &line) >= 0 && line.l > 0 && line.s[0] == '@') {
+        kputsn(line.s, line.l, str);
+        kputc('\n', str);
+        ret = bam_read_idx_fastq_read_body(fp, &line, str);
+    }
+
+    if(ret != 0) {
+        fprintf(stderr, "[bri] could not read a fastq record at offset %zu\n", offset);
+    }
+    free(line.s);
+    return ret;
+}
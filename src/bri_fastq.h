@@ -0,0 +1,32 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+// Indexing of bgzip compressed fastq files. Each record is indexed
+// by the read ID, the header line up to the first whitespace, at
+// the virtual offset of its header line. Records must be four lines
+// (header, sequence, separator, qualities).
+//
+#ifndef BAM_READ_IDX_FASTQ
+#define BAM_READ_IDX_FASTQ
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <htslib/bgzf.h>
+#include <htslib/kstring.h>
+#include "bri_index.h"
+
+// read every record of fp, a bgzf compressed fastq file opened from
+// filename, adding it to the index. stream is the I/O policy's stream of the
+// file, or NULL, see bri_io.h. Exits if the file is malformed.
+void bam_read_idx_scan_fastq(const char* filename, BGZF* fp, bri_io_stream* stream, bam_read_idx* bri);
+
+// read the four lines of the fastq record at virtual offset into str, each
+// followed by a newline. Returns 0 on success and -1 on error.
+int bam_read_idx_fastq_read_record(BGZF* fp, size_t offset, kstring_t* str);
+
+#endif
@@ -0,0 +1,127 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "bri_filter.h"
+
+//
+void bam_read_idx_filter_init(bam_read_idx_filter* filter)
+{
+    filter->exclude_flags = 0;
+    filter->min_read_length = 0;
+    filter->region = NULL;
+}
+
+//
+int bam_read_idx_filter_is_set(const bam_read_idx_filter* filter)
+{
+    return filter->exclude_flags != 0 || filter->min_read_length > 0 || filter->region != NULL;
+}
+
+//
+int bam_read_idx_filter_resolve(const bam_read_idx_filter* filter, bam_hdr_t* h, bam_read_idx_filter_region* region)
+{
+    region->tid = -1;
+    region->beg = 0;
+    region->end = 0;
+    if(filter->region == NULL) {
+        return 0;
+    }
+
+    if(sam_parse_region(h, filter->region, &region->tid, &region->beg, &region->end, 0) == NULL || region->tid < 0) {
+        fprintf(stderr, "[bri] could not parse region %s\n", filter->region);
+        return -1;
+    }
+    return 0;
+}
+
+//
+size_t bam_read_idx_filter_read_length(const bam1_t* b)
+{
+    // unmapped reads have no cigar, otherwise count the
+    // bases consumed from the read and those hard clipped
+    if(b->core.n_cigar == 0) {
+        return b->core.l_qseq;
+    }
+
+    const uint32_t* cigar = bam_get_cigar(b);
+    size_t length = 0;
+    for(uint32_t i = 0; i < b->core.n_cigar; ++i) {
+        int op = bam_cigar_op(cigar[i]);
+        if((bam_cigar_type(op) & 1) || op == BAM_CHARD_CLIP) {
+            length += bam_cigar_oplen(cigar[i]);
+        }
+    }
+    return length;
+}
+
+//
+int bam_read_idx_filter_pass(const bam_read_idx_filter* filter, const bam_read_idx_filter_region* region, const bam1_t* b)
+{
+    if(b->core.flag & filter->exclude_flags) {
+        return 0;
+    }
+
+    if(filter->min_read_length > 0 && bam_read_idx_filter_read_length(b) < filter->min_read_length) {
+        return 0;
+    }
+
+    if(filter->region != NULL &&
+       (b->core.tid != region->tid || b->core.pos >= region->end || bam_endpos(b) <= region->beg)) {
+        return 0;
+    }
+    return 1;
+}
+
+//
+size_t bam_read_idx_filter_bytes(const bam_read_idx_filter* filter)
+{
+    size_t region_bytes = filter->region != NULL ? strlen(filter->region) : 0;
+    return 2 * sizeof(size_t) + region_bytes;
+}
+
+//
+void bam_read_idx_filter_write(const bam_read_idx_filter* filter, FILE* fp)
+{
+    // the region, if any, takes up the rest of the payload
+    fwrite(&filter->exclude_flags, sizeof(filter->exclude_flags), 1, fp);
+    fwrite(&filter->min_read_length, sizeof(filter->min_read_length), 1, fp);
+    if(filter->region != NULL) {
+        fwrite(filter->region, 1, strlen(filter->region), fp);
+    }
+}
+
+//
+int bam_read_idx_filter_read(bam_read_idx_filter* filter, FILE* fp, size_t bytes)
+{
+    if(bytes < 2 * sizeof(size_t) ||
+       fread(&filter->exclude_flags, sizeof(filter->exclude_flags), 1, fp) != 1 ||
+       fread(&filter->min_read_length, sizeof(filter->min_read_length), 1, fp) != 1) {
+        return -1;
+    }
+
+    size_t region_bytes = bytes - 2 * sizeof(size_t);
+    if(region_bytes > 0) {
+        filter->region = malloc(region_bytes + 1);
+        if(filter->region == NULL || fread(filter->region, 1, region_bytes, fp) != region_bytes) {
+            return -1;
+        }
+        filter->region[region_bytes] = '\0';
+    }
+    return 0;
+}
+
+//
+void bam_read_idx_filter_destroy(bam_read_idx_filter* filter)
+{
+    free(filter->region);
+    filter->region = NULL;
+}
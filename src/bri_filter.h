@@ -0,0 +1,70 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+#ifndef BAM_READ_IDX_FILTER
+#define BAM_READ_IDX_FILTER
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <htslib/sam.h>
+
+// Selects the alignments that are added to an index. An index built
+// with a filter only has records for the alignments that pass it, and
+// stores the filter so the index can be checked against its files.
+typedef struct bam_read_idx_filter
+{
+    // alignments with any of these flags set are skipped
+    size_t exclude_flags;
+
+    // alignments of reads shorter than this are skipped
+    size_t min_read_length;
+
+    // if not NULL, only alignments overlapping this region
+    // (in samtools chr:start-end syntax) are indexed
+    char* region;
+} bam_read_idx_filter;
+
+// A filter region resolved against the header of one file
+typedef struct bam_read_idx_filter_region
+{
+    int tid;
+    hts_pos_t beg;
+    hts_pos_t end;
+} bam_read_idx_filter_region;
+
+// initialize a filter that accepts every alignment
+void bam_read_idx_filter_init(bam_read_idx_filter* filter);
+
+// returns 1 if the filter skips any alignments
+int bam_read_idx_filter_is_set(const bam_read_idx_filter* filter);
+
+// look up the filter's region in header h, returns 0 on success
+// and -1 if the region can't be parsed or isn't in the header
+int bam_read_idx_filter_resolve(const bam_read_idx_filter* filter, bam_hdr_t* h, bam_read_idx_filter_region* region);
+
+// returns 1 if alignment b should be indexed. region is the filter's
+// region resolved for the file b is from, and is unused if there is none.
+int bam_read_idx_filter_pass(const bam_read_idx_filter* filter, const bam_read_idx_filter_region* region, const bam1_t* b);
+
+// the length of the read an alignment is from, including hard clipped bases
+size_t bam_read_idx_filter_read_length(const bam1_t* b);
+
+// write the filter as an index section payload, see bri_index.h
+void bam_read_idx_filter_write(const bam_read_idx_filter* filter, FILE* fp);
+
+// size in bytes of the section payload written by bam_read_idx_filter_write
+size_t bam_read_idx_filter_bytes(const bam_read_idx_filter* filter);
+
+// read a filter from a section payload, returns 0 on success and -1 on error
+int bam_read_idx_filter_read(bam_read_idx_filter* filter, FILE* fp, size_t bytes);
+
+// free the memory owned by the filter
+void bam_read_idx_filter_destroy(bam_read_idx_filter* filter);
+
+#endif
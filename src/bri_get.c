@@ -11,25 +11,45 @@
 #include <string.h>
 #include <assert.h>
 #include <getopt.h>
+#include <htslib/hts_endian.h>
 #include "bri_index.h"
+#include "bri_cram.h"
+#include "bri_get.h"
+#include "bri_bloom.h"
+#include "bri_reader.h"
+#include "bri_fastq.h"
+#include "bri_stats.h"
 
 //
 // Getopt
 //
 enum {
     OPT_HELP = 1,
+    OPT_STATS,
+    OPT_PAGED,
+    OPT_KEY_TAG,
 };
 
-static const char* shortopts = ":i:"; // placeholder
+static const char* shortopts = ":i:r:t:"; // placeholder
 static const struct option longopts[] = {
     { "help",                      no_argument,       NULL, OPT_HELP },
     { "index",               required_argument,       NULL,      'i' },
+    { "reference",           required_argument,       NULL,      'r' },
+    { "stats",               required_argument,       NULL, OPT_STATS },
+    { "paged",                     no_argument,       NULL, OPT_PAGED },
+    { "threads",             required_argument,       NULL,      't' },
+    { "key-tag",             required_argument,       NULL, OPT_KEY_TAG },
     { NULL, 0, NULL, 0 }
 };
 
 void print_usage_get()
 {
-    fprintf(stderr, "usage: bri get [-i <index_filename.bri>] <input.bam> <readname>\n");
+    fprintf(stderr, "usage: bri get [-i <index_filename.bri>] [-r <reference.fa>] [-t <threads>] [--key-tag <TAG>] [--paged] [--stats <stats.json>] <input.bam|input.cram|input.fastq.gz> <readname> [readname ...]\n");
+    fprintf(stderr, "       bri get -i <multi_file_index.bri> [-r <reference.fa>] [-t <threads>] [--key-tag <TAG>] [--paged] [--stats <stats.json>] <readname> [readname ...]\n");
+    fprintf(stderr, "  --paged    read the parts of the index needed for each read from disk, rather than loading it\n");
+    fprintf(stderr, "  --key-tag TAG    get the alignments with the given values of aux tag TAG from the index keyed on it,\n");
+    fprintf(stderr, "                   <input>.TAG.bri unless -i is given\n");
+    fprintf(stderr, "  -t, --threads N    inflate the blocks of long bam alignments with N threads (default: 1)\n");
 }
 
 // comparator used by bsearch, direct strcmp through the name pointer
@@ -43,6 +63,13 @@ int compare_records_by_readname_ptr(const void* r1, const void* r2)
 //
 void bam_read_idx_get_range(const bam_read_idx* bri, const char* readname, bam_read_idx_record** start, bam_read_idx_record** end)
 {
+    // names missing from the bloom filter are definitely not in the index
+    if(bri->bloom != NULL && !bam_read_idx_bloom_maybe_contains(bri->bloom, readname)) {
+        *start = NULL;
+        *end = NULL;
+        return;
+    }
+
     // construct a query record to pass to bsearch
     bam_read_idx_record query;
     query.read_name.ptr = readname;
@@ -78,25 +105,320 @@ void bam_read_idx_get_range(const bam_read_idx* bri, const char* readname, bam_r
 }
 
 //
-void bam_read_idx_get_by_record(htsFile* fp, bam_hdr_t* hdr, bam1_t* b, bam_read_idx_record* bri_record)
+int bam_read_idx_read_record(htsFile* fp, bam_hdr_t* hdr, bam1_t* b, const bam_read_idx_record* bri_record)
 {
-    int ret = bgzf_seek(fp->fp.bgzf, bri_record->file_offset, SEEK_SET);
+    if(fp->format.format == cram) {
+        size_t position = BRI_NO_POSITION;
+        if(bam_read_idx_read_record_from(fp, hdr, b, bri_record, &position) != 0) {
+            fprintf(stderr, "[bri] sam_read1 failed\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    int ret = bri_stats_bgzf_seek(fp->fp.bgzf, bri_record->file_offset);
     if(ret != 0) {
         fprintf(stderr, "[bri] bgzf_seek failed\n");
-        exit(EXIT_FAILURE);
+        return -1;
     }
 
-    ret = sam_read1(fp, hdr, b);
+    ret = bri_stats_sam_read1(fp, hdr, b);
     if(ret < 0) {
         fprintf(stderr, "[bri] sam_read1 failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+//
+int bam_read_idx_read_record_from(htsFile* fp, bam_hdr_t* hdr, bam1_t* b, const bam_read_idx_record* bri_record, size_t* position)
+{
+    size_t current = *position;
+    size_t target = bri_record->file_offset;
+    *position = BRI_NO_POSITION;
+
+    if(fp->format.format == cram) {
+        size_t skip = 0;
+        if(current != BRI_NO_POSITION &&
+           BRI_CRAM_CONTAINER(current) == BRI_CRAM_CONTAINER(target) &&
+           BRI_CRAM_ORDINAL(current) <= BRI_CRAM_ORDINAL(target)) {
+            skip = BRI_CRAM_ORDINAL(target) - BRI_CRAM_ORDINAL(current);
+        } else {
+            if(bam_read_idx_cram_seek(fp, BRI_CRAM_CONTAINER(target)) != 0) {
+                return -1;
+            }
+            skip = BRI_CRAM_ORDINAL(target);
+        }
+
+        for(size_t i = 0; i <= skip; ++i) {
+            if(bri_stats_sam_read1(fp, hdr, b) < 0) {
+                return -1;
+            }
+        }
+        *position = target + 1;
+        return 0;
+    }
+
+    if(current != target && bri_stats_bgzf_seek(fp->fp.bgzf, target) != 0) {
+        return -1;
+    }
+
+    if(bri_stats_sam_read1(fp, hdr, b) < 0) {
+        return -1;
+    }
+    *position = bgzf_tell(fp->fp.bgzf);
+    return 0;
+}
+
+//
+void bam_read_idx_get_by_record(htsFile* fp, bam_hdr_t* hdr, bam1_t* b, bam_read_idx_record* bri_record)
+{
+    if(bam_read_idx_read_record(fp, hdr, b, bri_record) != 0) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+//
+bam_read_idx_handles* bam_read_idx_handles_init(const bam_read_idx* bri, const char* input_bam, const char* reference)
+{
+    bam_read_idx_handles* handles = calloc(1, sizeof(bam_read_idx_handles));
+    if(handles == NULL) {
+        return NULL;
+    }
+
+    if(bri->file_count > 0) {
+        handles->count = bri->file_count;
+        handles->filenames = (const char**)bri->file_names;
+    } else {
+        assert(input_bam != NULL);
+        handles->count = 1;
+        handles->filenames = &handles->input_bam;
+        handles->input_bam = input_bam;
+    }
+
+    handles->reference = reference;
+    handles->threads = 1;
+    handles->fps = calloc(handles->count, sizeof(htsFile*));
+    handles->hdrs = calloc(handles->count, sizeof(bam_hdr_t*));
+    handles->long_fps = calloc(handles->count, sizeof(htsFile*));
+    if(handles->fps == NULL || handles->hdrs == NULL || handles->long_fps == NULL) {
+        bam_read_idx_handles_destroy(handles);
+        return NULL;
+    }
+    return handles;
+}
+
+//
+htsFile* bam_read_idx_handles_get(bam_read_idx_handles* handles, size_t file_id, bam_hdr_t** hdr)
+{
+    assert(file_id < handles->count);
+    if(handles->fps[file_id] == NULL) {
+        const char* filename = handles->filenames[file_id];
+        htsFile* fp = hts_open(filename, "r");
+        if(fp == NULL) {
+            fprintf(stderr, "[bri] could not open %s\n", filename);
+            return NULL;
+        }
+
+        // cram decoding needs the reference, if it isn't given htslib
+        // will try to find it using the header or REF_PATH
+        if(handles->reference != NULL && hts_set_fai_filename(fp, handles->reference) != 0) {
+            fprintf(stderr, "[bri] could not load reference %s\n", handles->reference);
+            hts_close(fp);
+            return NULL;
+        }
+
+        bam_hdr_t* h = sam_hdr_read(fp);
+        if(h == NULL) {
+            fprintf(stderr, "[bri] could not read header of %s\n", filename);
+            hts_close(fp);
+            return NULL;
+        }
+
+        handles->fps[file_id] = fp;
+        handles->hdrs[file_id] = h;
+    }
+
+    *hdr = handles->hdrs[file_id];
+    return handles->fps[file_id];
+}
+
+//
+void bam_read_idx_handles_set_threads(bam_read_idx_handles* handles, int threads)
+{
+    handles->threads = threads;
+}
+
+// the threaded handle to file_id, or NULL if it can't be opened, in
+// which case the record is read through the unthreaded handle
+static htsFile* bam_read_idx_handles_get_long(bam_read_idx_handles* handles, size_t file_id)
+{
+    if(handles->long_fps[file_id] == NULL) {
+        htsFile* fp = hts_open(handles->filenames[file_id], "r");
+        if(fp == NULL || hts_set_threads(fp, handles->threads) != 0) {
+            if(fp != NULL) {
+                hts_close(fp);
+            }
+            return NULL;
+        }
+
+        // the header is read to reach the alignments, but the header of
+        // the other handle is used to decode them
+        bam_hdr_t* h = sam_hdr_read(fp);
+        if(h == NULL) {
+            hts_close(fp);
+            return NULL;
+        }
+        bam_hdr_destroy(h);
+        handles->long_fps[file_id] = fp;
+    }
+    return handles->long_fps[file_id];
+}
+
+// The block holding the start of the record is loaded, if it isn't already,
+// which bgzf_read would do anyway so it isn't inflated twice. After a seek
+// the block isn't loaded and bgzf_read_block keeps the offset within it.
+size_t bam_read_idx_peek_record_bytes(BGZF* fp)
+{
+    if(fp->block_offset >= fp->block_length && bgzf_read_block(fp) != 0) {
+        return 0;
+    }
+
+    if(fp->block_offset + 4 > fp->block_length) {
+        return 0;
+    }
+    return 4 + le_to_u32((const uint8_t*)fp->uncompressed_block + fp->block_offset);
+}
+
+//
+int bam_read_idx_handles_read(bam_read_idx_handles* handles, size_t file_id, bam1_t* b,
+                              const bam_read_idx_record* bri_record, size_t* position)
+{
+    bam_hdr_t* h;
+    htsFile* fp = bam_read_idx_handles_get(handles, file_id, &h);
+    if(fp == NULL) {
+        return -1;
+    }
+
+    if(handles->threads > 1 && fp->format.format == bam) {
+        if(*position != bri_record->file_offset) {
+            *position = BRI_NO_POSITION;
+            if(bri_stats_bgzf_seek(fp->fp.bgzf, bri_record->file_offset) != 0) {
+                return -1;
+            }
+            *position = bri_record->file_offset;
+        }
+
+        // the unthreaded handle is left at the start of the record
+        htsFile* long_fp = NULL;
+        if(bam_read_idx_peek_record_bytes(fp->fp.bgzf) >= BRI_LONG_RECORD_BYTES &&
+           (long_fp = bam_read_idx_handles_get_long(handles, file_id)) != NULL) {
+            return bam_read_idx_read_record(long_fp, h, b, bri_record);
+        }
+    }
+    return bam_read_idx_read_record_from(fp, h, b, bri_record, position);
+}
+
+//
+int bam_read_idx_headers_compatible(const bam_hdr_t* h1, const bam_hdr_t* h2)
+{
+    if(h1->n_targets != h2->n_targets) {
+        return 0;
+    }
+
+    for(int i = 0; i < h1->n_targets; ++i) {
+        if(strcmp(h1->target_name[i], h2->target_name[i]) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+//
+void bam_read_idx_handles_destroy(bam_read_idx_handles* handles)
+{
+    for(size_t i = 0; handles->fps != NULL && i < handles->count; ++i) {
+        if(handles->fps[i] != NULL) {
+            bam_hdr_destroy(handles->hdrs[i]);
+            hts_close(handles->fps[i]);
+        }
+    }
+
+    for(size_t i = 0; handles->long_fps != NULL && i < handles->count; ++i) {
+        if(handles->long_fps[i] != NULL) {
+            hts_close(handles->long_fps[i]);
+        }
+    }
+
+    free(handles->fps);
+    free(handles->hdrs);
+    free(handles->long_fps);
+    free(handles);
+}
+
+// write the fastq records of each read to stdout
+static void bam_read_idx_get_fastq(bri_reader_t* reader, const char* input_bam, char** readnames, int count)
+{
+    const bam_read_idx* bri = bri_reader_index(reader);
+    size_t num_files = bri->file_count > 0 ? bri->file_count : 1;
+    BGZF** fps = calloc(num_files, sizeof(BGZF*));
+    bri_itr_t* itr = bri_itr_init(reader);
+    if(fps == NULL || itr == NULL) {
+        fprintf(stderr, "[bri] malloc failed\n");
         exit(EXIT_FAILURE);
     }
+
+    kstring_t record = { 0, 0, NULL };
+    for(int i = 0; i < count; i++) {
+        size_t file_id;
+        size_t file_offset;
+        bri_stats_start(BRI_PHASE_SEARCH);
+        int ret = bri_itr_query(itr, readnames[i]);
+        bri_stats_stop(BRI_PHASE_SEARCH);
+        while(ret >= 0 && (ret = bri_itr_next_offset(itr, &file_id, &file_offset)) >= 0) {
+            if(fps[file_id] == NULL) {
+                const char* filename = bri->file_count > 0 ? bri->file_names[file_id] : input_bam;
+                fps[file_id] = bgzf_open(filename, "r");
+                if(fps[file_id] == NULL) {
+                    fprintf(stderr, "[bri] could not open %s\n", filename);
+                    exit(EXIT_FAILURE);
+                }
+            }
+
+            if(bam_read_idx_fastq_read_record(fps[file_id], file_offset, &record) != 0) {
+                exit(EXIT_FAILURE);
+            }
+
+            bri_stats_start(BRI_PHASE_OUTPUT);
+            fwrite(record.s, 1, record.l, stdout);
+            bri_stats_stop(BRI_PHASE_OUTPUT);
+        }
+
+        if(ret < BRI_ITR_END) {
+            fprintf(stderr, "[bri] failed to read records for %s (error %d)\n", readnames[i], ret);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for(size_t fi = 0; fi < num_files; ++fi) {
+        if(fps[fi] != NULL) {
+            bgzf_close(fps[fi]);
+        }
+    }
+    free(fps);
+    free(record.s);
+    bri_itr_destroy(itr);
 }
 
 //
 int bam_read_idx_get_main(int argc, char** argv)
 {
     char* input_bri = NULL;
+    char* reference = NULL;
+    char* stats_file = NULL;
+    int paged = 0;
+    int threads = 1;
+    char key_tag[BRI_KEY_TAG_SIZE] = "";
 
     int die = 0;
     for (char c; (c = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1;) {
@@ -104,12 +426,35 @@ int bam_read_idx_get_main(int argc, char** argv)
             case OPT_HELP:
                 print_usage_get();
                 exit(EXIT_SUCCESS);
+            case OPT_STATS:
+                stats_file = optarg;
+                break;
+            case OPT_PAGED:
+                paged = 1;
+                break;
+            case OPT_KEY_TAG:
+                if(bam_read_idx_key_tag_parse(optarg, key_tag) != 0) {
+                    fprintf(stderr, "bri get: %s is not a valid tag\n", optarg);
+                    die = 1;
+                }
+                break;
             case 'i':
                 input_bri = optarg;
+                break;
+            case 'r':
+                reference = optarg;
+                break;
+            case 't':
+                threads = atoi(optarg);
+                if(threads < 1) {
+                    fprintf(stderr, "bri get: the number of threads must be positive\n");
+                    die = 1;
+                }
+                break;
         }
     }
     
-    if (argc - optind < 2) {
+    if (argc - optind < 1) {
         fprintf(stderr, "bri get: not enough arguments\n");
         die = 1;
     }
@@ -119,40 +464,91 @@ int bam_read_idx_get_main(int argc, char** argv)
         exit(EXIT_FAILURE);
     }
 
-    char* input_bam = argv[optind++];
+    bri_stats_enable(stats_file != NULL);
 
-    bam_read_idx* bri = bam_read_idx_load(input_bam, input_bri);
-    
-    htsFile* bam_fp = hts_open(input_bam, "r");
-    bam_hdr_t* h = sam_hdr_read(bam_fp);
-    htsFile* out_fp = hts_open("-", "w");
+    // an index covering multiple files stores their paths, in which
+    // case only the index is given and every argument is a readname
+    char* input_bam = argv[optind];
+    char* key_bri = NULL;
+    if(key_tag[0] != '\0' && input_bri == NULL) {
+        key_bri = input_bri = generate_key_index_filename(input_bam, NULL, key_tag);
+        if(key_bri == NULL) {
+            fprintf(stderr, "[bri] malloc failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    bri_reader_t* reader = paged ? bri_reader_open_paged(input_bam, input_bri, reference)
+                                 : bri_reader_open(input_bam, input_bri, reference);
+    if(reader == NULL) {
+        exit(EXIT_FAILURE);
+    }
+
+    const char* index_key_tag = bri_reader_index(reader)->key_tag;
+    if(strcmp(index_key_tag, key_tag) != 0) {
+        fprintf(stderr, "bri get: the index is keyed on %s, not %s\n",
+            index_key_tag[0] != '\0' ? index_key_tag : "read names", key_tag[0] != '\0' ? key_tag : "read names");
+        exit(EXIT_FAILURE);
+    }
+
+    // the default key index is named after the input file, which is given
+    if(key_bri != NULL || input_bri == NULL || bri_reader_index(reader)->file_count == 0) {
+        optind++;
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "bri get: not enough arguments\n");
+        print_usage_get();
+        exit(EXIT_FAILURE);
+    }
+
+    if(bri_reader_index(reader)->format == BRI_FORMAT_FASTQ) {
+        bam_read_idx_get_fastq(reader, input_bam, argv + optind, argc - optind);
+        bri_reader_close(reader);
+        if(stats_file != NULL && bri_stats_write_json(stats_file, "get") != 0) {
+            exit(EXIT_FAILURE);
+        }
+        return 0;
+    }
 
-    bam_read_idx_record* start;
-    bam_read_idx_record* end;
+    bri_itr_t* itr = bri_itr_init(reader);
+    if(itr == NULL) {
+        fprintf(stderr, "[bri] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+    bri_itr_set_threads(itr, threads);
+
+    htsFile* out_fp = hts_open("-", "w");
+    bam1_t* b = bam_init1();
 
     for(int i = optind; i < argc; i++) {
         char* readname = argv[i];
-        bam_read_idx_get_range(bri, readname, &start, &end);
-        bam1_t* b = bam_init1();
-        while(start != end) {
-            
-            bam_read_idx_get_by_record(bam_fp, h, b, start);
-            int ret = sam_write1(out_fp, h, b);
-            if(ret < 0) {
+        bri_stats_start(BRI_PHASE_SEARCH);
+        int ret = bri_itr_query(itr, readname);
+        bri_stats_stop(BRI_PHASE_SEARCH);
+        while(ret >= 0 && (ret = bri_itr_next(itr, b)) >= 0) {
+            bri_stats_start(BRI_PHASE_OUTPUT);
+            if(sam_write1(out_fp, bri_itr_header(itr), b) < 0) {
                 fprintf(stderr, "[bri] sam_write1 failed\n");
                 exit(EXIT_FAILURE);
             }
+            bri_stats_stop(BRI_PHASE_OUTPUT);
+        }
 
-            start++;
+        if(ret < BRI_ITR_END) {
+            fprintf(stderr, "[bri] failed to read alignments for %s (error %d)\n", readname, ret);
+            exit(EXIT_FAILURE);
         }
-        bam_destroy1(b);
     }
 
+    bam_destroy1(b);
     hts_close(out_fp);
-    bam_hdr_destroy(h);
-    hts_close(bam_fp);
-    bam_read_idx_destroy(bri);
-    bri = NULL;
+    bri_itr_destroy(itr);
+    bri_reader_close(reader);
+    free(key_bri);
 
+    if(stats_file != NULL && bri_stats_write_json(stats_file, "get") != 0) {
+        exit(EXIT_FAILURE);
+    }
     return 0;
 }
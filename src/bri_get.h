@@ -12,10 +12,34 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <assert.h>
 #include <htslib/sam.h>
 #include <htslib/hts.h>
 #include <htslib/bgzf.h>
+#include "bri_index.h"
+
+// bam records at least this long span several bgzf blocks, which are
+// worth inflating in parallel when threads are available
+#define BRI_LONG_RECORD_BYTES (8 * BGZF_BLOCK_SIZE)
+
+// A set of handles to the file(s) covered by an index. Each
+// file is only opened the first time one of its records is needed.
+typedef struct bam_read_idx_handles
+{
+    size_t count;
+    const char** filenames;
+    const char* input_bam;
+    const char* reference;
+    htsFile** fps;
+    bam_hdr_t** hdrs;
+
+    // when threads is greater than 1, long records of bam files are read
+    // through a second handle to each file that inflates blocks with that
+    // many threads. These are opened the first time a long record is read.
+    int threads;
+    htsFile** long_fps;
+} bam_read_idx_handles;
 
 // retrieve pointers to the range of records for readname
 // start and end will be NULL if readname is not in the index
@@ -26,9 +50,55 @@ void bam_read_idx_get_range(const bam_read_idx* bri,
                             bam_read_idx_record** start, 
                             bam_read_idx_record** end);
 
-// fill in the bam record (b) by seeking to the right offset in fp using the information stored in bri_record
+// fill in the bam record (b) by seeking to the right offset in fp using the information stored in bri_record.
+// fp can be either a bam or cram file, matching the file the index was built from. Exits on error.
+// Each call repositions a cram file at the start of the record's container, so callers fetching
+// many records should use bam_read_idx_read_record_from, which continues within a container.
 void bam_read_idx_get_by_record(htsFile* fp, bam_hdr_t* hdr, bam1_t* b, bam_read_idx_record* bri_record);
 
+// as bam_read_idx_get_by_record, but returns 0 on success and -1 on error
+int bam_read_idx_read_record(htsFile* fp, bam_hdr_t* hdr, bam1_t* b, const bam_read_idx_record* bri_record);
+
+// stream position when it isn't known, see bam_read_idx_read_record_from
+#define BRI_NO_POSITION SIZE_MAX
+
+// as bam_read_idx_read_record, but continues from the current stream position
+// rather than seeking when the record is next in the stream (bam) or ahead of
+// it in the same container (cram). *position is the offset the stream would
+// read next, or BRI_NO_POSITION, and is updated after reading.
+int bam_read_idx_read_record_from(htsFile* fp, bam_hdr_t* hdr, bam1_t* b, const bam_read_idx_record* bri_record, size_t* position);
+
+// create the handles for the files covered by bri. input_bam gives the file
+// for an index over a single file (which doesn't store its path) and
+// reference is an optional fasta used for cram decoding. The strings
+// are not copied. Returns NULL if out of memory.
+bam_read_idx_handles* bam_read_idx_handles_init(const bam_read_idx* bri, const char* input_bam, const char* reference);
+
+// return the handle and header for file_id, opening the file if needed.
+// Returns NULL if the file can't be opened.
+htsFile* bam_read_idx_handles_get(bam_read_idx_handles* handles, size_t file_id, bam_hdr_t** hdr);
+
+// read long bam records with threads, see bam_read_idx_handles
+void bam_read_idx_handles_set_threads(bam_read_idx_handles* handles, int threads);
+
+// read the record of file_id into b as bam_read_idx_read_record_from does,
+// opening the file if needed. Long bam records are read through the
+// threaded handle when threads are set. Returns 0 on success and -1 on error.
+int bam_read_idx_handles_read(bam_read_idx_handles* handles, size_t file_id, bam1_t* b,
+                              const bam_read_idx_record* bri_record, size_t* position);
+
+// the length in bytes of the bam record at the current position of fp, read
+// from the block it starts in without moving the position. Returns 0 if the
+// length isn't within that block or the block can't be read.
+size_t bam_read_idx_peek_record_bytes(BGZF* fp);
+
+// returns 1 if the two headers have the same reference sequences, so
+// alignments from one can be written with the other
+int bam_read_idx_headers_compatible(const bam_hdr_t* h1, const bam_hdr_t* h2);
+
+// close all opened files and deallocate the handles
+void bam_read_idx_handles_destroy(bam_read_idx_handles* handles);
+
 // main of the "get" subprogram
 int bam_read_idx_get_main(int argc, char** argv);
 
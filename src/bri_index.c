@@ -13,30 +13,40 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <assert.h>
 #include <getopt.h>
+#include <htslib/hfile.h>
 #include "bri_index.h"
+#include "bri_cram.h"
+#include "bri_bloom.h"
+#include "bri_stats.h"
+#include "bri_sparse.h"
+#include "bri_fastq.h"
+#include "bri_shard.h"
+#include "bri_checkpoint.h"
+#include "bri_update.h"
 #include "sort_r.h"
 
 //#define BRI_INDEX_DEBUG 1
 char verbose = 0;
 
 // make the index filename based on the name of input_bam
-// caller must free the returned pointer
+// caller must free the returned pointer, NULL is returned if out of memory
 char* generate_index_filename(const char* input_bam, const char* input_bri) 
 {
     char* out_fn;
 
     if(input_bri != NULL) {
-        out_fn = malloc(strlen(input_bri));
+        out_fn = malloc(strlen(input_bri) + 1);
         if(out_fn == NULL) {
-            exit(EXIT_FAILURE);
+            return NULL;
         }
         strcpy(out_fn, input_bri);
     } else {
         out_fn = malloc(strlen(input_bam) + 5);
         if(out_fn == NULL) {
-            exit(EXIT_FAILURE);
+            return NULL;
         }
         strcpy(out_fn, input_bam);
         strcat(out_fn, ".bri");
@@ -49,15 +59,42 @@ char* generate_index_filename(const char* input_bam, const char* input_bri)
 bam_read_idx* bam_read_idx_init()
 {
     bam_read_idx* bri = (bam_read_idx*)malloc(sizeof(bam_read_idx));
+    if(bri == NULL) {
+        return NULL;
+    }
 
-    bri->name_capacity_bytes = 0;
     bri->name_count_bytes = 0;
     bri->readnames = NULL;
 
-    bri->record_capacity = 0;
     bri->record_count = 0;
     bri->records = NULL;
 
+    bri_arena_init(&bri->name_arena, BRI_ARENA_CHUNK_BITS, 0);
+    bri_arena_init(&bri->record_arena, BRI_ARENA_CHUNK_BITS, 0);
+
+    bri->format = BRI_FORMAT_BAM;
+
+    bri->file_count = 0;
+    bri->file_names = NULL;
+    bri->file_ids = NULL;
+    bri->file_name_starts = NULL;
+    bri->records_sorted = 0;
+
+    bri->source_count = 0;
+    bri->sources = NULL;
+
+    bri->bloom = NULL;
+    bri->bloom_fpr = 0.0;
+
+    bam_read_idx_filter_init(&bri->filter);
+    bri->key_tag[0] = '\0';
+
+    bri->sparse_interval = 0;
+    bri->name_order = BRI_NAME_ORDER_LEXICOGRAPHIC;
+
+    bri->shard_count = 0;
+    bri->shard = 0;
+
     return bri;
 }
 
@@ -73,33 +110,173 @@ void bam_read_idx_destroy(bam_read_idx* bri)
     free(bri->records);
     bri->records = NULL;
 
+    bri_arena_destroy(&bri->name_arena);
+    bri_arena_destroy(&bri->record_arena);
+
+    for(size_t i = 0; i < bri->file_count; ++i) {
+        free(bri->file_names[i]);
+    }
+    free(bri->file_names);
+    free(bri->file_ids);
+    free(bri->file_name_starts);
+    free(bri->sources);
+
+    if(bri->bloom != NULL) {
+        bam_read_idx_bloom_destroy(bri->bloom);
+    }
+
+    bam_read_idx_filter_destroy(&bri->filter);
+
     free(bri);
 }
 
-// comparison function used by quicksort, names pointers to a block of C strings
-// and allows us to indirectly sorted records by their offset.
+// comparison function used by quicksort, names points to the arena holding the
+// C strings and allows us to indirectly sorted records by their offset.
 int compare_records_by_readname_offset(const void* r1, const void* r2, void* names)
 {
-    const char* cnames = (const char*)names;
-    const char* n1 = cnames + ((bam_read_idx_record*)r1)->read_name.offset;
-    const char* n2 = cnames + ((bam_read_idx_record*)r2)->read_name.offset;
-    return strcmp(n1, n2);
+    const bri_arena* arena = (const bri_arena*)names;
+    size_t o1 = ((bam_read_idx_record*)r1)->read_name.offset;
+    size_t o2 = ((bam_read_idx_record*)r2)->read_name.offset;
+    int cmp = strcmp(bri_arena_ptr(arena, o1), bri_arena_ptr(arena, o2));
+
+    // every record has its own copy of the name, which are allocated in the
+    // order the records were added, so ties are broken by file order and
+    // the sorted order doesn't depend on the sort algorithm
+    return cmp != 0 ? cmp : (o1 > o2) - (o1 < o2);
+}
+
+// write a tagged section after the records, see bri_index.h
+void bam_read_idx_write_section(FILE* fp, size_t tag, const void* data, size_t bytes)
+{
+    fwrite(&tag, sizeof(tag), 1, fp);
+    fwrite(&bytes, sizeof(bytes), 1, fp);
+    fwrite(data, bytes, 1, fp);
+}
+
+// The names added from each file occupy a contiguous range of name_arena,
+// starting at file_name_starts, so the file of a record can be found from its
+// name offset by a binary search for the last file that starts at or before it
+size_t bam_read_idx_build_file_id(const bam_read_idx* bri, size_t offset)
+{
+    size_t lo = 0;
+    size_t hi = bri->file_count;
+    while(hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if(bri->file_name_starts[mid] <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// write the file table and per-record file IDs of a multi-file index, the
+// IDs are found from the name offsets unless they were given in file_ids
+void bam_read_idx_save_files(bam_read_idx* bri, FILE* fp)
+{
+    size_t names_bytes = 0;
+    for(size_t i = 0; i < bri->file_count; ++i) {
+        names_bytes += strlen(bri->file_names[i]) + 1;
+    }
+
+    char* names = malloc(names_bytes);
+    uint16_t* ids = bri->file_ids != NULL ? bri->file_ids : malloc(bri->record_count * sizeof(uint16_t));
+    if(names == NULL || (ids == NULL && bri->record_count > 0)) {
+        fprintf(stderr, "[bri] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    char* np = names;
+    for(size_t i = 0; i < bri->file_count; ++i) {
+        size_t len = strlen(bri->file_names[i]) + 1;
+        memcpy(np, bri->file_names[i], len);
+        np += len;
+    }
+
+    for(size_t i = 0; i < bri->record_count && ids != bri->file_ids; ++i) {
+        ids[i] = bam_read_idx_build_file_id(bri, bri->records[i].read_name.offset);
+    }
+
+    bam_read_idx_write_section(fp, BRI_SECTION_FILES, names, names_bytes);
+    bam_read_idx_write_section(fp, BRI_SECTION_FILE_IDS, ids, bri->record_count * sizeof(uint16_t));
+    free(names);
+    if(ids != bri->file_ids) {
+        free(ids);
+    }
+}
+
+// report how much of the memory reserved while building was used,
+// the rest is lost to the ends of chunks or not yet touched
+static void bam_read_idx_report_arenas(const bam_read_idx* bri)
+{
+    size_t reserved = bri_arena_reserved(&bri->name_arena) + bri_arena_reserved(&bri->record_arena);
+    size_t used = bri->name_arena.used + bri->record_arena.used;
+    bri_stats_count(BRI_COUNTER_ARENA_RESERVED, reserved);
+    bri_stats_count(BRI_COUNTER_ARENA_USED, used);
+
+    if(verbose) {
+        fprintf(stderr, "[bri-build] names used %zu of %zu bytes reserved, records used %zu of %zu bytes reserved%s\n",
+            bri->name_arena.used, bri_arena_reserved(&bri->name_arena),
+            bri->record_arena.used, bri_arena_reserved(&bri->record_arena),
+            bri->name_arena.huge_pages ? " (huge pages)" : "");
+    }
+}
+
+// Write the directory used by paged lookups: the number of records per page,
+// the number of pages, the name offset of the first record of each page, then
+// the names of those records. disk_offsets gives the name offset of each record.
+void bam_read_idx_save_directory(bam_read_idx* bri, const size_t* disk_offsets, FILE* fp)
+{
+    size_t page_size = BRI_PAGE_RECORDS;
+    size_t page_count = (bri->record_count + page_size - 1) / page_size;
+    size_t bytes = 2 * sizeof(size_t) + page_count * sizeof(size_t);
+    for(size_t p = 0; p < page_count; ++p) {
+        bytes += strlen(bam_read_idx_build_name(bri, bri->records[p * page_size].read_name.offset)) + 1;
+    }
+
+    size_t tag = BRI_SECTION_DIRECTORY;
+    fwrite(&tag, sizeof(tag), 1, fp);
+    fwrite(&bytes, sizeof(bytes), 1, fp);
+    fwrite(&page_size, sizeof(page_size), 1, fp);
+    fwrite(&page_count, sizeof(page_count), 1, fp);
+    for(size_t p = 0; p < page_count; ++p) {
+        fwrite(&disk_offsets[p * page_size], sizeof(size_t), 1, fp);
+    }
+
+    for(size_t p = 0; p < page_count; ++p) {
+        const char* name = bam_read_idx_build_name(bri, bri->records[p * page_size].read_name.offset);
+        fwrite(name, strlen(name) + 1, 1, fp);
+    }
 }
 
 //
 void bam_read_idx_save(bam_read_idx* bri, const char* filename)
 {
     FILE* fp = fopen(filename, "wb");
+    if(fp == NULL) {
+        fprintf(stderr, "[bri] could not open %s for writing\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    bam_read_idx_report_arenas(bri);
+    bam_read_idx_compact_records(bri);
 
-    // Sort records by readname
-    sort_r(bri->records, bri->record_count, sizeof(bam_read_idx_record), compare_records_by_readname_offset, bri->readnames);
+    // Sort records by readname. The records of a sparse index are
+    // added in file order, which is already the order of the names.
+    bri_stats_start(BRI_PHASE_SORT);
+    if(bri->sparse_interval == 0 && !bri->records_sorted) {
+        sort_r(bri->records, bri->record_count, sizeof(bam_read_idx_record), compare_records_by_readname_offset, &bri->name_arena);
+    }
+    bri_stats_stop(BRI_PHASE_SORT);
+    bri_stats_start(BRI_PHASE_NAME_WRITE);
     
     // write header, containing file version, the size (in bytes) of the read names
     // and the number of records. The readnames size is a placeholder and will be
     // corrected later.
     
     // version
-    size_t FILE_VERSION = 1;
+    size_t FILE_VERSION = BRI_FILE_VERSION;
     fwrite(&FILE_VERSION, sizeof(FILE_VERSION), 1, fp);
     
     // readname length
@@ -112,17 +289,17 @@ void bam_read_idx_save(bam_read_idx* bri, const char* filename)
     // Pass 1: count up the number of non-redundant read names, write them to disk
     // Also store the position in the file where the read name for each record was written
     size_t* disk_offsets_by_record = malloc(bri->record_count * sizeof(size_t));
-    const char* rn = bri->readnames; // for convenience 
+    const bri_arena* rn = &bri->name_arena; // for convenience 
 
     for(size_t i = 0; i < bri->record_count; ++i) {
         
         int redundant = i > 0 && 
-            strcmp(rn + bri->records[i].read_name.offset, rn + bri->records[i - 1].read_name.offset) == 0;
+            strcmp(bri_arena_ptr(rn, bri->records[i].read_name.offset), bri_arena_ptr(rn, bri->records[i - 1].read_name.offset)) == 0;
         
         if(!redundant) {
             disk_offsets_by_record[i] = readname_bytes; // current position in file
-            size_t len = strlen(rn + bri->records[i].read_name.offset) + 1;
-            fwrite(rn + bri->records[i].read_name.offset, len, 1, fp);
+            size_t len = strlen(bri_arena_ptr(rn, bri->records[i].read_name.offset)) + 1;
+            fwrite(bri_arena_ptr(rn, bri->records[i].read_name.offset), len, 1, fp);
             readname_bytes += len;
         } else {
             disk_offsets_by_record[i] = disk_offsets_by_record[i - 1];
@@ -130,10 +307,38 @@ void bam_read_idx_save(bam_read_idx* bri, const char* filename)
 
 #ifdef BRI_INDEX_DEBUG
         fprintf(stderr, "record %zu name: %s redundant: %d do: %zu offset: %zu\n", 
-            i, bri->readnames + bri->records[i].read_name.offset, redundant, disk_offsets_by_record[i], bri->records[i].file_offset);
+            i, bri_arena_ptr(rn, bri->records[i].read_name.offset), redundant, disk_offsets_by_record[i], bri->records[i].file_offset);
 #endif
     }
 
+    // build the bloom filter over the distinct names, which are the
+    // records whose name was written to disk in pass 1
+    if(bri->bloom_fpr > 0.0) {
+        size_t distinct = 0;
+        for(size_t i = 0; i < bri->record_count; ++i) {
+            distinct += i == 0 || disk_offsets_by_record[i] != disk_offsets_by_record[i - 1];
+        }
+
+        bri->bloom = bam_read_idx_bloom_init(distinct, bri->bloom_fpr);
+        if(bri->bloom == NULL) {
+            fprintf(stderr, "[bri] malloc failed\n");
+            exit(EXIT_FAILURE);
+        }
+        for(size_t i = 0; i < bri->record_count; ++i) {
+            if(i == 0 || disk_offsets_by_record[i] != disk_offsets_by_record[i - 1]) {
+                bam_read_idx_bloom_add(bri->bloom, bri_arena_ptr(rn, bri->records[i].read_name.offset));
+            }
+        }
+
+        if(verbose) {
+            fprintf(stderr, "[bri-build] bloom filter with %zu blocks and %zu hashes for %zu names\n",
+                bri->bloom->num_blocks, bri->bloom->num_hashes, distinct);
+        }
+    }
+
+    bri_stats_stop(BRI_PHASE_NAME_WRITE);
+    bri_stats_start(BRI_PHASE_RECORD_WRITE);
+
     // Pass 2: write the records, getting the read name offset from the disk offset (rather than
     // the memory offset stored)
     for(size_t i = 0; i < bri->record_count; ++i) {
@@ -142,9 +347,53 @@ void bam_read_idx_save(bam_read_idx* bri, const char* filename)
         fwrite(&brir, sizeof(brir), 1, fp);
 #ifdef BRI_INDEX_DEBUG
         fprintf(stderr, "[bri-save] record %zu %s name offset: %zu file offset: %zu\n", 
-            i, bri->readnames + bri->records[i].read_name.offset, disk_offsets_by_record[i], bri->records[i].file_offset);
+            i, bri_arena_ptr(rn, bri->records[i].read_name.offset), disk_offsets_by_record[i], bri->records[i].file_offset);
 #endif
     }
+
+    // optional sections
+    size_t format = bri->format;
+    bam_read_idx_write_section(fp, BRI_SECTION_FORMAT, &format, sizeof(format));
+
+    if(bri->file_count > 1) {
+        bam_read_idx_save_files(bri, fp);
+    }
+
+    bam_read_idx_save_directory(bri, disk_offsets_by_record, fp);
+
+    if(bri->bloom != NULL) {
+        size_t tag = BRI_SECTION_BLOOM;
+        size_t bytes = bam_read_idx_bloom_bytes(bri->bloom);
+        fwrite(&tag, sizeof(tag), 1, fp);
+        fwrite(&bytes, sizeof(bytes), 1, fp);
+        bam_read_idx_bloom_write(bri->bloom, fp);
+    }
+
+    if(bri->sparse_interval > 0) {
+        size_t sparse[2] = { bri->sparse_interval, bri->name_order };
+        bam_read_idx_write_section(fp, BRI_SECTION_SPARSE, sparse, sizeof(sparse));
+    }
+
+    if(bri->shard_count > 0) {
+        size_t shards[2] = { bri->shard_count, bri->shard };
+        bam_read_idx_write_section(fp, BRI_SECTION_SHARDS, shards, sizeof(shards));
+    }
+
+    if(bri->sources != NULL) {
+        bam_read_idx_write_section(fp, BRI_SECTION_SOURCES, bri->sources, bri->source_count * sizeof(bam_read_idx_source));
+    }
+
+    if(bam_read_idx_filter_is_set(&bri->filter)) {
+        size_t tag = BRI_SECTION_FILTER;
+        size_t bytes = bam_read_idx_filter_bytes(&bri->filter);
+        fwrite(&tag, sizeof(tag), 1, fp);
+        fwrite(&bytes, sizeof(bytes), 1, fp);
+        bam_read_idx_filter_write(&bri->filter, fp);
+    }
+
+    if(bri->key_tag[0] != '\0') {
+        bam_read_idx_write_section(fp, BRI_SECTION_KEY_TAG, bri->key_tag, 2);
+    }
     
     // finish by writing the actual size of the read name segment
     fseek(fp, sizeof(FILE_VERSION), SEEK_SET);
@@ -152,212 +401,834 @@ void bam_read_idx_save(bam_read_idx* bri, const char* filename)
 
     free(disk_offsets_by_record);
     fclose(fp);
+    bri_stats_stop(BRI_PHASE_RECORD_WRITE);
 }
 
-// add a record to the index, growing the dynamic arrays as necessary
+// add a record to the index. The name and record are copied into the
+// arenas, which grow by adding chunks so nothing already added is moved.
 void bam_read_idx_add(bam_read_idx* bri, const char* readname, size_t offset)
 {
     // 
     // add readname to collection
     //
     size_t len = strlen(readname) + 1;
-    if(bri->name_capacity_bytes <= bri->name_count_bytes + len) {
+    size_t name_offset = bri_arena_alloc(&bri->name_arena, len);
+    memcpy(bri_arena_ptr(&bri->name_arena, name_offset), readname, len);
+    bri->name_count_bytes += len;
 
-        // if already allocated double size, if initialization start with 1Mb
-        bri->name_capacity_bytes = bri->name_capacity_bytes > 0 ? 2 * bri->name_capacity_bytes : 1024*1024;
-#ifdef BRI_INDEX_DEBUG
-        fprintf(stderr, "[bri] allocating %zu bytes for names\n", bri->name_capacity_bytes);
-#endif
-    
-        bri->readnames = realloc(bri->readnames, bri->name_capacity_bytes);
-        if(bri->readnames == NULL) {
-            fprintf(stderr, "[bri] malloc failed\n");
-            exit(EXIT_FAILURE);
+    //
+    // add record, the arena chunks are a multiple of the record size
+    // so the records are at consecutive offsets
+    //
+    assert(bri->records == NULL);
+    size_t record_offset = bri_arena_alloc(&bri->record_arena, sizeof(bam_read_idx_record));
+    assert(record_offset == bri->record_count * sizeof(bam_read_idx_record));
+
+    bam_read_idx_record* record = (bam_read_idx_record*)bri_arena_ptr(&bri->record_arena, record_offset);
+    record->read_name.offset = name_offset;
+    record->file_offset = offset;
+    bri->record_count += 1;
+}
+
+//
+const char* bam_read_idx_build_name(const bam_read_idx* bri, size_t offset)
+{
+    return bri_arena_ptr(&bri->name_arena, offset);
+}
+
+//
+const bam_read_idx_record* bam_read_idx_build_record(const bam_read_idx* bri, size_t i)
+{
+    return (const bam_read_idx_record*)bri_arena_ptr(&bri->record_arena, i * sizeof(bam_read_idx_record));
+}
+
+// copy the records one chunk at a time, freeing each chunk once it has
+// been copied so the records are only held twice for a single chunk
+void bam_read_idx_compact_records(bam_read_idx* bri)
+{
+    if(bri->record_arena.num_chunks == 0) {
+        return;
+    }
+
+    bri->records = malloc(bri->record_count * sizeof(bam_read_idx_record));
+    if(bri->records == NULL) {
+        fprintf(stderr, "[bri] failed to allocate %zu records\n", bri->record_count);
+        exit(EXIT_FAILURE);
+    }
+
+    size_t per_chunk = ((size_t)1 << bri->record_arena.chunk_bits) / sizeof(bam_read_idx_record);
+    for(size_t ci = 0; ci < bri->record_arena.num_chunks; ++ci) {
+        size_t first = ci * per_chunk;
+        size_t n = bri->record_count - first < per_chunk ? bri->record_count - first : per_chunk;
+        memcpy(bri->records + first, bri->record_arena.chunks[ci], n * sizeof(bam_read_idx_record));
+        bri_arena_free_chunk(&bri->record_arena, ci);
+    }
+    bri_arena_destroy(&bri->record_arena);
+}
+
+// print the periodic progress message for the record that was just added
+void bam_read_idx_build_progress(const bam_read_idx* bri)
+{
+    if(verbose && (bri->record_count == 1 || bri->record_count % 100000 == 0)) {
+        const bam_read_idx_record* brir = bam_read_idx_build_record(bri, bri->record_count - 1);
+        fprintf(stderr, "[bri-build] record %zu [%zu %zu] %s\n",
+            bri->record_count,
+            brir->read_name.offset,
+            brir->file_offset,
+            bam_read_idx_build_name(bri, brir->read_name.offset)
+        );
+    }
+}
+
+//
+void bam_read_idx_build_add(void* data, const bam1_t* b, size_t file_offset)
+{
+    bam_read_idx* bri = (bam_read_idx*)data;
+    char buffer[BRI_KEY_BUFFER_SIZE];
+    const char* key = bam_read_idx_key(b, bri->key_tag, buffer);
+    if(key == NULL) {
+        return;
+    }
+    bam_read_idx_add(bri, key, file_offset);
+    bam_read_idx_build_progress(bri);
+}
+
+// read the records of a bgzf-compressed bam file from the current position
+// up to end_offset, or the end of the file. Returns the offset following the
+// last record read.
+size_t bam_read_idx_scan_bam(htsFile* fp, bam_hdr_t* h, bam1_t* b, size_t end_offset,
+                           const bam_read_idx_filter* filter, const bam_read_idx_filter_region* region,
+                           bri_io_stream* stream, bam_read_idx_scan_fn fn, void* data)
+{
+    int ret = 0;
+    size_t file_offset = bgzf_tell(fp->fp.bgzf);
+    bri_stats_bgzf_mark mark;
+    bri_stats_bgzf_mark_position(fp->fp.bgzf, &mark);
+    while (file_offset < end_offset && (ret = sam_read1(fp, h, b)) >= 0) {
+        bri_stats_bgzf_read(fp->fp.bgzf, &mark, 4 + 32 + b->l_data);
+        if(filter == NULL || bam_read_idx_filter_pass(filter, region, b)) {
+            fn(data, b, file_offset);
         }
+
+        // update offset for next record
+        file_offset = bgzf_tell(fp->fp.bgzf);
+        bri_stats_bgzf_mark_position(fp->fp.bgzf, &mark);
+        bri_io_stream_update(stream, fp->fp.bgzf->fp);
     }
-    
-    // in principle this incoming name can be so larger than doubling the size
-    // doesn't allow it to fit. This really shouldn't happen so we'll just exit here
-    if(bri->name_capacity_bytes <= bri->name_count_bytes + len) {
-        fprintf(stderr, "[bri] incoming name with length %zu is too large (%zu %zu)\n", len, bri->name_count_bytes + len, bri->name_capacity_bytes);
+    return file_offset;
+}
+
+// read the records of a bam file that may overlap the filter's region. We read
+// the chunks the .bai gives for the region ourselves, rather than using
+// sam_itr_next, so that the offset of each record is known.
+void bam_read_idx_scan_bam_region(const char* filename, htsFile* fp, bam_hdr_t* h, bam1_t* b,
+                                  const bam_read_idx_filter* filter, const bam_read_idx_filter_region* region,
+                                  bri_io_stream* stream, bam_read_idx_scan_fn fn, void* data)
+{
+    hts_idx_t* idx = sam_index_load(fp, filename);
+    if(idx == NULL) {
+        fprintf(stderr, "[bri] a .bai index of %s is needed to filter by region\n", filename);
         exit(EXIT_FAILURE);
     }
 
-    // copy name
-    size_t name_offset = bri->name_count_bytes;
-    strncpy(bri->readnames + bri->name_count_bytes, readname, len);
-    bri->name_count_bytes += len;
-    assert(bri->readnames[bri->name_count_bytes - 1] == '\0');
+    hts_itr_t* itr = sam_itr_querys(idx, h, filter->region);
+    if(itr == NULL) {
+        fprintf(stderr, "[bri] could not query region %s in %s\n", filter->region, filename);
+        exit(EXIT_FAILURE);
+    }
 
-    //
-    // add record
-    //
-    if(bri->record_count == bri->record_capacity) {
-        bri->record_capacity = bri->record_capacity > 0 ? 2 * bri->record_capacity : 1024;
-        bri->records = realloc(bri->records, sizeof(bam_read_idx_record) * bri->record_capacity);
-        if(bri->records == NULL) {
-            fprintf(stderr, "[bri] malloc failed\n");
+    // the chunks are sorted and don't overlap
+    for(int i = 0; i < itr->n_off; ++i) {
+        if(bri_stats_bgzf_seek(fp->fp.bgzf, itr->off[i].u) != 0) {
+            fprintf(stderr, "[bri] bgzf_seek failed\n");
             exit(EXIT_FAILURE);
         }
+        bam_read_idx_scan_bam(fp, h, b, itr->off[i].v, filter, region, stream, fn, data);
     }
 
-    bri->records[bri->record_count].read_name.offset = name_offset;
-    bri->records[bri->record_count].file_offset = offset;
-    bri->record_count += 1;
+    hts_itr_destroy(itr);
+    hts_idx_destroy(idx);
+}
+
+// read every record of a cram file. htslib has no equivalent of bgzf_tell
+// for cram so the offset of each record is the container it came from, and
+// its ordinal within that container, instead.
+void bam_read_idx_scan_cram(const char* filename, htsFile* fp, bam_hdr_t* h, bam1_t* b,
+                            const bam_read_idx_filter* filter, const bam_read_idx_filter_region* region,
+                            const char* key_tag, bri_io_stream* stream, bam_read_idx_scan_fn fn, void* data)
+{
+    size_t num_containers = 0;
+    size_t* containers = bam_read_idx_cram_container_offsets(filename, &num_containers);
+
+    // only the read name is needed, which lets htslib skip decoding
+    // everything else (and means no reference is required). Filters
+    // need the placement of the alignment and, for unmapped reads,
+    // the length of the sequence. An index keyed on a tag needs the aux fields.
+    int required_fields = SAM_QNAME;
+    required_fields |= key_tag[0] != '\0' ? SAM_AUX : 0;
+    if(filter != NULL) {
+        required_fields |= SAM_FLAG | SAM_RNAME | SAM_POS | SAM_CIGAR;
+        required_fields |= filter->min_read_length > 0 ? SAM_SEQ : 0;
+    }
+    hts_set_opt(fp, CRAM_OPT_REQUIRED_FIELDS, required_fields);
+    hFILE* hfp = cram_fd_get_fp(fp->fp.cram);
+    off_t start_offset = htell(hfp);
+
+    int ret = 0;
+    size_t ci = 0;
+    size_t ordinal = 0;
+    while ((ret = sam_read1(fp, h, b)) >= 0) {
+
+        // htslib reads a slice at a time so after decoding a record the stream
+        // is somewhere past the start of the container it belongs to and at
+        // most at the start of the next container
+        size_t stream_offset = htell(hfp);
+        bri_io_stream_update(stream, hfp);
+        size_t prev_ci = ci;
+        while(ci + 1 < num_containers && containers[ci + 1] < stream_offset) {
+            ci += 1;
+        }
+
+        if(ci != prev_ci) {
+            ordinal = 0;
+        }
+
+        if(ordinal > BRI_CRAM_MAX_ORDINAL) {
+            fprintf(stderr, "[bri] cram container at %zu has too many records to index\n", containers[ci]);
+            exit(EXIT_FAILURE);
+        }
+
+        // filtered records still count towards the ordinal
+        if(filter == NULL || bam_read_idx_filter_pass(filter, region, b)) {
+            fn(data, b, BRI_CRAM_OFFSET(containers[ci], ordinal));
+        }
+        ordinal += 1;
+    }
+
+    bri_stats_count(BRI_COUNTER_BYTES_READ, htell(hfp) - start_offset);
+    free(containers);
 }
 
 //
-void bam_read_idx_build(const char* filename, const char* output_bri)
+size_t bam_read_idx_scan(const char* filename, htsFile* fp, bam_hdr_t* h, bam1_t* b,
+                         const bam_read_idx_filter* filter, const char* key_tag, bri_io_stream* stream,
+                         bam_read_idx_scan_fn fn, void* data)
 {
-    htsFile *fp = hts_open(filename, "r");
-    if(fp == NULL) {
-        fprintf(stderr, "[bri] could not open %s\n", filename);
+    bam_read_idx_filter_region region;
+    if(filter != NULL && !bam_read_idx_filter_is_set(filter)) {
+        filter = NULL;
+    }
+
+    if(filter != NULL && bam_read_idx_filter_resolve(filter, h, &region) != 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    if(fp->format.format == cram) {
+        bam_read_idx_scan_cram(filename, fp, h, b, filter, &region, key_tag, stream, fn, data);
+    } else if(filter != NULL && filter->region != NULL) {
+        bam_read_idx_scan_bam_region(filename, fp, h, b, filter, &region, stream, fn, data);
+    } else {
+        return bam_read_idx_scan_bam(fp, h, b, SIZE_MAX, filter, &region, stream, fn, data);
+    }
+    return 0;
+}
+
+//
+void bam_read_idx_build_options_init(bam_read_idx_build_options* opts)
+{
+    opts->bloom_fpr = 0.0;
+    bam_read_idx_filter_init(&opts->filter);
+    opts->sparse_interval = 0;
+    opts->huge_pages = 0;
+    opts->shard_count = 0;
+    opts->checkpoint_dir = NULL;
+    opts->checkpoint_interval = BRI_CHECKPOINT_INTERVAL;
+    opts->io_policy = BRI_IO_BUFFERED;
+    opts->update = 0;
+    opts->key_tag[0] = '\0';
+    opts->reference = NULL;
+}
+
+//
+void bam_read_idx_build_files(const char** input_files, size_t num_files, const char* output_bri, const bam_read_idx_build_options* opts)
+{
+    if(num_files > BRI_MAX_FILES) {
+        fprintf(stderr, "[bri] at most %d files can be indexed together\n", BRI_MAX_FILES);
+        exit(EXIT_FAILURE);
+    }
+
+    // a sparse index relies on the order of the reads in a single file,
+    // and has records for too few alignments to filter them or their names
+    if(opts->sparse_interval > 0 && (num_files > 1 || opts->bloom_fpr > 0.0 || bam_read_idx_filter_is_set(&opts->filter))) {
+        fprintf(stderr, "[bri] a sparse index must be built from a single file without a bloom filter or filters\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // a sparse index is sampled by the order of the read names in the file
+    if(opts->sparse_interval > 0 && opts->key_tag[0] != '\0') {
+        fprintf(stderr, "[bri] a sparse index can't be keyed on a tag\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // the records of a sparse index are in file order, which sharding doesn't keep
+    if(opts->sparse_interval > 0 && opts->shard_count > 0) {
+        fprintf(stderr, "[bri] a sparse index can't be sharded\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // a build is resumed from the virtual offset of the next alignment, which
+    // isn't known for cram or when reading the chunks of a region
+    if(opts->checkpoint_dir != NULL && (opts->sparse_interval > 0 || opts->filter.region != NULL)) {
+        fprintf(stderr, "[bri] checkpoints can't be used with sparse indices or a region filter\n");
         exit(EXIT_FAILURE);
     }
 
     bam_read_idx* bri = bam_read_idx_init();
+    if(bri == NULL) {
+        fprintf(stderr, "[bri] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+    bri->bloom_fpr = opts->bloom_fpr;
+    memcpy(bri->key_tag, opts->key_tag, BRI_KEY_TAG_SIZE);
+    bri->name_arena.huge_pages = opts->huge_pages;
+    bri->record_arena.huge_pages = opts->huge_pages;
 
-    bam1_t* b = bam_init1();
-    bam_hdr_t *h = sam_hdr_read(fp);
-    int ret = 0;
-    size_t file_offset = bgzf_tell(fp->fp.bgzf);
-    while ((ret = sam_read1(fp, h, b)) >= 0) {
-        char* readname = bam_get_qname(b);
-        bam_read_idx_add(bri, readname, file_offset);
+    bri->filter = opts->filter;
+    if(opts->filter.region != NULL) {
+        bri->filter.region = strdup(opts->filter.region);
+        if(bri->filter.region == NULL) {
+            fprintf(stderr, "[bri] malloc failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
 
-        bam_read_idx_record brir = bri->records[bri->record_count - 1];
-        if(verbose && (bri->record_count == 1 || bri->record_count % 100000 == 0)) {
-            fprintf(stderr, "[bri-build] record %zu [%zu %zu] %s\n",
-                bri->record_count,
-                brir.read_name.offset,
-                brir.file_offset,
-                bri->readnames + brir.read_name.offset
-            );
+    if(num_files > 1) {
+        bri->file_count = num_files;
+        bri->file_names = malloc(num_files * sizeof(char*));
+        bri->file_name_starts = malloc(num_files * sizeof(size_t));
+        if(bri->file_names == NULL || bri->file_name_starts == NULL) {
+            fprintf(stderr, "[bri] malloc failed\n");
+            exit(EXIT_FAILURE);
         }
+    }
 
-        // update offset for next record
-        file_offset = bgzf_tell(fp->fp.bgzf);
+    // record how much of each bam was indexed so the index can be updated as
+    // the files grow. A resumed build restores the sources of the files its
+    // checkpoint covers.
+    if(opts->filter.region == NULL) {
+        bri->source_count = num_files;
+        bri->sources = calloc(num_files, sizeof(bam_read_idx_source));
+        if(bri->sources == NULL) {
+            fprintf(stderr, "[bri] malloc failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    bam_read_idx_checkpoint ckpt;
+    size_t resume_file = 0;
+    size_t resume_offset = 0;
+    int resumed = 0;
+    if(opts->checkpoint_dir != NULL) {
+        resumed = bam_read_idx_checkpoint_open(&ckpt, opts->checkpoint_dir, opts->checkpoint_interval,
+                                               input_files, num_files, bri, &resume_file, &resume_offset);
+    }
+
+    bri_stats_start(BRI_PHASE_SCAN);
+    for(size_t fi = 0; fi < num_files; ++fi) {
+        const char* filename = input_files[fi];
+        htsFile *fp = hts_open(filename, "r");
+        if(fp == NULL) {
+            fprintf(stderr, "[bri] could not open %s\n", filename);
+            exit(EXIT_FAILURE);
+        }
+
+        int format;
+        if(fp->format.format == cram) {
+            format = BRI_FORMAT_CRAM;
+        } else if(fp->format.format == bam) {
+            format = BRI_FORMAT_BAM;
+        } else if(fp->format.format == fastq_format && fp->format.compression == bgzf) {
+            format = BRI_FORMAT_FASTQ;
+        } else {
+            fprintf(stderr, "[bri] %s is not a bam, cram or bgzip compressed fastq file\n", filename);
+            exit(EXIT_FAILURE);
+        }
+
+        // the format applies to every record so the files can't be mixed
+        if(fi > 0 && format != bri->format) {
+            fprintf(stderr, "[bri] %s is not the same type as %s\n", filename, input_files[0]);
+            exit(EXIT_FAILURE);
+        }
+        bri->format = format;
+
+        // decoding the sequence of a cram file needs the reference, if it isn't
+        // given htslib will try to find it using the header or REF_PATH
+        if(format == BRI_FORMAT_CRAM && opts->reference != NULL && hts_set_fai_filename(fp, opts->reference) != 0) {
+            fprintf(stderr, "[bri] could not load reference %s\n", opts->reference);
+            exit(EXIT_FAILURE);
+        }
+
+        if(opts->checkpoint_dir != NULL && format != BRI_FORMAT_BAM) {
+            fprintf(stderr, "[bri] checkpoints can only be used with bam files\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // the names of the files the checkpoint covers were restored with its records
+        if(bri->file_count > 0) {
+            // store the absolute path so the index can be used from any directory
+            bri->file_names[fi] = realpath(filename, NULL);
+            if(bri->file_names[fi] == NULL) {
+                fprintf(stderr, "[bri] could not resolve the path of %s\n", filename);
+                exit(EXIT_FAILURE);
+            }
+            if(!resumed || fi > resume_file) {
+                bri->file_name_starts[fi] = bri->name_arena.next;
+            }
+        }
+
+        if(resumed && fi < resume_file) {
+            hts_close(fp);
+            continue;
+        }
+
+        if(opts->checkpoint_dir != NULL && (!resumed || fi > resume_file)) {
+            bam_read_idx_checkpoint_start_file(&ckpt, fi);
+        }
+
+        if(verbose && num_files > 1) {
+            fprintf(stderr, "[bri-build] indexing file %zu: %s\n", fi, filename);
+        }
+
+        // fastq files are reopened below, so keep htslib's block size for them
+        bri_io_stream stream_data;
+        bri_io_stream* stream = NULL;
+        if(opts->io_policy == BRI_IO_STREAM &&
+           bri_io_stream_open(&stream_data, filename, format == BRI_FORMAT_FASTQ ? NULL : fp) == 0) {
+            stream = &stream_data;
+        }
+
+        // fastq is read as lines of text rather than as alignments
+        if(format == BRI_FORMAT_FASTQ) {
+            hts_close(fp);
+            if(opts->sparse_interval > 0 || bam_read_idx_filter_is_set(&bri->filter) || bri->key_tag[0] != '\0') {
+                fprintf(stderr, "[bri] filters, sparse indices and key tags can't be used with fastq files\n");
+                exit(EXIT_FAILURE);
+            }
+
+            BGZF* bfp = bgzf_open(filename, "r");
+            if(bfp == NULL) {
+                fprintf(stderr, "[bri] could not open %s\n", filename);
+                exit(EXIT_FAILURE);
+            }
+            bam_read_idx_scan_fastq(filename, bfp, stream, bri);
+            bgzf_close(bfp);
+            if(stream != NULL) {
+                bri_io_stream_close(stream);
+            }
+            continue;
+        }
+
+        bam1_t* b = bam_init1();
+        bam_hdr_t *h = sam_hdr_read(fp);
+
+        int record_source = bri->sources != NULL && format == BRI_FORMAT_BAM;
+        if(record_source) {
+            bam_read_idx_source_start(&bri->sources[fi], filename);
+        }
+
+        size_t end_offset = 0;
+        if(opts->sparse_interval > 0) {
+            if(format != BRI_FORMAT_BAM) {
+                fprintf(stderr, "[bri] a sparse index can only be built for a bam file\n");
+                exit(EXIT_FAILURE);
+            }
+
+            bam_read_idx_sparse_builder builder;
+            bam_read_idx_sparse_builder_init(&builder, bri, opts->sparse_interval);
+            end_offset = bam_read_idx_scan(filename, fp, h, b, NULL, bri->key_tag, stream, bam_read_idx_sparse_build_add, &builder);
+            if(bam_read_idx_sparse_builder_finish(&builder) != 0) {
+                fprintf(stderr, "[bri] %s is not sorted by read name, a sparse index can't be built\n", filename);
+                exit(EXIT_FAILURE);
+            }
+
+            if(verbose) {
+                fprintf(stderr, "[bri-build] %zu reads sorted in %s order\n", builder.reads,
+                    bri->name_order == BRI_NAME_ORDER_NATURAL ? "natural" : "lexicographic");
+            }
+        } else if(opts->checkpoint_dir != NULL) {
+            if(resumed && fi == resume_file && resume_offset > 0 && bri_stats_bgzf_seek(fp->fp.bgzf, resume_offset) != 0) {
+                fprintf(stderr, "[bri] could not resume %s from offset %zu\n", filename, resume_offset);
+                exit(EXIT_FAILURE);
+            }
+            end_offset = bam_read_idx_scan(filename, fp, h, b, &bri->filter, bri->key_tag, stream, bam_read_idx_checkpoint_add, &ckpt);
+        } else {
+            end_offset = bam_read_idx_scan(filename, fp, h, b, &bri->filter, bri->key_tag, stream, bam_read_idx_build_add, bri);
+        }
+
+        if(record_source) {
+            bam_read_idx_source_finish(&bri->sources[fi], filename, end_offset);
+        }
+
+        bam_hdr_destroy(h);
+        bam_destroy1(b);
+        hts_close(fp);
+        if(stream != NULL) {
+            bri_io_stream_close(stream);
+        }
     }
 
-    bam_hdr_destroy(h);
-    bam_destroy1(b);
-    hts_close(fp);
+    bri_stats_stop(BRI_PHASE_SCAN);
+
+    if(bri->format != BRI_FORMAT_BAM) {
+        free(bri->sources);
+        bri->sources = NULL;
+        bri->source_count = 0;
+    }
 
     // save to disk and cleanup
     if(verbose) {
         fprintf(stderr, "[bri-build] writing to disk...\n");
     }
 
-    char* out_fn = generate_index_filename(filename, output_bri);
-    bam_read_idx_save(bri, out_fn);
+    char* out_fn = generate_key_index_filename(input_files[0], output_bri, bri->key_tag);
+    if(out_fn == NULL) {
+        fprintf(stderr, "[bri] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t record_count = bri->record_count;
+    if(opts->shard_count > 0) {
+        bam_read_idx_save_shards(bri, opts->shard_count, out_fn);
+    } else {
+        bam_read_idx_save(bri, out_fn);
+    }
 
     if(verbose) {
-        fprintf(stderr, "[bri-build] wrote index for %zu records.\n", bri->record_count);
+        fprintf(stderr, "[bri-build] wrote index for %zu records.\n", record_count);
+    }
+
+    if(opts->checkpoint_dir != NULL) {
+        bam_read_idx_checkpoint_finish(&ckpt);
     }
 
     free(out_fn);
     bam_read_idx_destroy(bri);
 }
 
-void print_error_and_exit(const char* msg)
+//
+void bam_read_idx_build(const char* filename, const char* output_bri)
 {
-    fprintf(stderr, "[bri] %s\n", msg);
-    exit(EXIT_FAILURE);
+    bam_read_idx_build_options opts;
+    bam_read_idx_build_options_init(&opts);
+    bam_read_idx_build_files(&filename, 1, output_bri, &opts);
+}
+
+// FNV-1a followed by a 64-bit finalizer (from splitmix64) to
+// spread the bits, as FNV alone mixes the high bits poorly
+uint64_t bam_read_idx_hash_name(const char* name)
+{
+    uint64_t h = 14695981039346656037ull;
+    for(const unsigned char* p = (const unsigned char*)name; *p != '\0'; ++p) {
+        h ^= *p;
+        h *= 1099511628211ull;
+    }
+
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return h;
 }
 
 //
-bam_read_idx* bam_read_idx_load(const char* input_bam, const char* input_bri)
+size_t bam_read_idx_record_file_id(const bam_read_idx* bri, const bam_read_idx_record* record)
 {
-    char* index_fn = generate_index_filename(input_bam, input_bri);
-    FILE* fp = fopen(index_fn, "rb");
-    if(fp == NULL) {
-        fprintf(stderr, "[bri] index file not found for %s\n", input_bam);
-        exit(EXIT_FAILURE);
+    return bri->file_ids != NULL ? bri->file_ids[record - bri->records] : 0;
+}
+
+// read the file table section, a list of null terminated paths
+// returns 0 on success and -1 on error
+int bam_read_idx_load_file_names(bam_read_idx* bri, FILE* fp, size_t bytes)
+{
+    char* names = malloc(bytes);
+    if(names == NULL || bytes == 0 || fread(names, bytes, 1, fp) != 1 || names[bytes - 1] != '\0') {
+        free(names);
+        return -1;
     }
 
-    bam_read_idx* bri = bam_read_idx_init();
-    size_t file_version;
-    // currently ignored
-    int bytes_read = fread(&file_version, sizeof(file_version), 1, fp);
-    if(bytes_read <= 0) {
-        print_error_and_exit("read error");
+    size_t count = 0;
+    for(size_t i = 0; i < bytes; ++i) {
+        count += names[i] == '\0';
     }
 
-    // read size of readames segment
-    bytes_read = fread(&bri->name_count_bytes, sizeof(bri->name_count_bytes), 1, fp);
-    if(bytes_read <= 0) {
-        print_error_and_exit("read error");
+    bri->file_names = calloc(count, sizeof(char*));
+    if(bri->file_names == NULL) {
+        free(names);
+        return -1;
     }
-    bri->name_capacity_bytes = bri->name_count_bytes;
+    bri->file_count = count;
 
-    // read number of records on disk
-    bytes_read = fread(&bri->record_count, sizeof(bri->record_count), 1, fp);
-    if(bytes_read <= 0) {
-        print_error_and_exit("read error");
+    const char* np = names;
+    for(size_t i = 0; i < bri->file_count; ++i) {
+        bri->file_names[i] = strdup(np);
+        np += strlen(np) + 1;
     }
+    free(names);
+    return 0;
+}
 
-    bri->record_capacity = bri->record_count;
+// read the index from fp into bri, returns 0 on success and -1 on error
+int bam_read_idx_read(bam_read_idx* bri, FILE* fp)
+{
+    size_t header[3];
+    if(fread(header, sizeof(size_t), 3, fp) != 3) {
+        return -1;
+    }
+
+    size_t file_version = header[0];
+    if(file_version > BRI_FILE_VERSION) {
+        fprintf(stderr, "[bri] index version %zu is newer than supported (%d)\n", file_version, BRI_FILE_VERSION);
+        return -1;
+    }
+
+    // size of readames segment and number of records on disk
+    bri->name_count_bytes = header[1];
+    bri->record_count = header[2];
 
     // allocate filenames
-    bri->readnames = malloc(bri->name_capacity_bytes);
+    bri->readnames = malloc(bri->name_count_bytes);
     if(bri->readnames == NULL) {
-        fprintf(stderr, "[bri] failed to allocate %zu bytes for read names\n", bri->name_capacity_bytes);
-        exit(EXIT_FAILURE);
+        fprintf(stderr, "[bri] failed to allocate %zu bytes for read names\n", bri->name_count_bytes);
+        return -1;
     }
 
     // allocate records
-    bri->records = malloc(bri->record_capacity * sizeof(bam_read_idx_record));
+    bri->records = malloc(bri->record_count * sizeof(bam_read_idx_record));
+    if(bri->records == NULL) {
+        fprintf(stderr, "[bri] failed to allocate %zu records\n", bri->record_count);
+        return -1;
+    }
 
-    // read the names
-    bytes_read = fread(bri->readnames, bri->name_count_bytes, 1, fp);
-    if(bytes_read <= 0) {
-        print_error_and_exit("read error");
+    // read the names and records
+    if(fread(bri->readnames, 1, bri->name_count_bytes, fp) != bri->name_count_bytes ||
+       fread(bri->records, sizeof(bam_read_idx_record), bri->record_count, fp) != bri->record_count) {
+        return -1;
     }
 
-    // read the records
-    bytes_read = fread(bri->records, bri->record_count, sizeof(bam_read_idx_record), fp);
-    if(bytes_read <= 0) {
-        print_error_and_exit("read error");
+    // read the optional sections, skipping any we don't know about
+    size_t section_header[2];
+    while(file_version >= 2 && fread(section_header, sizeof(size_t), 2, fp) == 2) {
+        size_t tag = section_header[0];
+        size_t bytes = section_header[1];
+        if(tag == BRI_SECTION_FORMAT && bytes == sizeof(size_t)) {
+            size_t format;
+            if(fread(&format, sizeof(format), 1, fp) != 1) {
+                return -1;
+            }
+            bri->format = format;
+        } else if(tag == BRI_SECTION_SPARSE && bytes == 2 * sizeof(size_t)) {
+            size_t sparse[2];
+            if(fread(sparse, sizeof(size_t), 2, fp) != 2) {
+                return -1;
+            }
+            bri->sparse_interval = sparse[0];
+            bri->name_order = sparse[1];
+        } else if(tag == BRI_SECTION_SHARDS && bytes == 2 * sizeof(size_t)) {
+            size_t shards[2];
+            if(fread(shards, sizeof(size_t), 2, fp) != 2) {
+                return -1;
+            }
+            bri->shard_count = shards[0];
+            bri->shard = shards[1];
+        } else if(tag == BRI_SECTION_SOURCES && bytes % sizeof(bam_read_idx_source) == 0 && bytes > 0) {
+            bri->source_count = bytes / sizeof(bam_read_idx_source);
+            bri->sources = malloc(bytes);
+            if(bri->sources == NULL || fread(bri->sources, sizeof(bam_read_idx_source), bri->source_count, fp) != bri->source_count) {
+                return -1;
+            }
+        } else if(tag == BRI_SECTION_KEY_TAG && bytes == 2) {
+            if(fread(bri->key_tag, 1, 2, fp) != 2) {
+                return -1;
+            }
+            bri->key_tag[2] = '\0';
+        } else if(tag == BRI_SECTION_BLOOM) {
+            bri->bloom = bam_read_idx_bloom_read(fp, bytes);
+            if(bri->bloom == NULL) {
+                return -1;
+            }
+        } else if(tag == BRI_SECTION_FILTER) {
+            if(bam_read_idx_filter_read(&bri->filter, fp, bytes) != 0) {
+                return -1;
+            }
+        } else if(tag == BRI_SECTION_FILES) {
+            if(bam_read_idx_load_file_names(bri, fp, bytes) != 0) {
+                return -1;
+            }
+        } else if(tag == BRI_SECTION_FILE_IDS && bytes == bri->record_count * sizeof(uint16_t)) {
+            bri->file_ids = malloc(bytes);
+            if(bri->file_ids == NULL || fread(bri->file_ids, sizeof(uint16_t), bri->record_count, fp) != bri->record_count) {
+                return -1;
+            }
+        } else if(fseek(fp, bytes, SEEK_CUR) != 0) {
+            return -1;
+        }
     }
+    return 0;
+}
 
-    // convert read name offsets to direct pointers
+// convert the read name offsets of a loaded index to direct pointers
+int bam_read_idx_fixup_names(bam_read_idx* bri)
+{
     for(size_t i = 0; i < bri->record_count; ++i) {
+        if(bri->records[i].read_name.offset >= bri->name_count_bytes) {
+            return -1;
+        }
         bri->records[i].read_name.ptr = bri->readnames + bri->records[i].read_name.offset;
 #ifdef BRI_INDEX_DEBUG
         fprintf(stderr, "[bri-load] record %zu %s %zu\n", i, bri->records[i].read_name.ptr, bri->records[i].file_offset);
 #endif
     }
+    return 0;
+}
+
+// load the index, returning NULL on error or if it is a manifest and allow_manifest is false
+static bam_read_idx* bam_read_idx_try_load_index(const char* input_bam, const char* input_bri, int allow_manifest)
+{
+    char* index_fn = generate_index_filename(input_bam, input_bri);
+    if(index_fn == NULL) {
+        return NULL;
+    }
+
+    FILE* fp = fopen(index_fn, "rb");
+    if(fp == NULL) {
+        fprintf(stderr, "[bri] index file %s not found\n", index_fn);
+        free(index_fn);
+        return NULL;
+    }
+
+    bri_stats_start(BRI_PHASE_LOAD);
+    bam_read_idx* bri = bam_read_idx_init();
+    int ret = bri != NULL ? bam_read_idx_read(bri, fp) : -1;
+    bri_stats_stop(BRI_PHASE_LOAD);
+
+    if(ret == 0) {
+        bri_stats_start(BRI_PHASE_FIXUP);
+        ret = bam_read_idx_fixup_names(bri);
+        bri_stats_stop(BRI_PHASE_FIXUP);
+    }
+
+    if(ret == 0 && !allow_manifest && bam_read_idx_is_manifest(bri)) {
+        fprintf(stderr, "[bri] %s is the manifest of a sharded index, use one of its shards (%s.0 ...)\n", index_fn, index_fn);
+        ret = -1;
+    } else if(ret != 0) {
+        fprintf(stderr, "[bri] failed to read index file %s\n", index_fn);
+    }
+
+    if(ret != 0) {
+        if(bri != NULL) {
+            bam_read_idx_destroy(bri);
+        }
+        bri = NULL;
+    }
 
     fclose(fp);
     free(index_fn);
     return bri;
 }
 
+//
+bam_read_idx* bam_read_idx_try_load(const char* input_bam, const char* input_bri)
+{
+    return bam_read_idx_try_load_index(input_bam, input_bri, 0);
+}
+
+//
+bam_read_idx* bam_read_idx_try_load_sharded(const char* input_bam, const char* input_bri)
+{
+    return bam_read_idx_try_load_index(input_bam, input_bri, 1);
+}
+
+//
+bam_read_idx* bam_read_idx_load(const char* input_bam, const char* input_bri)
+{
+    bam_read_idx* bri = bam_read_idx_try_load(input_bam, input_bri);
+    if(bri == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    return bri;
+}
+
 //
 // Getopt
 //
 enum {
     OPT_HELP = 1,
+    OPT_STATS,
+    OPT_HUGE_PAGES,
+    OPT_SHARDS,
+    OPT_CHECKPOINT,
+    OPT_CHECKPOINT_INTERVAL,
+    OPT_IO,
+    OPT_UPDATE,
+    OPT_KEY_TAG,
 };
 
-static const char* shortopts = ":i:v"; // placeholder
+static const char* shortopts = ":i:r:vb:F:m:R:s:"; // placeholder
 static const struct option longopts[] = {
     { "help",                      no_argument,       NULL, OPT_HELP },
     { "index",               required_argument,       NULL,      'i' },
+    { "reference",           required_argument,       NULL,      'r' },
     { "verbose",                   no_argument,       NULL,      'v' },
+    { "bloom",               required_argument,       NULL,      'b' },
+    { "stats",               required_argument,       NULL, OPT_STATS },
+    { "exclude-flags",       required_argument,       NULL,      'F' },
+    { "min-read-length",     required_argument,       NULL,      'm' },
+    { "region",              required_argument,       NULL,      'R' },
+    { "sparse",              required_argument,       NULL,      's' },
+    { "huge-pages",                no_argument,       NULL, OPT_HUGE_PAGES },
+    { "shards",              required_argument,       NULL, OPT_SHARDS },
+    { "checkpoint",          required_argument,       NULL, OPT_CHECKPOINT },
+    { "checkpoint-interval", required_argument,       NULL, OPT_CHECKPOINT_INTERVAL },
+    { "io",                  required_argument,       NULL, OPT_IO },
+    { "update",                    no_argument,       NULL, OPT_UPDATE },
+    { "key-tag",             required_argument,       NULL, OPT_KEY_TAG },
     { NULL, 0, NULL, 0 }
 };
 
 //
 void print_usage_index()
 {
-    fprintf(stderr, "usage: bri index [-v] [-i <index_filename.bri>] <input.bam>\n");
+    fprintf(stderr, "usage: bri index [-v] [-r <reference.fa>] [-b <fpr>] [-F <flags>] [-m <length>] [-R <region>] [-s <interval>] [--key-tag <TAG>] [--shards <N>] [--checkpoint <dir>] [--update] [--io <policy>] [--huge-pages] [--stats <stats.json>] [-i <index_filename.bri>] <input.bam|input.cram|input.fastq.gz> [input2.bam ...]\n");
+    fprintf(stderr, "  -b, --bloom FPR              write a bloom filter of the read names with false positive rate FPR (e.g. 0.01)\n");
+    fprintf(stderr, "  -F, --exclude-flags FLAGS    don't index alignments with any of FLAGS set (e.g. 0x104 for unmapped and secondary)\n");
+    fprintf(stderr, "  -m, --min-read-length N      don't index alignments of reads shorter than N, including hard clipped bases\n");
+    fprintf(stderr, "  -r, --reference FASTA        reference used to decode the sequences of cram files for -m\n");
+    fprintf(stderr, "  -R, --region REGION          only index alignments overlapping REGION (chr:start-end), bam files need a .bai\n");
+    fprintf(stderr, "  -s, --sparse K               for a bam sorted by read name, only index the first alignment of every K reads\n");
+    fprintf(stderr, "  --key-tag TAG                index the values of aux tag TAG (e.g. MI or CB) rather than the read names,\n");
+    fprintf(stderr, "                               writing <input>.TAG.bri unless -i is given\n");
+    fprintf(stderr, "  --shards N                   split the index by a hash of the read names into N files, <index>.0 to <index>.N-1,\n");
+    fprintf(stderr, "                               and write a manifest of them to the index\n");
+    fprintf(stderr, "  --checkpoint DIR             save the progress of the build to DIR so it can be resumed by running the\n");
+    fprintf(stderr, "                               same command again, bam files only\n");
+    fprintf(stderr, "  --checkpoint-interval SECS   seconds between checkpoints (default %d)\n", BRI_CHECKPOINT_INTERVAL);
+    fprintf(stderr, "  --update                     only index the alignments appended to the files since the index was\n");
+    fprintf(stderr, "                               written, and do nothing if none were, bam files only\n");
+    fprintf(stderr, "  --io POLICY                  how the input files are read: buffered (default), or stream to read in\n");
+    fprintf(stderr, "                               large blocks with readahead and drop them from the page cache once read\n");
+    fprintf(stderr, "  --huge-pages                 back the memory used while building with transparent huge pages\n");
+    fprintf(stderr, "  --stats FILE                 write timing and I/O statistics to FILE as JSON\n");
+    fprintf(stderr, "  when multiple files are given a single index covering all of them is written to -i\n");
 }
 
 //
 int bam_read_idx_index_main(int argc, char** argv)
 {
     char* output_bri = NULL;
+    char* stats_file = NULL;
+    char* end = NULL;
+    bam_read_idx_build_options opts;
+    bam_read_idx_build_options_init(&opts);
 
     int die = 0;
     for (char c; (c = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1;) {
@@ -365,12 +1236,81 @@ int bam_read_idx_index_main(int argc, char** argv)
             case OPT_HELP:
                 print_usage_index();
                 exit(EXIT_SUCCESS);
+            case OPT_STATS:
+                stats_file = optarg;
+                break;
+            case OPT_HUGE_PAGES:
+                opts.huge_pages = 1;
+                break;
+            case OPT_SHARDS:
+                opts.shard_count = strtoull(optarg, NULL, 10);
+                if(opts.shard_count == 0) {
+                    fprintf(stderr, "bri index: the number of shards must be positive\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_CHECKPOINT:
+                opts.checkpoint_dir = optarg;
+                break;
+            case OPT_CHECKPOINT_INTERVAL:
+                opts.checkpoint_interval = strtoull(optarg, NULL, 10);
+                break;
+            case OPT_UPDATE:
+                opts.update = 1;
+                break;
+            case OPT_KEY_TAG:
+                if(bam_read_idx_key_tag_parse(optarg, opts.key_tag) != 0) {
+                    fprintf(stderr, "bri index: %s is not a valid tag\n", optarg);
+                    die = 1;
+                }
+                break;
+            case OPT_IO:
+                opts.io_policy = bri_io_policy_parse(optarg);
+                if(opts.io_policy < 0) {
+                    fprintf(stderr, "bri index: unknown I/O policy %s\n", optarg);
+                    die = 1;
+                }
+                break;
             case 'i':
                 output_bri = optarg;
                 break;
+            case 'r':
+                opts.reference = optarg;
+                break;
             case 'v':
                 verbose = 1;
                 break;
+            case 'F':
+                opts.filter.exclude_flags = strtoul(optarg, &end, 0);
+                if(*optarg == '\0' || *end != '\0' || opts.filter.exclude_flags > 0xFFFF) {
+                    fprintf(stderr, "bri index: %s is not a valid set of flags\n", optarg);
+                    die = 1;
+                }
+                break;
+            case 'm':
+                opts.filter.min_read_length = strtoull(optarg, &end, 10);
+                if(*optarg == '\0' || *end != '\0' || *optarg == '-') {
+                    fprintf(stderr, "bri index: %s is not a valid read length\n", optarg);
+                    die = 1;
+                }
+                break;
+            case 'R':
+                opts.filter.region = optarg;
+                break;
+            case 's':
+                opts.sparse_interval = strtoull(optarg, NULL, 10);
+                if(opts.sparse_interval == 0) {
+                    fprintf(stderr, "bri index: the sparse interval must be positive\n");
+                    die = 1;
+                }
+                break;
+            case 'b':
+                opts.bloom_fpr = atof(optarg);
+                if(opts.bloom_fpr <= 0.0 || opts.bloom_fpr >= 1.0) {
+                    fprintf(stderr, "bri index: the bloom filter false positive rate must be between 0 and 1\n");
+                    die = 1;
+                }
+                break;
         }
     }
     
@@ -379,13 +1319,25 @@ int bam_read_idx_index_main(int argc, char** argv)
         die = 1;
     }
 
+    if (argc - optind > 1 && output_bri == NULL) {
+        fprintf(stderr, "bri index: an output index (-i) must be given when indexing multiple files\n");
+        die = 1;
+    }
+
     if(die) {
         print_usage_index();
         exit(EXIT_FAILURE);
     }
 
-    char* input_bam = argv[optind++];
-    bam_read_idx_build(input_bam, output_bri);
+    bri_stats_enable(stats_file != NULL);
+    if(opts.update) {
+        bam_read_idx_update_files((const char**)(argv + optind), argc - optind, output_bri, &opts);
+    } else {
+        bam_read_idx_build_files((const char**)(argv + optind), argc - optind, output_bri, &opts);
+    }
 
+    if(stats_file != NULL && bri_stats_write_json(stats_file, "index") != 0) {
+        exit(EXIT_FAILURE);
+    }
     return 0;
 }
@@ -16,6 +16,12 @@
 #include <htslib/sam.h>
 #include <htslib/hts.h>
 #include <htslib/bgzf.h>
+#include "bri_filter.h"
+#include "bri_arena.h"
+#include "bri_io.h"
+#include "bri_key.h"
+
+#define BRI_VERSION "0.3"
 
 // An entry record in the index, storing
 // either an offset or pointer to the readname
@@ -24,7 +30,7 @@ typedef struct bam_read_idx_record
 {
     // When building the index and storing it on disk
     // the read name for this record is stored as an
-    // offset into readnames. When it is loaded from
+    // offset into the names. When it is loaded from
     // disk the size of the index is fixed and we
     // convert the offset into a direct pointer.
     union read_name {
@@ -35,6 +41,60 @@ typedef struct bam_read_idx_record
     size_t file_offset;
 } bam_read_idx_record;
 
+// The type of file the index was built from. This determines
+// how the file_offset of each record is interpreted: for BAM
+// it is a BGZF virtual offset, for CRAM see bri_cram.h and
+// for bgzip compressed FASTQ it is the virtual offset of the
+// record's header line, see bri_fastq.h
+enum bam_read_idx_format
+{
+    BRI_FORMAT_BAM = 0,
+    BRI_FORMAT_CRAM = 1,
+    BRI_FORMAT_FASTQ = 2
+};
+
+// Version 2 of the file format added the optional
+// sections described below
+#define BRI_FILE_VERSION 2
+
+// Optional data is stored on disk in tagged sections following
+// the records. Each section is written as its tag, the size of
+// its payload in bytes, then the payload itself, so readers can
+// skip sections they do not understand.
+#define BRI_SECTION_FORMAT 1
+#define BRI_SECTION_FILES 2
+#define BRI_SECTION_FILE_IDS 3
+#define BRI_SECTION_BLOOM 4
+#define BRI_SECTION_FILTER 5
+#define BRI_SECTION_DIRECTORY 6
+#define BRI_SECTION_SPARSE 7
+#define BRI_SECTION_SHARDS 8
+#define BRI_SECTION_SOURCES 9
+#define BRI_SECTION_KEY_TAG 10
+
+// The records are divided into pages of this many records for
+// lookups that don't load the whole index, see bri_paged.h
+#define BRI_PAGE_RECORDS 512
+
+// A single index can cover up to this many files, the
+// file of each record is stored as a 16-bit ID
+#define BRI_MAX_FILES 65536
+
+// How much of an input file was indexed, so that an update only
+// reads what has been appended to it since, see bri_update.h
+typedef struct bam_read_idx_source
+{
+    // the size of the file before it was scanned, and the virtual
+    // offset following the last alignment read from it
+    size_t file_bytes;
+    size_t end_offset;
+
+    // hash of the compressed bytes at the start and end of the indexed
+    // part of the file, to detect a file that was replaced rather than
+    // appended to
+    uint64_t fingerprint;
+} bam_read_idx_source;
+
 //
 // The index itself consists of two parts,
 //  1) a memory block containing the names of every indexed read
@@ -44,25 +104,200 @@ typedef struct bam_read_idx
 {
     // read names are stored contiguously in one large block
     // of memory as null terminated strings
-    size_t name_capacity_bytes;
     size_t name_count_bytes;
     char* readnames;
 
     // records giving the offset into the bam file
-    size_t record_capacity;
     size_t record_count;
     bam_read_idx_record* records;
+
+    // While building, names and records are allocated from these arenas
+    // instead, so they are never copied as the index grows. The name
+    // offsets of the records are offsets into name_arena. The records
+    // are moved into records by bam_read_idx_compact_records.
+    bri_arena name_arena;
+    bri_arena record_arena;
+
+    // the type of file indexed, see bam_read_idx_format
+    int format;
+
+    // When the index covers multiple files the absolute path of each
+    // file is stored, along with the ID of the file each record
+    // belongs to (parallel to records). For an index over a single
+    // file file_count is 0 and the file is given by the caller.
+    size_t file_count;
+    char** file_names;
+    uint16_t* file_ids;
+
+    // while building, the offset into name_arena of the first
+    // name added from each file, used to assign file IDs
+    size_t* file_name_starts;
+
+    // while building, set when the records are added in name order
+    // so bam_read_idx_save doesn't sort them. The file IDs of the
+    // records are then given in file_ids rather than file_name_starts.
+    int records_sorted;
+
+    // for each input file, how much of it was indexed. NULL if unknown,
+    // which is the case for cram and fastq and with a region filter.
+    size_t source_count;
+    bam_read_idx_source* sources;
+
+    // optional bloom filter over the distinct read names, used to
+    // quickly reject names that aren't in the index. When building,
+    // the filter is written if bloom_fpr is greater than zero.
+    struct bam_read_idx_bloom* bloom;
+    double bloom_fpr;
+
+    // the alignments that were indexed, see bri_filter.h
+    bam_read_idx_filter filter;
+
+    // the aux tag the index is keyed on, see bri_key.h. Empty for an
+    // index of read names, otherwise "names" are the tag values.
+    char key_tag[BRI_KEY_TAG_SIZE];
+
+    // for a sparse index of a name sorted file (see bri_sparse.h), the number
+    // of reads per record and the order of the names, which the records are
+    // also kept in. 0 for an index with a record for every alignment.
+    size_t sparse_interval;
+    int name_order;
+
+    // for a sharded index (see bri_shard.h), the number of shards and which
+    // shard this is, or shard_count for the manifest. 0 for an unsharded index.
+    size_t shard_count;
+    size_t shard;
 } bam_read_idx;
 
+// Options that control how an index is built
+typedef struct bam_read_idx_build_options
+{
+    // false positive rate of the bloom filter, or 0 to not write one
+    double bloom_fpr;
+
+    // only alignments that pass this filter are indexed. The
+    // region string is copied when building.
+    bam_read_idx_filter filter;
+
+    // if greater than zero, build a sparse index with a record for
+    // every sparse_interval reads of a name sorted bam file
+    size_t sparse_interval;
+
+    // back the memory used while building with huge pages, see bri_arena.h
+    int huge_pages;
+
+    // if greater than zero, split the index into this many shards, see bri_shard.h
+    size_t shard_count;
+
+    // if not NULL, checkpoint the build to this directory every
+    // checkpoint_interval seconds so it can be resumed, see bri_checkpoint.h
+    const char* checkpoint_dir;
+    size_t checkpoint_interval;
+
+    // how the input files are read, see bri_io.h
+    int io_policy;
+
+    // index only what was appended to the files since the existing
+    // index was written, see bri_update.h
+    int update;
+
+    // key the index on the value of this aux tag rather than
+    // the read name if it isn't empty, see bri_key.h
+    char key_tag[BRI_KEY_TAG_SIZE];
+
+    // optional fasta used to decode cram files when filtering on
+    // read length, which needs the sequence
+    const char* reference;
+} bam_read_idx_build_options;
+
+// the filename of the index for input_bam, which is input_bri if it is
+// not NULL. Returns NULL if out of memory, otherwise the caller frees it.
+char* generate_index_filename(const char* input_bam, const char* input_bri);
+
 // load the index for input_bam file
 // returns a pointer to the index, which must be deallocated by
-// the caller using bam_read_idx_destroy.
+// the caller using bam_read_idx_destroy. Exits if the index can't be loaded.
 bam_read_idx* bam_read_idx_load(const char* input_bam, const char* input_bri);
 
+// as bam_read_idx_load, but returns NULL if the index can't be loaded
+bam_read_idx* bam_read_idx_try_load(const char* input_bam, const char* input_bri);
+
+// as bam_read_idx_try_load, but also loads the manifest of a sharded index,
+// which has no records, rather than failing
+bam_read_idx* bam_read_idx_try_load_sharded(const char* input_bam, const char* input_bri);
+
 // construct the index for input_bam and save it to disk
 // to use the created index bam_read_idx_load should be called
 void bam_read_idx_build(const char* input_bam, const char* output_bri);
 
+// called by bam_read_idx_scan for every alignment, with the
+// offset the alignment is stored at in the index
+typedef void (*bam_read_idx_scan_fn)(void* data, const bam1_t* b, size_t file_offset);
+
+// read every alignment of fp, a bam or cram file opened from filename with its
+// header already read, in file order and call fn on each that passes filter
+// (which may be NULL). key_tag is the tag fn keys the alignments on, see
+// bri_key.h, so that it is decoded from cram files. If stream is not NULL the file is read under the
+// streaming I/O policy, see bri_io.h. A bam file without a region is read
+// from the current position of fp, and the virtual offset following the
+// last alignment read is returned. Otherwise 0 is returned. Exits on error.
+size_t bam_read_idx_scan(const char* filename, htsFile* fp, bam_hdr_t* h, bam1_t* b,
+                         const bam_read_idx_filter* filter, const char* key_tag, bri_io_stream* stream,
+                         bam_read_idx_scan_fn fn, void* data);
+
+// set the build options to their defaults
+void bam_read_idx_build_options_init(bam_read_idx_build_options* opts);
+
+// construct a single index covering all num_files input files and save
+// it to output_bri. All files must be the same type (bam or cram).
+void bam_read_idx_build_files(const char** input_files, size_t num_files, const char* output_bri, const bam_read_idx_build_options* opts);
+
+// allocate an empty index, returns NULL if out of memory
+bam_read_idx* bam_read_idx_init();
+
+// add a record for readname at offset to an index being built,
+// the name is stored as an offset into name_arena. Exits if out of memory.
+void bam_read_idx_add(bam_read_idx* bri, const char* readname, size_t offset);
+
+// the name at offset in an index being built
+const char* bam_read_idx_build_name(const bam_read_idx* bri, size_t offset);
+
+// the i-th record added to an index being built
+const bam_read_idx_record* bam_read_idx_build_record(const bam_read_idx* bri, size_t i);
+
+// move the records of an index being built out of the arena into a
+// single array, after which no more records can be added. Called by
+// bam_read_idx_save. Exits if out of memory.
+void bam_read_idx_compact_records(bam_read_idx* bri);
+
+// sort the records of an index being built by name and write it
+// to filename. Exits if the file can't be written.
+void bam_read_idx_save(bam_read_idx* bri, const char* filename);
+
+// read the FILES section of size bytes from fp into the file names of bri,
+// returns 0 on success
+int bam_read_idx_load_file_names(bam_read_idx* bri, FILE* fp, size_t bytes);
+
+// print the periodic progress message for the record that was just added
+void bam_read_idx_build_progress(const bam_read_idx* bri);
+
+// add a record found while scanning to the index, data is the
+// index being built, see bam_read_idx_scan_fn
+void bam_read_idx_build_add(void* data, const bam1_t* b, size_t file_offset);
+
+// the ID of the file the name at offset in an index being built was added from
+size_t bam_read_idx_build_file_id(const bam_read_idx* bri, size_t offset);
+
+// sort_r comparison function for records of an index being built,
+// names is the bri_arena the record offsets refer to
+int compare_records_by_readname_offset(const void* r1, const void* r2, void* names);
+
+// stable 64-bit hash of a read name
+uint64_t bam_read_idx_hash_name(const char* name);
+
+// returns the ID of the file the record belongs to, which is
+// always 0 for an index over a single file
+size_t bam_read_idx_record_file_id(const bam_read_idx* bri, const bam_read_idx_record* record);
+
 // cleanup the index by deallocating everything
 void bam_read_idx_destroy(bam_read_idx* bri);
 
@@ -0,0 +1,154 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+
+// for posix_fadvise and mincore
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bri_io.h"
+
+extern char verbose;
+
+// bytes of a file checked with each call to mincore (1GB)
+#define BRI_IO_MINCORE_WINDOW ((size_t)1 << 30)
+
+static const char* bri_io_policy_names[] = { "buffered", "stream" };
+
+//
+int bri_io_policy_parse(const char* name)
+{
+    for(int p = BRI_IO_BUFFERED; p <= BRI_IO_STREAM; ++p) {
+        if(strcmp(name, bri_io_policy_names[p]) == 0) {
+            return p;
+        }
+    }
+    return -1;
+}
+
+//
+const char* bri_io_policy_name(int policy)
+{
+    return bri_io_policy_names[policy];
+}
+
+//
+int bri_io_stream_open(bri_io_stream* stream, const char* filename, htsFile* fp)
+{
+    memset(stream, 0, sizeof(bri_io_stream));
+    stream->fd = open(filename, O_RDONLY);
+    if(stream->fd < 0) {
+        fprintf(stderr, "[bri] could not open %s to stream it, using buffered reads\n", filename);
+        return -1;
+    }
+
+    // htslib's default 32KB buffer takes a system call for every few blocks
+    if(fp != NULL && hts_set_opt(fp, HTS_OPT_BLOCK_SIZE, BRI_IO_BLOCK_SIZE) != 0 && verbose) {
+        fprintf(stderr, "[bri-build] could not set the block size of %s\n", filename);
+    }
+
+    bri_io_stream_advance(stream, 0);
+    return 0;
+}
+
+// Everything before position has been copied into htslib's buffers so
+// the pages holding it can be dropped. Pages only partly before position
+// aren't dropped by the kernel, so they are dropped with the next range.
+void bri_io_stream_advance(bri_io_stream* stream, off_t position)
+{
+    off_t readahead_end = position + BRI_IO_READAHEAD;
+    if(readahead_end > stream->advised_end) {
+        posix_fadvise(stream->fd, stream->advised_end, readahead_end - stream->advised_end, POSIX_FADV_WILLNEED);
+        stream->advised_end = readahead_end;
+    }
+
+    if(position > stream->dropped_end) {
+        posix_fadvise(stream->fd, stream->dropped_end, position - stream->dropped_end, POSIX_FADV_DONTNEED);
+        stream->dropped_end = position - position % sysconf(_SC_PAGESIZE);
+    }
+    stream->next_update = position + BRI_IO_READAHEAD / 4;
+}
+
+//
+void bri_io_stream_close(bri_io_stream* stream)
+{
+    // a length of 0 is to the end of the file, which includes any
+    // readahead past the last record
+    posix_fadvise(stream->fd, stream->dropped_end, 0, POSIX_FADV_DONTNEED);
+    close(stream->fd);
+    stream->fd = -1;
+}
+
+//
+int bri_io_drop_cached(const char* filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) {
+        return -1;
+    }
+
+    // dirty pages aren't dropped
+    int ret = fdatasync(fd) == 0 && posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0 ? 0 : -1;
+    close(fd);
+    return ret;
+}
+
+//
+int64_t bri_io_cached_bytes(const char* filename, size_t* file_bytes)
+{
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) != 0) {
+        if(fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    *file_bytes = st.st_size;
+
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    unsigned char* pages = malloc(BRI_IO_MINCORE_WINDOW / page_size);
+    if(pages == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    // map and check the file a window at a time to bound the memory used
+    int64_t cached = 0;
+    for(size_t offset = 0; offset < *file_bytes && cached >= 0; offset += BRI_IO_MINCORE_WINDOW) {
+        size_t length = *file_bytes - offset < BRI_IO_MINCORE_WINDOW ? *file_bytes - offset : BRI_IO_MINCORE_WINDOW;
+        void* map = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, offset);
+        if(map == MAP_FAILED) {
+            cached = -1;
+            break;
+        }
+
+        size_t num_pages = (length + page_size - 1) / page_size;
+        if(mincore(map, length, pages) != 0) {
+            cached = -1;
+        } else {
+            for(size_t i = 0; i < num_pages; ++i) {
+                if(pages[i] & 1) {
+                    size_t page_end = (i + 1) * page_size;
+                    cached += (page_end > length ? length : page_end) - i * page_size;
+                }
+            }
+        }
+        munmap(map, length);
+    }
+
+    free(pages);
+    close(fd);
+    return cached;
+}
@@ -0,0 +1,89 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+// The I/O policy for the single sequential pass over the input files
+// when building an index. With BRI_IO_BUFFERED the files are read
+// through htslib's small buffer and the kernel's default readahead, and
+// every page read stays in the page cache. BRI_IO_STREAM reads in large
+// blocks, asks the kernel to read a window ahead of the scan, and drops
+// the pages behind it from the cache, so indexing a large file doesn't
+// evict the data of other processes.
+//
+// The advice is given through a second descriptor for the same file, as
+// htslib doesn't expose its own. Readahead and dropping pages act on the
+// file's page cache, so it applies to htslib's reads all the same.
+//
+#ifndef BAM_READ_IDX_IO
+#define BAM_READ_IDX_IO
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <htslib/hfile.h>
+#include <htslib/hts.h>
+
+enum bri_io_policy
+{
+    BRI_IO_BUFFERED = 0,
+    BRI_IO_STREAM
+};
+
+// size of htslib's reads when streaming (4MB)
+#define BRI_IO_BLOCK_SIZE (4 << 20)
+
+// bytes to read ahead of the scan when streaming (64MB)
+#define BRI_IO_READAHEAD (64 << 20)
+
+typedef struct bri_io_stream
+{
+    int fd;
+
+    // the file is advised up to advised_end, and pages before
+    // dropped_end have been dropped. The advice is updated once the
+    // scan reaches next_update, a quarter of the window at a time.
+    off_t advised_end;
+    off_t dropped_end;
+    off_t next_update;
+} bri_io_stream;
+
+// parse the name of a policy, returning -1 if it isn't known
+int bri_io_policy_parse(const char* name);
+const char* bri_io_policy_name(int policy);
+
+// Start streaming filename, which fp is reading if it isn't NULL. Returns
+// 0 on success and -1 if the file can't be opened for advice, in which case
+// the scan should go ahead with stream set to NULL.
+int bri_io_stream_open(bri_io_stream* stream, const char* filename, htsFile* fp);
+
+// update the advice for the scan having read up to position in the file
+void bri_io_stream_advance(bri_io_stream* stream, off_t position);
+
+// drop the rest of the file from the cache and close the descriptor
+void bri_io_stream_close(bri_io_stream* stream);
+
+// called as the scan reads hfp, cheap enough to call for every record
+static inline void bri_io_stream_update(bri_io_stream* stream, hFILE* hfp)
+{
+    if(stream != NULL) {
+        off_t position = htell(hfp);
+        if(position >= stream->next_update) {
+            bri_io_stream_advance(stream, position);
+        }
+    }
+}
+
+// write any changes to filename to disk and drop it from the page cache,
+// so it is read from the device next. Returns 0 on success and -1 on error.
+int bri_io_drop_cached(const char* filename);
+
+// The bytes of filename that are in the page cache, and the size of the
+// file in file_bytes. Returns -1 if this can't be determined.
+int64_t bri_io_cached_bytes(const char* filename, size_t* file_bytes);
+
+#endif
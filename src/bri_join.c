@@ -0,0 +1,404 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+// Join two indexed files by read name. Both indices are sorted by
+// name so they are merged in one linear pass. The alignments of the
+// selected names are collected into batches, which are read from
+// each file in offset order then written out in name order.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <getopt.h>
+#include "bri_index.h"
+#include "bri_get.h"
+#include "bri_stats.h"
+#include "bri_join.h"
+
+// number of bytes of decompressed blocks kept cached per bam file
+#define BRI_JOIN_CACHE_SIZE (16 * 1024 * 1024)
+
+extern char verbose;
+
+enum {
+    BRI_JOIN_INNER = 0,
+    BRI_JOIN_LEFT_ONLY,
+    BRI_JOIN_RIGHT_ONLY
+};
+
+// an alignment to be read into slot of the batch buffer
+typedef struct join_entry
+{
+    size_t file_id;
+    const bam_read_idx_record* record;
+    size_t slot;
+} join_entry;
+
+// one side of the join: its index, open files, output and current batch
+typedef struct join_side
+{
+    bam_read_idx* bri;
+    bam_read_idx_handles* handles;
+    size_t* positions;
+
+    htsFile* out_fp;
+    bam_hdr_t* out_hdr;
+
+    // alignments to read in the current batch, in name order
+    size_t n;
+    size_t capacity;
+    join_entry* entries;
+    bam1_t** buffer;
+} join_side;
+
+// order entries by file then by offset within the file
+static int compare_join_entries(const void* a, const void* b)
+{
+    const join_entry* e1 = a;
+    const join_entry* e2 = b;
+    if(e1->file_id != e2->file_id) {
+        return e1->file_id < e2->file_id ? -1 : 1;
+    }
+
+    size_t o1 = e1->record->file_offset;
+    size_t o2 = e2->record->file_offset;
+    return o1 < o2 ? -1 : (o1 > o2);
+}
+
+// load the index of one side
+static void join_side_load(join_side* side, const char* input_bam, const char* input_bri)
+{
+    memset(side, 0, sizeof(join_side));
+    side->bri = bam_read_idx_load(input_bam, input_bri);
+    if(side->bri->sparse_interval > 0) {
+        fprintf(stderr, "bri join: a sparse index doesn't have a record for every alignment\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// open the files of a side and its output, if the side is written
+static void join_side_open(join_side* side, const char* input_bam, const char* reference, const char* output, size_t batch_size)
+{
+    if(side->bri->format == BRI_FORMAT_FASTQ && output != NULL) {
+        fprintf(stderr, "bri join: alignments can't be written from fastq files, use bri diff or intersect\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(output == NULL) {
+        return;
+    }
+
+    side->handles = bam_read_idx_handles_init(side->bri, input_bam, reference);
+    side->positions = side->handles != NULL ? malloc(side->handles->count * sizeof(size_t)) : NULL;
+    side->entries = malloc(batch_size * sizeof(join_entry));
+    side->buffer = malloc(batch_size * sizeof(bam1_t*));
+    if(side->positions == NULL || side->entries == NULL || side->buffer == NULL) {
+        fprintf(stderr, "[bri] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    side->capacity = batch_size;
+    for(size_t i = 0; i < batch_size; ++i) {
+        side->buffer[i] = bam_init1();
+    }
+
+    for(size_t fi = 0; fi < side->handles->count; ++fi) {
+        side->positions[fi] = BRI_NO_POSITION;
+    }
+
+    // the output uses the header of the first input file, the others must match it
+    bam_hdr_t* first_hdr = NULL;
+    for(size_t fi = 0; fi < side->handles->count; ++fi) {
+        bam_hdr_t* h;
+        if(bam_read_idx_handles_get(side->handles, fi, &h) == NULL) {
+            exit(EXIT_FAILURE);
+        }
+
+        if(first_hdr == NULL) {
+            first_hdr = h;
+        } else if(!bam_read_idx_headers_compatible(first_hdr, h)) {
+            fprintf(stderr, "[bri] %s has different reference sequences to %s\n", side->handles->filenames[fi], side->handles->filenames[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    side->out_hdr = bam_hdr_dup(first_hdr);
+    if(sam_hdr_update_hd(side->out_hdr, "SO", "unsorted", "GO", "query") != 0) {
+        sam_hdr_add_line(side->out_hdr, "HD", "VN", "1.6", "SO", "unsorted", "GO", "query", NULL);
+    }
+
+    side->out_fp = hts_open(output, "wb");
+    if(side->out_fp == NULL || sam_hdr_write(side->out_fp, side->out_hdr) != 0) {
+        fprintf(stderr, "[bri] could not write to %s\n", output);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// read the alignments of the batch in file order, then write them in name order
+static void join_side_flush(join_side* side)
+{
+    qsort(side->entries, side->n, sizeof(join_entry), compare_join_entries);
+    for(size_t i = 0; i < side->n; ++i) {
+        const join_entry* entry = &side->entries[i];
+        int new_handle = side->handles->fps[entry->file_id] == NULL;
+
+        bam_hdr_t* h;
+        htsFile* fp = bam_read_idx_handles_get(side->handles, entry->file_id, &h);
+        if(fp == NULL) {
+            exit(EXIT_FAILURE);
+        }
+
+        if(new_handle && fp->format.format != cram) {
+            hts_set_cache_size(fp, BRI_JOIN_CACHE_SIZE);
+        }
+
+        if(bam_read_idx_read_record_from(fp, h, side->buffer[entry->slot], entry->record, &side->positions[entry->file_id]) != 0) {
+            fprintf(stderr, "[bri] failed to read alignment of %s\n", entry->record->read_name.ptr);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    bri_stats_start(BRI_PHASE_OUTPUT);
+    for(size_t i = 0; i < side->n; ++i) {
+        if(sam_write1(side->out_fp, side->out_hdr, side->buffer[i]) < 0) {
+            fprintf(stderr, "[bri] sam_write1 failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    bri_stats_stop(BRI_PHASE_OUTPUT);
+    side->n = 0;
+}
+
+// add the records [start, end) of the side's index to its batch
+static void join_side_add(join_side* side, size_t start, size_t end)
+{
+    for(size_t ri = start; ri < end; ++ri) {
+        if(side->n == side->capacity) {
+            join_side_flush(side);
+        }
+
+        const bam_read_idx_record* record = &side->bri->records[ri];
+        join_entry* entry = &side->entries[side->n];
+        entry->file_id = bam_read_idx_record_file_id(side->bri, record);
+        entry->record = record;
+        entry->slot = side->n;
+        side->n += 1;
+    }
+}
+
+//
+static void join_side_close(join_side* side)
+{
+    if(side->out_fp != NULL) {
+        join_side_flush(side);
+        if(hts_close(side->out_fp) != 0) {
+            fprintf(stderr, "[bri] could not close output\n");
+            exit(EXIT_FAILURE);
+        }
+        bam_hdr_destroy(side->out_hdr);
+    }
+
+    for(size_t i = 0; i < side->capacity; ++i) {
+        bam_destroy1(side->buffer[i]);
+    }
+    free(side->buffer);
+    free(side->entries);
+    free(side->positions);
+    if(side->handles != NULL) {
+        bam_read_idx_handles_destroy(side->handles);
+    }
+    bam_read_idx_destroy(side->bri);
+}
+
+// the end of the range of records with the same name as records[start],
+// names in a loaded index are stored once so can be compared by pointer
+static size_t join_group_end(const bam_read_idx* bri, size_t start)
+{
+    size_t end = start + 1;
+    while(end < bri->record_count && bri->records[end].read_name.ptr == bri->records[start].read_name.ptr) {
+        end += 1;
+    }
+    return end;
+}
+
+//
+// Getopt
+//
+enum {
+    OPT_HELP = 1,
+    OPT_STATS,
+    OPT_INDEX_A,
+    OPT_INDEX_B,
+};
+
+static const char* shortopts = ":m:o:b:r:v"; // placeholder
+static const struct option longopts[] = {
+    { "help",                      no_argument,       NULL, OPT_HELP },
+    { "mode",                required_argument,       NULL,      'm' },
+    { "output",              required_argument,       NULL,      'o' },
+    { "batch-size",          required_argument,       NULL,      'b' },
+    { "reference",           required_argument,       NULL,      'r' },
+    { "verbose",                   no_argument,       NULL,      'v' },
+    { "index-a",             required_argument,       NULL, OPT_INDEX_A },
+    { "index-b",             required_argument,       NULL, OPT_INDEX_B },
+    { "stats",               required_argument,       NULL, OPT_STATS },
+    { NULL, 0, NULL, 0 }
+};
+
+void print_usage_join()
+{
+    fprintf(stderr, "usage: bri join [-v] [-m inner|left|right] [-o <prefix>] [-b <batch_size>] [-r <reference.fa>] [--index-a <a.bri>] [--index-b <b.bri>] [--stats <stats.json>] <a.bam> <b.bam>\n");
+    fprintf(stderr, "  write the alignments of reads selected by comparing the names in two indexed files\n");
+    fprintf(stderr, "  -m, --mode MODE         inner: reads in both files, written to PREFIX.a.bam and PREFIX.b.bam with matching read order (default)\n");
+    fprintf(stderr, "                          left: reads only in a.bam, written to PREFIX.a.bam\n");
+    fprintf(stderr, "                          right: reads only in b.bam, written to PREFIX.b.bam\n");
+    fprintf(stderr, "  -o, --output PREFIX     prefix of the output files (default: join)\n");
+    fprintf(stderr, "  -b, --batch-size N      number of alignments of each file read together in offset order (default: 100000)\n");
+}
+
+//
+int bam_read_idx_join_main(int argc, char** argv)
+{
+    int mode = BRI_JOIN_INNER;
+    const char* prefix = "join";
+    const char* index_a = NULL;
+    const char* index_b = NULL;
+    const char* reference = NULL;
+    char* stats_file = NULL;
+    size_t batch_size = 100000;
+
+    int die = 0;
+    for (char c; (c = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1;) {
+        switch (c) {
+            case OPT_HELP:
+                print_usage_join();
+                exit(EXIT_SUCCESS);
+            case OPT_STATS:
+                stats_file = optarg;
+                break;
+            case OPT_INDEX_A:
+                index_a = optarg;
+                break;
+            case OPT_INDEX_B:
+                index_b = optarg;
+                break;
+            case 'm':
+                if(strcmp(optarg, "inner") == 0) {
+                    mode = BRI_JOIN_INNER;
+                } else if(strcmp(optarg, "left") == 0) {
+                    mode = BRI_JOIN_LEFT_ONLY;
+                } else if(strcmp(optarg, "right") == 0) {
+                    mode = BRI_JOIN_RIGHT_ONLY;
+                } else {
+                    fprintf(stderr, "bri join: unknown mode %s\n", optarg);
+                    die = 1;
+                }
+                break;
+            case 'o':
+                prefix = optarg;
+                break;
+            case 'r':
+                reference = optarg;
+                break;
+            case 'b':
+                batch_size = strtoull(optarg, NULL, 10);
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+        }
+    }
+
+    if (argc - optind != 2) {
+        fprintf(stderr, "bri join: two input files are required\n");
+        die = 1;
+    }
+
+    if(batch_size == 0) {
+        fprintf(stderr, "bri join: the batch size must be positive\n");
+        die = 1;
+    }
+
+    if(die) {
+        print_usage_join();
+        exit(EXIT_FAILURE);
+    }
+
+    bri_stats_enable(stats_file != NULL);
+
+    char* out_a = malloc(strlen(prefix) + 7);
+    char* out_b = malloc(strlen(prefix) + 7);
+    if(out_a == NULL || out_b == NULL) {
+        fprintf(stderr, "[bri] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+    sprintf(out_a, "%s.a.bam", prefix);
+    sprintf(out_b, "%s.b.bam", prefix);
+
+    join_side a, b;
+    join_side_load(&a, argv[optind], index_a);
+    join_side_load(&b, argv[optind + 1], index_b);
+
+    // the names of both indices must be the same kind of key
+    if(strcmp(a.bri->key_tag, b.bri->key_tag) != 0) {
+        fprintf(stderr, "[bri] the index of %s is keyed on %s but the index of %s is keyed on %s\n",
+            argv[optind], a.bri->key_tag[0] != '\0' ? a.bri->key_tag : "read names",
+            argv[optind + 1], b.bri->key_tag[0] != '\0' ? b.bri->key_tag : "read names");
+        exit(EXIT_FAILURE);
+    }
+
+    // only the sides that are written need outputs
+    join_side_open(&a, argv[optind], reference, mode != BRI_JOIN_RIGHT_ONLY ? out_a : NULL, batch_size);
+    join_side_open(&b, argv[optind + 1], reference, mode != BRI_JOIN_LEFT_ONLY ? out_b : NULL, batch_size);
+
+    // merge the two indices, each group is the records for one name
+    size_t ai = 0;
+    size_t bi = 0;
+    size_t selected = 0;
+    while(ai < a.bri->record_count || bi < b.bri->record_count) {
+        int cmp;
+        if(ai < a.bri->record_count && bi < b.bri->record_count) {
+            cmp = strcmp(a.bri->records[ai].read_name.ptr, b.bri->records[bi].read_name.ptr);
+        } else {
+            cmp = ai < a.bri->record_count ? -1 : 1;
+        }
+
+        size_t a_end = cmp <= 0 ? join_group_end(a.bri, ai) : ai;
+        size_t b_end = cmp >= 0 ? join_group_end(b.bri, bi) : bi;
+
+        if(cmp == 0 && mode == BRI_JOIN_INNER) {
+            join_side_add(&a, ai, a_end);
+            join_side_add(&b, bi, b_end);
+            selected += 1;
+        } else if(cmp < 0 && mode == BRI_JOIN_LEFT_ONLY) {
+            join_side_add(&a, ai, a_end);
+            selected += 1;
+        } else if(cmp > 0 && mode == BRI_JOIN_RIGHT_ONLY) {
+            join_side_add(&b, bi, b_end);
+            selected += 1;
+        }
+
+        ai = a_end;
+        bi = b_end;
+    }
+
+    if(verbose) {
+        fprintf(stderr, "[bri-join] selected %zu reads\n", selected);
+    }
+
+    join_side_close(&a);
+    join_side_close(&b);
+    free(out_a);
+    free(out_b);
+
+    if(stats_file != NULL && bri_stats_write_json(stats_file, "join") != 0) {
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
@@ -0,0 +1,73 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "bri_key.h"
+#include "bri_index.h"
+
+//
+int bam_read_idx_key_tag_parse(const char* arg, char* key_tag)
+{
+    if(strlen(arg) != 2 || !isalpha((unsigned char)arg[0]) || !isalnum((unsigned char)arg[1])) {
+        return -1;
+    }
+    memcpy(key_tag, arg, BRI_KEY_TAG_SIZE);
+    return 0;
+}
+
+//
+const char* bam_read_idx_key(const bam1_t* b, const char* key_tag, char* buffer)
+{
+    if(key_tag[0] == '\0') {
+        return bam_get_qname(b);
+    }
+
+    const uint8_t* aux = bam_aux_get(b, key_tag);
+    if(aux == NULL) {
+        return NULL;
+    }
+
+    switch(aux[0]) {
+        case 'Z':
+        case 'H':
+            return (const char*)(aux + 1);
+        case 'A':
+            buffer[0] = aux[1];
+            buffer[1] = '\0';
+            return buffer;
+        case 'c':
+        case 'C':
+        case 's':
+        case 'S':
+        case 'i':
+        case 'I':
+            snprintf(buffer, BRI_KEY_BUFFER_SIZE, "%lld", (long long)bam_aux2i(aux));
+            return buffer;
+        default:
+            return NULL;
+    }
+}
+
+//
+char* generate_key_index_filename(const char* input_bam, const char* input_bri, const char* key_tag)
+{
+    if(input_bri != NULL || key_tag[0] == '\0') {
+        return generate_index_filename(input_bam, input_bri);
+    }
+
+    size_t len = strlen(input_bam) + strlen(key_tag) + 6;
+    char* out_fn = malloc(len);
+    if(out_fn == NULL) {
+        return NULL;
+    }
+    snprintf(out_fn, len, "%s.%s.bri", input_bam, key_tag);
+    return out_fn;
+}
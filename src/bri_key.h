@@ -0,0 +1,49 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+// Indices keyed on the value of an aux tag rather than the read name,
+// such as the duplex parent read (pi), the molecule (MI) or the cell
+// barcode (CB). The values take the place of the read names in the
+// index, so every alignment of a molecule or cell is found with one
+// search. Alignments without the tag aren't indexed. String (Z and H),
+// character (A) and integer tags can be used, integers are indexed by
+// their decimal value.
+//
+// The tag is stored in the index, and by default the index of a file
+// keyed on TAG is written to <file>.TAG.bri so that indices on several
+// tags can be kept alongside the file and its read name index.
+//
+#ifndef BAM_READ_IDX_KEY
+#define BAM_READ_IDX_KEY
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <htslib/sam.h>
+
+// size of a key tag, two characters and a terminator. The key
+// tag of an index keyed on read names is the empty string.
+#define BRI_KEY_TAG_SIZE 3
+
+// size of the buffer bam_read_idx_key may format a value in
+#define BRI_KEY_BUFFER_SIZE 24
+
+// copy the tag named by arg to key_tag, returns 0 on success and
+// -1 if arg isn't a valid tag name (a letter, then a letter or digit)
+int bam_read_idx_key_tag_parse(const char* arg, char* key_tag);
+
+// the key of alignment b, which is its read name if key_tag is empty and
+// otherwise the value of the tag, formatted in buffer if it isn't a string.
+// Returns NULL if b doesn't have the tag or its type can't be a key.
+const char* bam_read_idx_key(const bam1_t* b, const char* key_tag, char* buffer);
+
+// the default filename of the index of input_bam keyed on key_tag, or of its
+// read name index if key_tag is empty, which is input_bri if it is not NULL.
+// Returns NULL if out of memory, otherwise the caller frees it.
+char* generate_key_index_filename(const char* input_bam, const char* input_bri, const char* key_tag);
+
+#endif
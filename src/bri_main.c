@@ -13,8 +13,11 @@
 #include "bri_get.h"
 #include "bri_show.h"
 #include "bri_test.h"
-
-#define BRI_VERSION "0.3"
+#include "bri_bench.h"
+#include "bri_collate.h"
+#include "bri_join.h"
+#include "bri_set.h"
+#include "bri_dump.h"
 
 void print_version()
 {
@@ -34,8 +37,20 @@ int main(int argc, char** argv)
        bam_read_idx_get_main(argc - 1, argv + 1);
     } else if(strcmp(argv[1], "show") == 0) {
        bam_read_idx_show_main(argc - 1, argv + 1);
+    } else if(strcmp(argv[1], "dump") == 0) {
+        bam_read_idx_dump_main(argc - 1, argv + 1);
     } else if(strcmp(argv[1], "test") == 0) {
         bam_read_idx_test_main(argc - 1, argv + 1);
+    } else if(strcmp(argv[1], "bench") == 0) {
+        bam_read_idx_bench_main(argc - 1, argv + 1);
+    } else if(strcmp(argv[1], "collate") == 0) {
+        bam_read_idx_collate_main(argc - 1, argv + 1);
+    } else if(strcmp(argv[1], "join") == 0) {
+        bam_read_idx_join_main(argc - 1, argv + 1);
+    } else if(strcmp(argv[1], "diff") == 0) {
+        bam_read_idx_diff_main(argc - 1, argv + 1);
+    } else if(strcmp(argv[1], "intersect") == 0) {
+        bam_read_idx_intersect_main(argc - 1, argv + 1);
     } else if(strcmp(argv[1], "version") == 0) {
         print_version();
     } else {
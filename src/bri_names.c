@@ -0,0 +1,140 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "bri_index.h"
+#include "bri_names.h"
+
+// names are read from disk in chunks of this many bytes
+#define BRI_NAME_STREAM_CHUNK (1024 * 1024)
+
+//
+int bam_read_idx_name_stream_open(bam_read_idx_name_stream* stream, const char* filename)
+{
+    memset(stream, 0, sizeof(bam_read_idx_name_stream));
+    stream->fp = fopen(filename, "rb");
+    if(stream->fp == NULL) {
+        fprintf(stderr, "[bri] index file %s not found\n", filename);
+        return -1;
+    }
+
+    // the header is the file version, the size of the name block and the record count
+    size_t header[3];
+    if(fread(header, sizeof(size_t), 3, stream->fp) != 3) {
+        fprintf(stderr, "[bri] failed to read index file %s\n", filename);
+        return -1;
+    }
+
+    if(header[0] > BRI_FILE_VERSION) {
+        fprintf(stderr, "[bri] index version %zu is newer than supported (%d)\n", header[0], BRI_FILE_VERSION);
+        return -1;
+    }
+
+    // the names of a sparse index are only a sample of the reads and a
+    // sharded index's manifest has none, look for their sections and the
+    // tag the index is keyed on then return to the start of the names
+    size_t section_header[2];
+    size_t shards[2] = { 0, 0 };
+    int sparse = 0;
+    if(header[0] >= 2 && fseek(stream->fp, header[1] + header[2] * sizeof(bam_read_idx_record), SEEK_CUR) == 0) {
+        while(!sparse && fread(section_header, sizeof(size_t), 2, stream->fp) == 2) {
+            sparse = section_header[0] == BRI_SECTION_SPARSE;
+            if(section_header[0] == BRI_SECTION_SHARDS && section_header[1] == sizeof(shards)) {
+                if(fread(shards, sizeof(size_t), 2, stream->fp) != 2) {
+                    break;
+                }
+            } else if(section_header[0] == BRI_SECTION_KEY_TAG && section_header[1] == 2) {
+                if(fread(stream->key_tag, 1, 2, stream->fp) != 2) {
+                    break;
+                }
+                stream->key_tag[2] = '\0';
+            } else if(fseek(stream->fp, section_header[1], SEEK_CUR) != 0) {
+                break;
+            }
+        }
+    }
+
+    if(sparse) {
+        fprintf(stderr, "[bri] %s is a sparse index, which doesn't have every read name\n", filename);
+        return -1;
+    }
+
+    if(shards[0] > 0 && shards[1] == shards[0]) {
+        fprintf(stderr, "[bri] %s is the manifest of a sharded index, which doesn't have any read names\n", filename);
+        return -1;
+    }
+
+    if(fseek(stream->fp, sizeof(header), SEEK_SET) != 0) {
+        fprintf(stderr, "[bri] failed to read index file %s\n", filename);
+        return -1;
+    }
+
+    stream->remaining = header[1];
+    stream->capacity = BRI_NAME_STREAM_CHUNK;
+    stream->buffer = malloc(stream->capacity);
+    if(stream->buffer == NULL) {
+        fprintf(stderr, "[bri] malloc failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+//
+const char* bam_read_idx_name_stream_next(bam_read_idx_name_stream* stream)
+{
+    while(1) {
+        char* name = stream->buffer + stream->start;
+        char* name_end = memchr(name, '\0', stream->end - stream->start);
+        if(name_end != NULL) {
+            stream->start = name_end - stream->buffer + 1;
+            return name;
+        }
+
+        if(stream->remaining == 0) {
+            return NULL;
+        }
+
+        // move the partial name to the front of the buffer, growing it
+        // if the name doesn't fit, then fill the rest from the file
+        size_t partial = stream->end - stream->start;
+        memmove(stream->buffer, name, partial);
+        stream->start = 0;
+        stream->end = partial;
+
+        if(partial == stream->capacity) {
+            stream->capacity *= 2;
+            stream->buffer = realloc(stream->buffer, stream->capacity);
+            if(stream->buffer == NULL) {
+                fprintf(stderr, "[bri] malloc failed\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        size_t n = stream->capacity - stream->end;
+        n = n < stream->remaining ? n : stream->remaining;
+        if(fread(stream->buffer + stream->end, 1, n, stream->fp) != n) {
+            fprintf(stderr, "[bri] failed to read names from index file\n");
+            exit(EXIT_FAILURE);
+        }
+        stream->end += n;
+        stream->remaining -= n;
+    }
+}
+
+//
+void bam_read_idx_name_stream_close(bam_read_idx_name_stream* stream)
+{
+    if(stream->fp != NULL) {
+        fclose(stream->fp);
+    }
+    free(stream->buffer);
+    memset(stream, 0, sizeof(bam_read_idx_name_stream));
+}
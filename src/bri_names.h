@@ -0,0 +1,47 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+#ifndef BAM_READ_IDX_NAMES
+#define BAM_READ_IDX_NAMES
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "bri_key.h"
+
+// Reads the distinct read names of an index file in sorted order
+// without loading the index. Only the name block at the start of
+// the file is read, through a buffer that only grows to hold the
+// longest name, so memory use doesn't depend on the size of the index.
+typedef struct bam_read_idx_name_stream
+{
+    FILE* fp;
+
+    // the tag the names are values of, see bri_key.h, or empty for read names
+    char key_tag[BRI_KEY_TAG_SIZE];
+
+    // bytes of the name block not yet read into the buffer
+    size_t remaining;
+
+    // names are returned as pointers into buffer[start, end)
+    char* buffer;
+    size_t capacity;
+    size_t start;
+    size_t end;
+} bam_read_idx_name_stream;
+
+// open the index file for streaming, returns 0 on success
+int bam_read_idx_name_stream_open(bam_read_idx_name_stream* stream, const char* filename);
+
+// returns the next name, which is valid until the next call, or NULL
+// once all names have been read. Exits if the file can't be read.
+const char* bam_read_idx_name_stream_next(bam_read_idx_name_stream* stream);
+
+//
+void bam_read_idx_name_stream_close(bam_read_idx_name_stream* stream);
+
+#endif
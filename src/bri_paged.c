@@ -0,0 +1,419 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+
+// for pread
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include "bri_paged.h"
+
+// read bytes from the index file at offset, without moving the stream
+// position so lookups from multiple threads don't interfere
+static int paged_read(const bam_read_idx_paged* paged, void* buf, size_t bytes, size_t offset)
+{
+    size_t done = 0;
+    while(done < bytes) {
+        ssize_t n = pread(fileno(paged->fp), (char*)buf + done, bytes - done, offset + done);
+        if(n <= 0) {
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+// set the pointers to the first names of the pages, which
+// are stored contiguously in page_names_block
+static int paged_set_page_names(bam_read_idx_paged* paged, size_t bytes)
+{
+    paged->page_names = malloc(paged->page_count * sizeof(char*));
+    if(paged->page_names == NULL || (bytes > 0 && paged->page_names_block[bytes - 1] != '\0')) {
+        return -1;
+    }
+
+    size_t offset = 0;
+    for(size_t p = 0; p < paged->page_count; ++p) {
+        if(offset >= bytes) {
+            return -1;
+        }
+        paged->page_names[p] = paged->page_names_block + offset;
+        offset += strlen(paged->page_names[p]) + 1;
+    }
+    return 0;
+}
+
+// read the DIRECTORY section, see bam_read_idx_save_directory
+static int paged_read_directory(bam_read_idx_paged* paged, size_t bytes)
+{
+    size_t header[2];
+    if(bytes < sizeof(header) || fread(header, sizeof(size_t), 2, paged->fp) != 2) {
+        return -1;
+    }
+
+    paged->page_size = header[0];
+    paged->page_count = header[1];
+    if(paged->page_size == 0 ||
+       paged->page_count != (paged->record_count + paged->page_size - 1) / paged->page_size ||
+       paged->page_count > (bytes - sizeof(header)) / sizeof(size_t)) {
+        return -1;
+    }
+
+    size_t names_bytes = bytes - sizeof(header) - paged->page_count * sizeof(size_t);
+    paged->page_name_offsets = malloc(paged->page_count * sizeof(size_t));
+    paged->page_names_block = malloc(names_bytes);
+    if(paged->page_name_offsets == NULL || paged->page_names_block == NULL ||
+       fread(paged->page_name_offsets, sizeof(size_t), paged->page_count, paged->fp) != paged->page_count ||
+       fread(paged->page_names_block, 1, names_bytes, paged->fp) != names_bytes) {
+        return -1;
+    }
+    return paged_set_page_names(paged, names_bytes);
+}
+
+// build the directory of an index written without one by
+// reading the first record of each page and its name
+static int paged_sample_directory(bam_read_idx_paged* paged)
+{
+    paged->page_size = BRI_PAGE_RECORDS;
+    paged->page_count = (paged->record_count + paged->page_size - 1) / paged->page_size;
+    paged->page_name_offsets = malloc(paged->page_count * sizeof(size_t));
+    if(paged->page_name_offsets == NULL) {
+        return -1;
+    }
+
+    size_t names_bytes = 0;
+    size_t names_capacity = 0;
+    for(size_t p = 0; p < paged->page_count; ++p) {
+        bam_read_idx_record record;
+        if(paged_read(paged, &record, sizeof(record), paged->records_start + p * paged->page_size * sizeof(record)) != 0 ||
+           record.read_name.offset >= paged->name_bytes) {
+            return -1;
+        }
+        paged->page_name_offsets[p] = record.read_name.offset;
+
+        // read the name in chunks until its terminator
+        size_t offset = record.read_name.offset;
+        while(1) {
+            if(names_capacity - names_bytes < 256) {
+                names_capacity = names_capacity > 0 ? 2 * names_capacity : 64 * 1024;
+                paged->page_names_block = realloc(paged->page_names_block, names_capacity);
+                if(paged->page_names_block == NULL) {
+                    return -1;
+                }
+            }
+
+            size_t n = paged->name_bytes - offset < 256 ? paged->name_bytes - offset : 256;
+            char* chunk = paged->page_names_block + names_bytes;
+            if(n == 0 || paged_read(paged, chunk, n, paged->names_start + offset) != 0) {
+                return -1;
+            }
+
+            char* end = memchr(chunk, '\0', n);
+            if(end != NULL) {
+                names_bytes += end - chunk + 1;
+                break;
+            }
+            names_bytes += n;
+            offset += n;
+        }
+    }
+    return paged_set_page_names(paged, names_bytes);
+}
+
+// read the sections following the records, keeping the metadata and
+// directory and noting where the record file IDs are stored
+static int paged_read_sections(bam_read_idx_paged* paged, size_t file_version)
+{
+    bam_read_idx* bri = paged->bri;
+    if(fseek(paged->fp, paged->records_start + paged->record_count * sizeof(bam_read_idx_record), SEEK_SET) != 0) {
+        return -1;
+    }
+
+    size_t section_header[2];
+    while(file_version >= 2 && fread(section_header, sizeof(size_t), 2, paged->fp) == 2) {
+        size_t tag = section_header[0];
+        size_t bytes = section_header[1];
+        if(tag == BRI_SECTION_FORMAT && bytes == sizeof(size_t)) {
+            size_t format;
+            if(fread(&format, sizeof(format), 1, paged->fp) != 1) {
+                return -1;
+            }
+            bri->format = format;
+        } else if(tag == BRI_SECTION_FILTER) {
+            if(bam_read_idx_filter_read(&bri->filter, paged->fp, bytes) != 0) {
+                return -1;
+            }
+        } else if(tag == BRI_SECTION_KEY_TAG && bytes == 2) {
+            if(fread(bri->key_tag, 1, 2, paged->fp) != 2) {
+                return -1;
+            }
+            bri->key_tag[2] = '\0';
+        } else if(tag == BRI_SECTION_FILES) {
+            if(bam_read_idx_load_file_names(bri, paged->fp, bytes) != 0) {
+                return -1;
+            }
+        } else if(tag == BRI_SECTION_SHARDS && bytes == 2 * sizeof(size_t)) {
+            size_t shards[2];
+            if(fread(shards, sizeof(size_t), 2, paged->fp) != 2) {
+                return -1;
+            }
+            bri->shard_count = shards[0];
+            bri->shard = shards[1];
+        } else if(tag == BRI_SECTION_SPARSE) {
+            fprintf(stderr, "[bri] paged lookups can't be used with a sparse index\n");
+            return -1;
+        } else if(tag == BRI_SECTION_DIRECTORY) {
+            if(paged_read_directory(paged, bytes) != 0) {
+                return -1;
+            }
+        } else {
+            if(tag == BRI_SECTION_FILE_IDS && bytes == paged->record_count * sizeof(uint16_t)) {
+                paged->file_ids_start = ftell(paged->fp);
+            }
+
+            // the bloom filter is skipped as it is large compared to the directory
+            if(fseek(paged->fp, bytes, SEEK_CUR) != 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+//
+bam_read_idx_paged* bam_read_idx_paged_open(const char* input_bam, const char* input_bri)
+{
+    char* index_fn = generate_index_filename(input_bam, input_bri);
+    if(index_fn == NULL) {
+        return NULL;
+    }
+
+    bam_read_idx_paged* paged = calloc(1, sizeof(bam_read_idx_paged));
+    if(paged == NULL) {
+        free(index_fn);
+        return NULL;
+    }
+
+    paged->fp = fopen(index_fn, "rb");
+    if(paged->fp == NULL) {
+        fprintf(stderr, "[bri] index file %s not found\n", index_fn);
+        free(index_fn);
+        bam_read_idx_paged_close(paged);
+        return NULL;
+    }
+
+    size_t header[3];
+    paged->bri = bam_read_idx_init();
+    int ret = paged->bri != NULL && fread(header, sizeof(size_t), 3, paged->fp) == 3 ? 0 : -1;
+    if(ret == 0 && header[0] > BRI_FILE_VERSION) {
+        fprintf(stderr, "[bri] index version %zu is newer than supported (%d)\n", header[0], BRI_FILE_VERSION);
+        ret = -1;
+    }
+
+    if(ret == 0) {
+        paged->name_bytes = header[1];
+        paged->record_count = header[2];
+        paged->names_start = sizeof(header);
+        paged->records_start = paged->names_start + paged->name_bytes;
+        ret = paged_read_sections(paged, header[0]);
+    }
+
+    if(ret == 0 && paged->page_names == NULL) {
+        ret = paged_sample_directory(paged);
+    }
+
+    if(ret != 0) {
+        fprintf(stderr, "[bri] failed to read index file %s\n", index_fn);
+        bam_read_idx_paged_close(paged);
+        paged = NULL;
+    }
+
+    free(index_fn);
+    return paged;
+}
+
+//
+void bam_read_idx_paged_close(bam_read_idx_paged* paged)
+{
+    if(paged->fp != NULL) {
+        fclose(paged->fp);
+    }
+
+    if(paged->bri != NULL) {
+        bam_read_idx_destroy(paged->bri);
+    }
+    free(paged->page_name_offsets);
+    free(paged->page_names);
+    free(paged->page_names_block);
+    free(paged);
+}
+
+//
+void bam_read_idx_page_buffer_init(bam_read_idx_page_buffer* buffer)
+{
+    memset(buffer, 0, sizeof(bam_read_idx_page_buffer));
+}
+
+//
+void bam_read_idx_page_buffer_destroy(bam_read_idx_page_buffer* buffer)
+{
+    free(buffer->records);
+    free(buffer->file_ids);
+    free(buffer->page_records);
+    free(buffer->page_file_ids);
+    free(buffer->names);
+    memset(buffer, 0, sizeof(bam_read_idx_page_buffer));
+}
+
+// find the offset of readname among the names of page, which are read into
+// the buffer. Returns 1 if it is found, 0 if not and -1 on error.
+static int paged_find_name(const bam_read_idx_paged* paged, bam_read_idx_page_buffer* buffer,
+                           size_t page, const char* readname, size_t* name_offset)
+{
+    size_t start = paged->page_name_offsets[page];
+    size_t end = page + 1 < paged->page_count ? paged->page_name_offsets[page + 1] : paged->name_bytes;
+    if(end < start || end > paged->name_bytes) {
+        return -1;
+    }
+
+    size_t bytes = end - start;
+    if(bytes > buffer->names_capacity) {
+        char* names = realloc(buffer->names, bytes);
+        if(names == NULL) {
+            return -1;
+        }
+        buffer->names = names;
+        buffer->names_capacity = bytes;
+    }
+
+    if(bytes == 0) {
+        return 0;
+    }
+
+    if(paged_read(paged, buffer->names, bytes, paged->names_start + start) != 0 || buffer->names[bytes - 1] != '\0') {
+        return -1;
+    }
+
+    // the names are sorted so the scan stops at the first name past readname
+    for(size_t o = 0; o < bytes; o += strlen(buffer->names + o) + 1) {
+        int cmp = strcmp(buffer->names + o, readname);
+        if(cmp == 0) {
+            *name_offset = start + o;
+            return 1;
+        } else if(cmp > 0) {
+            break;
+        }
+    }
+    return 0;
+}
+
+// read the records (and file IDs) of page into the buffer, returning the number read or -1
+static int paged_read_page(const bam_read_idx_paged* paged, bam_read_idx_page_buffer* buffer, size_t page)
+{
+    if(paged->page_size > buffer->page_capacity) {
+        free(buffer->page_records);
+        free(buffer->page_file_ids);
+        buffer->page_records = malloc(paged->page_size * sizeof(bam_read_idx_record));
+        buffer->page_file_ids = malloc(paged->page_size * sizeof(uint16_t));
+        buffer->page_capacity = buffer->page_records != NULL && buffer->page_file_ids != NULL ? paged->page_size : 0;
+        if(buffer->page_capacity == 0) {
+            return -1;
+        }
+    }
+
+    size_t first = page * paged->page_size;
+    size_t count = paged->record_count - first < paged->page_size ? paged->record_count - first : paged->page_size;
+    if(paged_read(paged, buffer->page_records, count * sizeof(bam_read_idx_record),
+                  paged->records_start + first * sizeof(bam_read_idx_record)) != 0) {
+        return -1;
+    }
+
+    if(paged->file_ids_start != 0 &&
+       paged_read(paged, buffer->page_file_ids, count * sizeof(uint16_t), paged->file_ids_start + first * sizeof(uint16_t)) != 0) {
+        return -1;
+    }
+    return count;
+}
+
+//
+int bam_read_idx_paged_lookup(const bam_read_idx_paged* paged, bam_read_idx_page_buffer* buffer, const char* readname)
+{
+    buffer->n = 0;
+
+    // the number of pages whose first name sorts before readname
+    size_t lo = 0;
+    size_t hi = paged->page_count;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if(strcmp(paged->page_names[mid], readname) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    // find the offset of readname in the names block, and the page its records start in
+    size_t name_offset;
+    size_t page;
+    if(lo < paged->page_count && strcmp(paged->page_names[lo], readname) == 0) {
+        // the read starts a page, but its records may begin at the end of the previous page
+        name_offset = paged->page_name_offsets[lo];
+        page = lo > 0 ? lo - 1 : 0;
+    } else if(lo == 0) {
+        return 0;
+    } else {
+        page = lo - 1;
+        int ret = paged_find_name(paged, buffer, page, readname, &name_offset);
+        if(ret <= 0) {
+            return ret;
+        }
+    }
+
+    // records are sorted by name, so the records of readname are consecutive and
+    // continue onto the next page if they reach the end of this one
+    for(; page < paged->page_count; ++page) {
+        int count = paged_read_page(paged, buffer, page);
+        if(count < 0) {
+            return -1;
+        }
+
+        for(int i = 0; i < count; ++i) {
+            if(buffer->page_records[i].read_name.offset != name_offset) {
+                continue;
+            }
+
+            if(buffer->n == buffer->capacity) {
+                size_t capacity = buffer->capacity > 0 ? 2 * buffer->capacity : 16;
+                bam_read_idx_record* records = realloc(buffer->records, capacity * sizeof(bam_read_idx_record));
+                uint16_t* file_ids = records != NULL ? realloc(buffer->file_ids, capacity * sizeof(uint16_t)) : NULL;
+                if(records != NULL) {
+                    buffer->records = records;
+                }
+                if(file_ids == NULL) {
+                    return -1;
+                }
+                buffer->file_ids = file_ids;
+                buffer->capacity = capacity;
+            }
+
+            buffer->records[buffer->n].read_name.ptr = readname;
+            buffer->records[buffer->n].file_offset = buffer->page_records[i].file_offset;
+            buffer->file_ids[buffer->n] = paged->file_ids_start != 0 ? buffer->page_file_ids[i] : 0;
+            buffer->n += 1;
+        }
+
+        if(buffer->page_records[count - 1].read_name.offset > name_offset) {
+            break;
+        }
+    }
+    return buffer->n;
+}
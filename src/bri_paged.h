@@ -0,0 +1,88 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+// Lookups in an index that is left on disk. The records are divided
+// into pages of consecutive records and only the first name of each
+// page is kept in memory. A lookup searches these names for the page
+// that can hold the read, then reads the names of that page and, if
+// the read is found, its records, so most lookups take one or two small
+// reads. The page directory is written when the index is built; for
+// older indices it is sampled from the file when opened.
+//
+#ifndef BAM_READ_IDX_PAGED
+#define BAM_READ_IDX_PAGED
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "bri_index.h"
+
+typedef struct bam_read_idx_paged
+{
+    FILE* fp;
+
+    // the format, files and filter of the index. No names or records
+    // are loaded, so record_count is 0.
+    bam_read_idx* bri;
+
+    // layout of the file
+    size_t name_bytes;
+    size_t record_count;
+    size_t names_start;
+    size_t records_start;
+
+    // start of the record file IDs, or 0 for an index over one file
+    size_t file_ids_start;
+
+    // the directory: the name offset and name of the first record of each page
+    size_t page_size;
+    size_t page_count;
+    size_t* page_name_offsets;
+    char** page_names;
+    char* page_names_block;
+} bam_read_idx_paged;
+
+// The records found by a lookup and the buffers used to find them.
+// Lookups only read the paged index so each thread can use its own
+// buffer with a shared bam_read_idx_paged.
+typedef struct bam_read_idx_page_buffer
+{
+    // records for the last name looked up, with their file IDs,
+    // which are valid until the next lookup. The name pointer of
+    // each record is the name that was looked up.
+    size_t n;
+    size_t capacity;
+    bam_read_idx_record* records;
+    uint16_t* file_ids;
+
+    // contents of the page being searched
+    size_t page_capacity;
+    bam_read_idx_record* page_records;
+    uint16_t* page_file_ids;
+    char* names;
+    size_t names_capacity;
+} bam_read_idx_page_buffer;
+
+// open the index for input_bam (or input_bri, if not NULL) for paged lookups,
+// returns NULL if the index can't be opened
+bam_read_idx_paged* bam_read_idx_paged_open(const char* input_bam, const char* input_bri);
+
+// find the records for readname, storing them in buffer.
+// Returns the number of records or -1 if the index can't be read.
+int bam_read_idx_paged_lookup(const bam_read_idx_paged* paged, bam_read_idx_page_buffer* buffer, const char* readname);
+
+// close the file and deallocate the paged index
+void bam_read_idx_paged_close(bam_read_idx_paged* paged);
+
+//
+void bam_read_idx_page_buffer_init(bam_read_idx_page_buffer* buffer);
+
+//
+void bam_read_idx_page_buffer_destroy(bam_read_idx_page_buffer* buffer);
+
+#endif
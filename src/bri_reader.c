@@ -0,0 +1,441 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+
+// for strdup
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <pthread.h>
+#include "bri_reader.h"
+#include "bri_get.h"
+#include "bri_paged.h"
+#include "bri_sparse.h"
+#include "bri_shard.h"
+
+// number of bytes of decompressed blocks each bam handle keeps cached, so
+// alignments of a read that share a block don't inflate it repeatedly
+#define BRI_ITR_CACHE_SIZE (4 * 1024 * 1024)
+
+struct bri_reader_t
+{
+    bam_read_idx* bri;
+
+    // set instead of bri for a reader opened with bri_reader_open_paged
+    bam_read_idx_paged* paged;
+
+    // when bri or paged is the manifest of a sharded index, the shards
+    // loaded (or opened for paged lookups) by the first query that needs
+    // them, guarded by shard_lock
+    char* index_fn;
+    bam_read_idx** shards;
+    bam_read_idx_paged** paged_shards;
+    pthread_mutex_t* shard_lock;
+
+    char* input_bam;
+    char* reference;
+};
+
+// an alignment to be read for the current query
+typedef struct bri_itr_entry
+{
+    size_t file_id;
+    const bam_read_idx_record* record;
+} bri_itr_entry;
+
+struct bri_itr_t
+{
+    const bri_reader_t* reader;
+    bam_read_idx_handles* handles;
+
+    // the alignments for the current query, sorted into file order,
+    // reused between queries
+    size_t n_entries;
+    size_t m_entries;
+    bri_itr_entry* entries;
+    size_t next;
+
+    // the offset that would be read next from each file's stream
+    // without seeking, or BRI_NO_POSITION
+    size_t* positions;
+
+    // file of the last alignment returned
+    size_t file_id;
+
+    // records found by the last query of a paged reader
+    bam_read_idx_page_buffer pages;
+
+    // records found by the last query of a sparse index
+    size_t m_sparse;
+    bam_read_idx_record* sparse;
+};
+
+// open a reader using either the loaded or the paged index
+static bri_reader_t* bri_reader_open_index(const char* input_bam, const char* input_bri, const char* reference, int paged)
+{
+    if(input_bam == NULL && input_bri == NULL) {
+        return NULL;
+    }
+
+    bri_reader_t* reader = calloc(1, sizeof(bri_reader_t));
+    if(reader == NULL) {
+        return NULL;
+    }
+
+    if(paged) {
+        reader->paged = bam_read_idx_paged_open(input_bam, input_bri);
+    } else {
+        reader->bri = bam_read_idx_try_load_sharded(input_bam, input_bri);
+    }
+
+    if(reader->bri == NULL && reader->paged == NULL) {
+        bri_reader_close(reader);
+        return NULL;
+    }
+
+    const bam_read_idx* index = bri_reader_index(reader);
+    if(bam_read_idx_is_manifest(index)) {
+        reader->index_fn = generate_index_filename(input_bam, input_bri);
+        reader->shards = calloc(index->shard_count, sizeof(bam_read_idx*));
+        reader->paged_shards = calloc(index->shard_count, sizeof(bam_read_idx_paged*));
+        reader->shard_lock = malloc(sizeof(pthread_mutex_t));
+        if(reader->index_fn == NULL || reader->shards == NULL || reader->paged_shards == NULL ||
+           reader->shard_lock == NULL || pthread_mutex_init(reader->shard_lock, NULL) != 0) {
+            free(reader->shard_lock);
+            reader->shard_lock = NULL;
+            bri_reader_close(reader);
+            return NULL;
+        }
+    }
+
+    // an index over a single file doesn't record its path
+    if(bri_reader_index(reader)->file_count == 0 && input_bam == NULL) {
+        fprintf(stderr, "[bri] the input file must be given for a single file index\n");
+        bri_reader_close(reader);
+        return NULL;
+    }
+
+    reader->input_bam = input_bam != NULL ? strdup(input_bam) : NULL;
+    reader->reference = reference != NULL ? strdup(reference) : NULL;
+    if((input_bam != NULL && reader->input_bam == NULL) || (reference != NULL && reader->reference == NULL)) {
+        bri_reader_close(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+//
+bri_reader_t* bri_reader_open(const char* input_bam, const char* input_bri, const char* reference)
+{
+    return bri_reader_open_index(input_bam, input_bri, reference, 0);
+}
+
+//
+bri_reader_t* bri_reader_open_paged(const char* input_bam, const char* input_bri, const char* reference)
+{
+    return bri_reader_open_index(input_bam, input_bri, reference, 1);
+}
+
+//
+const bam_read_idx* bri_reader_index(const bri_reader_t* reader)
+{
+    return reader->paged != NULL ? reader->paged->bri : reader->bri;
+}
+
+//
+void bri_reader_close(bri_reader_t* reader)
+{
+    if(reader->shard_lock != NULL) {
+        for(size_t i = 0; i < bri_reader_index(reader)->shard_count; ++i) {
+            if(reader->shards[i] != NULL) {
+                bam_read_idx_destroy(reader->shards[i]);
+            }
+
+            if(reader->paged_shards[i] != NULL) {
+                bam_read_idx_paged_close(reader->paged_shards[i]);
+            }
+        }
+        pthread_mutex_destroy(reader->shard_lock);
+        free(reader->shard_lock);
+    }
+    free(reader->index_fn);
+    free(reader->shards);
+    free(reader->paged_shards);
+
+    if(reader->bri != NULL) {
+        bam_read_idx_destroy(reader->bri);
+    }
+
+    if(reader->paged != NULL) {
+        bam_read_idx_paged_close(reader->paged);
+    }
+    free(reader->input_bam);
+    free(reader->reference);
+    free(reader);
+}
+
+//
+bri_itr_t* bri_itr_init(const bri_reader_t* reader)
+{
+    bri_itr_t* itr = calloc(1, sizeof(bri_itr_t));
+    if(itr == NULL) {
+        return NULL;
+    }
+
+    itr->reader = reader;
+    bam_read_idx_page_buffer_init(&itr->pages);
+    itr->handles = bam_read_idx_handles_init(bri_reader_index(reader), reader->input_bam, reader->reference);
+    if(itr->handles == NULL) {
+        bri_itr_destroy(itr);
+        return NULL;
+    }
+
+    itr->positions = malloc(itr->handles->count * sizeof(size_t));
+    if(itr->positions == NULL) {
+        bri_itr_destroy(itr);
+        return NULL;
+    }
+
+    for(size_t i = 0; i < itr->handles->count; ++i) {
+        itr->positions[i] = BRI_NO_POSITION;
+    }
+    return itr;
+}
+
+// order alignments by file then by offset within the file
+static int compare_itr_entries(const void* a, const void* b)
+{
+    const bri_itr_entry* e1 = a;
+    const bri_itr_entry* e2 = b;
+    if(e1->file_id != e2->file_id) {
+        return e1->file_id < e2->file_id ? -1 : 1;
+    }
+
+    size_t o1 = e1->record->file_offset;
+    size_t o2 = e2->record->file_offset;
+    return o1 < o2 ? -1 : (o1 > o2);
+}
+
+// find the records of readname in a sparse index by scanning its file,
+// returns the number found or a negative error code
+static int bri_itr_query_sparse(bri_itr_t* itr, const char* readname)
+{
+    int new_handle = itr->handles->fps[0] == NULL;
+
+    bam_hdr_t* h;
+    htsFile* fp = bam_read_idx_handles_get(itr->handles, 0, &h);
+    if(fp == NULL) {
+        return BRI_ERR_OPEN;
+    }
+
+    // the alignments are read again by bri_itr_next, from the cache
+    if(new_handle) {
+        hts_set_cache_size(fp, BRI_ITR_CACHE_SIZE);
+    }
+
+    int n = bam_read_idx_sparse_find(fp, h, itr->reader->bri, readname, &itr->sparse, &itr->m_sparse);
+    return n >= 0 ? n : BRI_ERR_READ;
+}
+
+// open shard of the manifest the reader was opened with, returns 0 on success
+static int bri_reader_open_shard(const bri_reader_t* reader, size_t shard)
+{
+    char* shard_fn = bam_read_idx_shard_filename(reader->index_fn, shard);
+    if(shard_fn == NULL) {
+        return -1;
+    }
+
+    const bam_read_idx* shard_bri = NULL;
+    if(reader->paged != NULL) {
+        reader->paged_shards[shard] = bam_read_idx_paged_open(NULL, shard_fn);
+        shard_bri = reader->paged_shards[shard] != NULL ? reader->paged_shards[shard]->bri : NULL;
+    } else {
+        reader->shards[shard] = bam_read_idx_try_load(NULL, shard_fn);
+        shard_bri = reader->shards[shard];
+    }
+
+    // a shard left from building the index with a different number of shards
+    // would silently miss reads, so check it belongs to this manifest
+    size_t shard_count = bri_reader_index(reader)->shard_count;
+    int ret = shard_bri != NULL ? 0 : -1;
+    if(shard_bri != NULL && (shard_bri->shard_count != shard_count || shard_bri->shard != shard)) {
+        fprintf(stderr, "[bri] %s is not shard %zu of the %zu shards of %s\n", shard_fn, shard, shard_count, reader->index_fn);
+        if(reader->paged_shards[shard] != NULL) {
+            bam_read_idx_paged_close(reader->paged_shards[shard]);
+            reader->paged_shards[shard] = NULL;
+        }
+
+        if(reader->shards[shard] != NULL) {
+            bam_read_idx_destroy(reader->shards[shard]);
+            reader->shards[shard] = NULL;
+        }
+        ret = -1;
+    }
+
+    free(shard_fn);
+    return ret;
+}
+
+// find the index to search for readname, which for a sharded index is the
+// shard holding readname, opening it if this is the first query that needs
+// it. Exactly one of bri and paged is set. Returns 0 on success.
+static int bri_reader_route(const bri_reader_t* reader, const char* readname, const bam_read_idx** bri, bam_read_idx_paged** paged)
+{
+    *bri = reader->bri;
+    *paged = reader->paged;
+    if(reader->shard_lock == NULL) {
+        return 0;
+    }
+
+    size_t shard = bam_read_idx_shard_of(readname, bri_reader_index(reader)->shard_count);
+    pthread_mutex_lock(reader->shard_lock);
+    int ret = 0;
+    if(reader->shards[shard] == NULL && reader->paged_shards[shard] == NULL) {
+        ret = bri_reader_open_shard(reader, shard);
+    }
+    *bri = reader->shards[shard];
+    *paged = reader->paged_shards[shard];
+    pthread_mutex_unlock(reader->shard_lock);
+    return ret;
+}
+
+//
+int bri_itr_query(bri_itr_t* itr, const char* readname)
+{
+    const bam_read_idx* bri;
+    bam_read_idx_paged* paged;
+    if(bri_reader_route(itr->reader, readname, &bri, &paged) != 0) {
+        return BRI_ERR_OPEN;
+    }
+
+    bam_read_idx_record* start = NULL;
+    bam_read_idx_record* end = NULL;
+    if(paged != NULL) {
+        if(bam_read_idx_paged_lookup(paged, &itr->pages, readname) < 0) {
+            return BRI_ERR_READ;
+        }
+        start = itr->pages.records;
+        end = start + itr->pages.n;
+    } else if(bri->sparse_interval > 0) {
+        // the alignments are found by scanning the file, after which its stream position is unknown
+        int ret = bri_itr_query_sparse(itr, readname);
+        if(ret < 0) {
+            return ret;
+        }
+        start = itr->sparse;
+        end = start + ret;
+        itr->positions[0] = BRI_NO_POSITION;
+    } else {
+        bam_read_idx_get_range(bri, readname, &start, &end);
+    }
+
+    size_t n = end - start;
+    if(n > itr->m_entries) {
+        bri_itr_entry* entries = realloc(itr->entries, n * sizeof(bri_itr_entry));
+        if(entries == NULL) {
+            return BRI_ERR_NOMEM;
+        }
+        itr->entries = entries;
+        itr->m_entries = n;
+    }
+
+    for(size_t i = 0; i < n; ++i) {
+        if(paged != NULL) {
+            itr->entries[i].file_id = itr->pages.file_ids[i];
+        } else {
+            itr->entries[i].file_id = bri->sparse_interval > 0 ? 0 : bam_read_idx_record_file_id(bri, start + i);
+        }
+        itr->entries[i].record = start + i;
+    }
+
+    // reading in file order turns the seeks into a forward scan and lets
+    // adjacent alignments be read without seeking at all
+    qsort(itr->entries, n, sizeof(bri_itr_entry), compare_itr_entries);
+    itr->n_entries = n;
+    itr->next = 0;
+    return n;
+}
+
+//
+int bri_itr_next(bri_itr_t* itr, bam1_t* b)
+{
+    if(itr->next >= itr->n_entries) {
+        return BRI_ITR_END;
+    }
+
+    const bri_itr_entry* entry = &itr->entries[itr->next];
+    int new_handle = itr->handles->fps[entry->file_id] == NULL;
+
+    bam_hdr_t* h;
+    htsFile* fp = bam_read_idx_handles_get(itr->handles, entry->file_id, &h);
+    if(fp == NULL) {
+        return BRI_ERR_OPEN;
+    }
+
+    if(new_handle && fp->format.format != cram) {
+        hts_set_cache_size(fp, BRI_ITR_CACHE_SIZE);
+    }
+
+    if(bam_read_idx_handles_read(itr->handles, entry->file_id, b, entry->record, &itr->positions[entry->file_id]) != 0) {
+        return BRI_ERR_READ;
+    }
+
+    itr->file_id = entry->file_id;
+    itr->next += 1;
+    return 0;
+}
+
+//
+void bri_itr_set_threads(bri_itr_t* itr, int threads)
+{
+    bam_read_idx_handles_set_threads(itr->handles, threads);
+}
+
+//
+int bri_itr_next_offset(bri_itr_t* itr, size_t* file_id, size_t* file_offset)
+{
+    if(itr->next >= itr->n_entries) {
+        return BRI_ITR_END;
+    }
+
+    const bri_itr_entry* entry = &itr->entries[itr->next];
+    *file_id = entry->file_id;
+    *file_offset = entry->record->file_offset;
+    itr->file_id = entry->file_id;
+    itr->next += 1;
+    return 0;
+}
+
+//
+bam_hdr_t* bri_itr_header(const bri_itr_t* itr)
+{
+    return itr->handles->hdrs[itr->file_id];
+}
+
+//
+size_t bri_itr_file_id(const bri_itr_t* itr)
+{
+    return itr->file_id;
+}
+
+//
+void bri_itr_destroy(bri_itr_t* itr)
+{
+    if(itr->handles != NULL) {
+        bam_read_idx_handles_destroy(itr->handles);
+    }
+    free(itr->entries);
+    free(itr->positions);
+    bam_read_idx_page_buffer_destroy(&itr->pages);
+    free(itr->sparse);
+    free(itr);
+}
@@ -0,0 +1,100 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+// Library interface for retrieving alignments by read name.
+// A bri_reader_t holds the loaded index and is read-only once
+// opened, so it can be shared between any number of threads.
+// Each thread creates its own bri_itr_t from the reader, which
+// owns that thread's file handles and buffers:
+//
+//   bri_reader_t* reader = bri_reader_open("reads.bam", NULL, NULL);
+//   ... in each thread:
+//   bri_itr_t* itr = bri_itr_init(reader);
+//   bam1_t* b = bam_init1();
+//   if(bri_itr_query(itr, readname) >= 0) {
+//       while((ret = bri_itr_next(itr, b)) >= 0) { ... }
+//   }
+//   bri_itr_destroy(itr);
+//   ... once all threads are done:
+//   bri_reader_close(reader);
+//
+#ifndef BAM_READ_IDX_READER
+#define BAM_READ_IDX_READER
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <htslib/sam.h>
+#include <htslib/hts.h>
+#include "bri_index.h"
+
+// return codes, errors are all negative and
+// less than BRI_ITR_END, as in htslib
+#define BRI_ITR_END -1
+#define BRI_ERR_OPEN -2
+#define BRI_ERR_READ -3
+#define BRI_ERR_NOMEM -4
+
+typedef struct bri_reader_t bri_reader_t;
+typedef struct bri_itr_t bri_itr_t;
+
+// load the index for input_bam (or from input_bri, if not NULL) for
+// shared use. input_bam can be NULL if the index covers multiple files.
+// reference is an optional fasta for decoding cram.
+// If the index is the manifest of a sharded index (see bri_shard.h)
+// only the manifest is loaded, and each query loads the one shard
+// holding its read the first time it is needed.
+// Returns NULL if the index can't be loaded.
+bri_reader_t* bri_reader_open(const char* input_bam, const char* input_bri, const char* reference);
+
+// as bri_reader_open, but the index is left on disk and only a small
+// directory of it is loaded, see bri_paged.h. Each query then reads
+// the part of the index it needs.
+bri_reader_t* bri_reader_open_paged(const char* input_bam, const char* input_bri, const char* reference);
+
+// the loaded index, which must not be modified. For a paged
+// reader only the format, files and filter of the index are loaded.
+const bam_read_idx* bri_reader_index(const bri_reader_t* reader);
+
+// deallocate the reader, all iterators created from it must be destroyed first
+void bri_reader_close(bri_reader_t* reader);
+
+// create an iterator with its own file handles. An iterator must only be
+// used by one thread at a time. Returns NULL if out of memory.
+bri_itr_t* bri_itr_init(const bri_reader_t* reader);
+
+// start iterating over the alignments of readname, replacing any previous query.
+// Returns the number of alignments, which may be 0, or a negative error code,
+// which is BRI_ERR_OPEN if the shard of a sharded index can't be loaded.
+int bri_itr_query(bri_itr_t* itr, const char* readname);
+
+// read the next alignment of the current query into b. Alignments in the same file
+// are returned in file order. Returns >= 0 on success, BRI_ITR_END when there are
+// no more alignments and < BRI_ITR_END on error.
+int bri_itr_next(bri_itr_t* itr, bam1_t* b);
+
+// Inflate the bgzf blocks of alignments that span many of them with threads,
+// which reduces the latency of reading very long alignments. Each file of a
+// bam is then also opened with a pool of threads the first time one of its
+// long alignments is read. Has no effect for cram.
+void bri_itr_set_threads(bri_itr_t* itr, int threads);
+
+// as bri_itr_next, but gives the file and offset of the next alignment
+// instead of reading it, for indexed files that aren't read as alignments
+// (fastq). Returns 0 on success or BRI_ITR_END.
+int bri_itr_next_offset(bri_itr_t* itr, size_t* file_id, size_t* file_offset);
+
+// the header of the file the last alignment returned by bri_itr_next came from
+bam_hdr_t* bri_itr_header(const bri_itr_t* itr);
+
+// the ID of the file the last alignment returned by bri_itr_next came from
+size_t bri_itr_file_id(const bri_itr_t* itr);
+
+// close the iterator's files and deallocate it
+void bri_itr_destroy(bri_itr_t* itr);
+
+#endif
@@ -0,0 +1,179 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+// Compare the read names of two indices. The sorted name blocks
+// of the two index files are streamed and merged, so neither the
+// indices nor the files they index are loaded.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <getopt.h>
+#include "bri_names.h"
+#include "bri_set.h"
+#include "bri_stats.h"
+
+enum {
+    BRI_SET_DIFF = 0,
+    BRI_SET_INTERSECT
+};
+
+// the index file for an input, which is either the index itself or the file it indexes
+static char* set_index_filename(const char* input)
+{
+    size_t len = strlen(input);
+    char* out_fn = malloc(len + 5);
+    if(out_fn == NULL) {
+        fprintf(stderr, "[bri] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    strcpy(out_fn, input);
+    if(len < 4 || strcmp(input + len - 4, ".bri") != 0) {
+        strcat(out_fn, ".bri");
+    }
+    return out_fn;
+}
+
+//
+// Getopt
+//
+enum {
+    OPT_HELP = 1,
+    OPT_STATS,
+};
+
+static const char* shortopts = ":c"; // placeholder
+static const struct option longopts[] = {
+    { "help",                      no_argument,       NULL, OPT_HELP },
+    { "count",                     no_argument,       NULL,      'c' },
+    { "stats",               required_argument,       NULL, OPT_STATS },
+    { NULL, 0, NULL, 0 }
+};
+
+void print_usage_set(const char* command)
+{
+    fprintf(stderr, "usage: bri %s [-c] [--stats <stats.json>] <a.bam|a.bam.bri> <b.bam|b.bam.bri>\n", command);
+    if(strcmp(command, "diff") == 0) {
+        fprintf(stderr, "  write the names of reads in the index of a.bam that are not in the index of b.bam\n");
+    } else {
+        fprintf(stderr, "  write the names of reads in both the index of a.bam and the index of b.bam\n");
+    }
+    fprintf(stderr, "  -c, --count    only write the number of reads\n");
+    fprintf(stderr, "  --stats FILE   write timing statistics to FILE as JSON\n");
+}
+
+//
+static int bam_read_idx_set_main(int argc, char** argv, int op)
+{
+    const char* command = op == BRI_SET_DIFF ? "diff" : "intersect";
+    int count_only = 0;
+    char* stats_file = NULL;
+
+    int die = 0;
+    for (char c; (c = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1;) {
+        switch (c) {
+            case OPT_HELP:
+                print_usage_set(command);
+                exit(EXIT_SUCCESS);
+            case 'c':
+                count_only = 1;
+                break;
+            case OPT_STATS:
+                stats_file = optarg;
+                break;
+            default:
+                die = 1;
+        }
+    }
+
+    if (argc - optind != 2) {
+        fprintf(stderr, "bri %s: two indexed files are required\n", command);
+        die = 1;
+    }
+
+    if(die) {
+        print_usage_set(command);
+        exit(EXIT_FAILURE);
+    }
+
+    bri_stats_enable(stats_file != NULL);
+    char* index_a = set_index_filename(argv[optind]);
+    char* index_b = set_index_filename(argv[optind + 1]);
+
+    bam_read_idx_name_stream a, b;
+    if(bam_read_idx_name_stream_open(&a, index_a) != 0 ||
+       bam_read_idx_name_stream_open(&b, index_b) != 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    // the names of both indices must be the same kind of key
+    if(strcmp(a.key_tag, b.key_tag) != 0) {
+        fprintf(stderr, "[bri] %s is keyed on %s but %s is keyed on %s\n",
+            index_a, a.key_tag[0] != '\0' ? a.key_tag : "read names",
+            index_b, b.key_tag[0] != '\0' ? b.key_tag : "read names");
+        exit(EXIT_FAILURE);
+    }
+
+    // merge the two sorted lists of distinct names
+    size_t count = 0;
+    const char* name_a = bam_read_idx_name_stream_next(&a);
+    const char* name_b = bam_read_idx_name_stream_next(&b);
+    while(name_a != NULL) {
+        int cmp = name_b != NULL ? strcmp(name_a, name_b) : -1;
+        if(cmp > 0) {
+            name_b = bam_read_idx_name_stream_next(&b);
+            continue;
+        }
+
+        if((cmp == 0) == (op == BRI_SET_INTERSECT)) {
+            count += 1;
+            if(!count_only) {
+                fputs(name_a, stdout);
+                fputc('\n', stdout);
+            }
+        }
+
+        // stop once there is nothing left to intersect with
+        if(name_b == NULL && op == BRI_SET_INTERSECT) {
+            break;
+        }
+
+        name_a = bam_read_idx_name_stream_next(&a);
+        if(cmp == 0) {
+            name_b = bam_read_idx_name_stream_next(&b);
+        }
+    }
+
+    if(count_only) {
+        printf("%zu\n", count);
+    }
+
+    bam_read_idx_name_stream_close(&a);
+    bam_read_idx_name_stream_close(&b);
+    free(index_a);
+    free(index_b);
+
+    if(stats_file != NULL && bri_stats_write_json(stats_file, command) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
+
+//
+int bam_read_idx_diff_main(int argc, char** argv)
+{
+    return bam_read_idx_set_main(argc, argv, BRI_SET_DIFF);
+}
+
+//
+int bam_read_idx_intersect_main(int argc, char** argv)
+{
+    return bam_read_idx_set_main(argc, argv, BRI_SET_INTERSECT);
+}
@@ -0,0 +1,23 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+#ifndef BAM_READ_IDX_SET
+#define BAM_READ_IDX_SET
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+// main of the "diff" subprogram
+int bam_read_idx_diff_main(int argc, char** argv);
+
+// main of the "intersect" subprogram
+int bam_read_idx_intersect_main(int argc, char** argv);
+
+#endif
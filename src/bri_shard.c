@@ -0,0 +1,177 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+
+// for strdup
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include "bri_shard.h"
+
+extern char verbose;
+
+// The shard is chosen from the low 32 bits of the hash as the bloom
+// filter chooses its block from the high 32 bits. Using the same bits
+// would leave most blocks of each shard's filter empty.
+size_t bam_read_idx_shard_of(const char* readname, size_t shard_count)
+{
+    uint64_t h = bam_read_idx_hash_name(readname);
+    return (size_t)(((h & 0xffffffffull) * (uint64_t)shard_count) >> 32);
+}
+
+//
+int bam_read_idx_is_manifest(const bam_read_idx* bri)
+{
+    return bri->shard_count > 0 && bri->shard == bri->shard_count;
+}
+
+//
+char* bam_read_idx_shard_filename(const char* index_fn, size_t shard)
+{
+    size_t len = strlen(index_fn) + 32;
+    char* filename = malloc(len);
+    if(filename == NULL) {
+        return NULL;
+    }
+    snprintf(filename, len, "%s.%zu", index_fn, shard);
+    return filename;
+}
+
+// an empty index with the same format, files and options as bri
+static bam_read_idx* bam_read_idx_shard_init(const bam_read_idx* bri, size_t shard_count, size_t shard)
+{
+    bam_read_idx* shard_bri = bam_read_idx_init();
+    if(shard_bri == NULL) {
+        fprintf(stderr, "[bri] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    shard_bri->format = bri->format;
+    memcpy(shard_bri->key_tag, bri->key_tag, BRI_KEY_TAG_SIZE);
+    shard_bri->bloom_fpr = bri->bloom_fpr;
+    shard_bri->name_arena.huge_pages = bri->name_arena.huge_pages;
+    shard_bri->record_arena.huge_pages = bri->record_arena.huge_pages;
+    shard_bri->shard_count = shard_count;
+    shard_bri->shard = shard;
+
+    shard_bri->filter = bri->filter;
+    shard_bri->filter.region = NULL;
+    if(bri->filter.region != NULL) {
+        shard_bri->filter.region = strdup(bri->filter.region);
+        if(shard_bri->filter.region == NULL) {
+            fprintf(stderr, "[bri] malloc failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if(bri->file_count > 0) {
+        shard_bri->file_count = bri->file_count;
+        shard_bri->file_names = malloc(bri->file_count * sizeof(char*));
+        shard_bri->file_name_starts = malloc(bri->file_count * sizeof(size_t));
+        if(shard_bri->file_names == NULL || shard_bri->file_name_starts == NULL) {
+            fprintf(stderr, "[bri] malloc failed\n");
+            exit(EXIT_FAILURE);
+        }
+
+        for(size_t fi = 0; fi < bri->file_count; ++fi) {
+            shard_bri->file_names[fi] = strdup(bri->file_names[fi]);
+            if(shard_bri->file_names[fi] == NULL) {
+                fprintf(stderr, "[bri] malloc failed\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    return shard_bri;
+}
+
+// The records are moved to the shards in the order they were added, which
+// is file order, so each shard's names from each file are contiguous as
+// bam_read_idx_save expects. The arena chunks are in the same order and
+// are freed once passed, so the names and records are only held once.
+void bam_read_idx_save_shards(bam_read_idx* bri, size_t shard_count, const char* filename)
+{
+    assert(bri->records == NULL && bri->sparse_interval == 0);
+
+    bam_read_idx** shards = malloc(shard_count * sizeof(bam_read_idx*));
+    if(shards == NULL) {
+        fprintf(stderr, "[bri] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(size_t si = 0; si < shard_count; ++si) {
+        shards[si] = bam_read_idx_shard_init(bri, shard_count, si);
+    }
+
+    size_t next_file = 0;
+    size_t names_freed = 0;
+    size_t records_freed = 0;
+    for(size_t i = 0; i < bri->record_count; ++i) {
+        size_t record_offset = i * sizeof(bam_read_idx_record);
+        const bam_read_idx_record* record = bam_read_idx_build_record(bri, i);
+        size_t name_offset = record->read_name.offset;
+
+        // start the names of any files that begin at this record
+        while(next_file < bri->file_count && bri->file_name_starts[next_file] <= name_offset) {
+            for(size_t si = 0; si < shard_count; ++si) {
+                shards[si]->file_name_starts[next_file] = shards[si]->name_arena.next;
+            }
+            next_file += 1;
+        }
+
+        const char* name = bam_read_idx_build_name(bri, name_offset);
+        bam_read_idx_add(shards[bam_read_idx_shard_of(name, shard_count)], name, record->file_offset);
+
+        // free the chunks before the ones holding this name and record
+        while(names_freed < (name_offset >> bri->name_arena.chunk_bits)) {
+            bri_arena_free_chunk(&bri->name_arena, names_freed++);
+        }
+
+        while(records_freed < (record_offset >> bri->record_arena.chunk_bits)) {
+            bri_arena_free_chunk(&bri->record_arena, records_freed++);
+        }
+    }
+
+    // files after the last record have no names
+    for(; next_file < bri->file_count; ++next_file) {
+        for(size_t si = 0; si < shard_count; ++si) {
+            shards[si]->file_name_starts[next_file] = shards[si]->name_arena.next;
+        }
+    }
+
+    // save each shard and free it before the next, the shards are
+    // saved in turn so only one holds its records twice at a time
+    for(size_t si = 0; si < shard_count; ++si) {
+        char* shard_fn = bam_read_idx_shard_filename(filename, si);
+        if(shard_fn == NULL) {
+            fprintf(stderr, "[bri] malloc failed\n");
+            exit(EXIT_FAILURE);
+        }
+
+        bam_read_idx_save(shards[si], shard_fn);
+        if(verbose) {
+            fprintf(stderr, "[bri-build] wrote shard %zu with %zu records to %s\n", si, shards[si]->record_count, shard_fn);
+        }
+        free(shard_fn);
+        bam_read_idx_destroy(shards[si]);
+    }
+    free(shards);
+
+    // the manifest keeps the metadata of the index but none of the reads
+    bri_arena_destroy(&bri->name_arena);
+    bri_arena_destroy(&bri->record_arena);
+    bri->name_count_bytes = 0;
+    bri->record_count = 0;
+    bri->bloom_fpr = 0.0;
+    bri->shard_count = shard_count;
+    bri->shard = shard_count;
+    bam_read_idx_save(bri, filename);
+}
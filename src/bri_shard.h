@@ -0,0 +1,40 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+// Sharded indices. The reads are partitioned by a hash of their name
+// into N shards, each written as a complete index to <index>.<shard>
+// (e.g. reads.bam.bri.0 ... reads.bam.bri.N-1). The index file itself
+// becomes a manifest with no records that holds the shard count along
+// with the format, files and filter of the index. Every alignment of
+// a read is in the same shard, so a lookup only needs the one shard
+// given by bam_read_idx_shard_of, and a process that only serves the
+// reads of one shard can load that shard's file as an ordinary index.
+//
+#ifndef BAM_READ_IDX_SHARD
+#define BAM_READ_IDX_SHARD
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "bri_index.h"
+
+// the shard of a sharded index that holds the records of readname
+size_t bam_read_idx_shard_of(const char* readname, size_t shard_count);
+
+// returns true if bri is the manifest of a sharded index
+int bam_read_idx_is_manifest(const bam_read_idx* bri);
+
+// the filename of a shard of the index written to index_fn.
+// Returns NULL if out of memory, otherwise the caller frees it.
+char* bam_read_idx_shard_filename(const char* index_fn, size_t shard);
+
+// split an index being built into shard_count shards and save them and
+// the manifest to filename. The names and records are moved into the
+// shards so bri is left without records. Exits on error.
+void bam_read_idx_save_shards(bam_read_idx* bri, size_t shard_count, const char* filename);
+
+#endif
@@ -12,34 +12,42 @@
 #include <assert.h>
 #include <getopt.h>
 #include "bri_index.h"
+#include "bri_stats.h"
 
 //
 // Getopt
 //
 enum {
     OPT_HELP = 1,
+    OPT_STATS,
 };
 
 static const char* shortopts = ""; // placeholder
 static const struct option longopts[] = {
     { "help",                      no_argument,       NULL, OPT_HELP },
+    { "stats",               required_argument,       NULL, OPT_STATS },
     { NULL, 0, NULL, 0 }
 };
 
 //
 void print_usage_show()
 {
-    fprintf(stderr, "usage: bri show <index_filename.bri>\n");
+    fprintf(stderr, "usage: bri show [--stats <stats.json>] <index_filename.bri>\n");
 }
 
 int bam_read_idx_show_main(int argc, char** argv)
 {
+    char* stats_file = NULL;
+
     int die = 0;
     for (char c; (c = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1;) {
         switch (c) {
             case OPT_HELP:
                 print_usage_show();
                 exit(EXIT_SUCCESS);
+            case OPT_STATS:
+                stats_file = optarg;
+                break;
         }
     }
     
@@ -53,12 +61,19 @@ int bam_read_idx_show_main(int argc, char** argv)
         exit(EXIT_FAILURE);
     }
 
+    bri_stats_enable(stats_file != NULL);
     char* input_bri = argv[optind++];
     bam_read_idx* bri = bam_read_idx_load(NULL, input_bri);
 
+    bri_stats_start(BRI_PHASE_OUTPUT);
     for(size_t i = 0; i < bri->record_count; ++i) {
         printf("%s\n", bri->records[i].read_name.ptr);
     }
+    bri_stats_stop(BRI_PHASE_OUTPUT);
+    bam_read_idx_destroy(bri);
 
+    if(stats_file != NULL && bri_stats_write_json(stats_file, "show") != 0) {
+        exit(EXIT_FAILURE);
+    }
     return 0;
 }
@@ -0,0 +1,199 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+#include "bri_sparse.h"
+#include "bri_stats.h"
+
+// natural order comparison of names, matching samtools sort -n
+static int compare_names_natural(const char* n1, const char* n2)
+{
+    const unsigned char* pa = (const unsigned char*)n1;
+    const unsigned char* pb = (const unsigned char*)n2;
+    while(*pa && *pb) {
+        if(!isdigit(*pa) || !isdigit(*pb)) {
+            if(*pa != *pb) {
+                return (int)*pa - (int)*pb;
+            }
+            ++pa;
+            ++pb;
+        } else {
+            // compare the numbers ignoring leading zeros, the longer number is
+            // larger and numbers of the same length differ at the first mismatch
+            while(*pa == '0') {
+                ++pa;
+            }
+            while(*pb == '0') {
+                ++pb;
+            }
+            while(isdigit(*pa) && *pa == *pb) {
+                ++pa;
+                ++pb;
+            }
+
+            int diff = (int)*pa - (int)*pb;
+            while(isdigit(*pa) && isdigit(*pb)) {
+                ++pa;
+                ++pb;
+            }
+
+            if(isdigit(*pa)) {
+                return 1;
+            } else if(isdigit(*pb)) {
+                return -1;
+            } else if(diff != 0) {
+                return diff;
+            }
+        }
+    }
+    return *pa ? 1 : (*pb ? -1 : 0);
+}
+
+//
+int bam_read_idx_compare_names(int order, const char* n1, const char* n2)
+{
+    return order == BRI_NAME_ORDER_NATURAL ? compare_names_natural(n1, n2) : strcmp(n1, n2);
+}
+
+//
+void bam_read_idx_sparse_builder_init(bam_read_idx_sparse_builder* builder, bam_read_idx* bri, size_t interval)
+{
+    memset(builder, 0, sizeof(bam_read_idx_sparse_builder));
+    builder->bri = bri;
+    builder->interval = interval;
+    builder->lexicographic = 1;
+    builder->natural = 1;
+}
+
+//
+void bam_read_idx_sparse_build_add(void* data, const bam1_t* b, size_t file_offset)
+{
+    bam_read_idx_sparse_builder* builder = (bam_read_idx_sparse_builder*)data;
+    const char* name = bam_get_qname(b);
+    if(builder->reads > 0 && strcmp(name, builder->last_name) == 0) {
+        return;
+    }
+
+    // a new read, which must come after the last in whichever order the file is sorted by.
+    // Different names can be equal in natural order (leading zeros) so ties are allowed.
+    if(builder->reads > 0) {
+        builder->lexicographic = builder->lexicographic && strcmp(builder->last_name, name) < 0;
+        builder->natural = builder->natural && compare_names_natural(builder->last_name, name) <= 0;
+    }
+
+    if(builder->reads % builder->interval == 0) {
+        bam_read_idx_add(builder->bri, name, file_offset);
+        bam_read_idx_build_progress(builder->bri);
+    }
+    builder->reads += 1;
+
+    size_t len = strlen(name) + 1;
+    if(len > builder->last_name_capacity) {
+        builder->last_name = realloc(builder->last_name, len);
+        builder->last_name_capacity = len;
+        if(builder->last_name == NULL) {
+            fprintf(stderr, "[bri] malloc failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(builder->last_name, name, len);
+}
+
+//
+int bam_read_idx_sparse_builder_finish(bam_read_idx_sparse_builder* builder)
+{
+    free(builder->last_name);
+    builder->last_name = NULL;
+    builder->last_name_capacity = 0;
+
+    if(!builder->lexicographic && !builder->natural) {
+        return -1;
+    }
+
+    builder->bri->sparse_interval = builder->interval;
+    builder->bri->name_order = builder->lexicographic ? BRI_NAME_ORDER_LEXICOGRAPHIC : BRI_NAME_ORDER_NATURAL;
+    return 0;
+}
+
+// the sampled read to start scanning from for readname: the last one that sorts before
+// it, or that is equal to it in lexicographic order where names can't tie
+static size_t bam_read_idx_sparse_start(const bam_read_idx* bri, const char* readname)
+{
+    int max_cmp = bri->name_order == BRI_NAME_ORDER_LEXICOGRAPHIC ? 0 : -1;
+    size_t lo = 0;
+    size_t hi = bri->record_count;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if(bam_read_idx_compare_names(bri->name_order, bri->records[mid].read_name.ptr, readname) <= max_cmp) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo > 0 ? lo - 1 : 0;
+}
+
+//
+int bam_read_idx_sparse_find(htsFile* fp, bam_hdr_t* hdr, const bam_read_idx* bri, const char* readname,
+                             bam_read_idx_record** records, size_t* capacity)
+{
+    if(bri->record_count == 0) {
+        return 0;
+    }
+
+    const bam_read_idx_record* start = &bri->records[bam_read_idx_sparse_start(bri, readname)];
+    if(bri_stats_bgzf_seek(fp->fp.bgzf, start->file_offset) != 0) {
+        fprintf(stderr, "[bri] bgzf_seek failed\n");
+        return -1;
+    }
+
+    // the reads are in order, so scan until the first read that sorts after readname
+    bam1_t* b = bam_init1();
+    int n = 0;
+    int ret;
+    while(1) {
+        size_t offset = bgzf_tell(fp->fp.bgzf);
+        if((ret = bri_stats_sam_read1(fp, hdr, b)) < 0) {
+            break;
+        }
+
+        const char* qname = bam_get_qname(b);
+        int cmp = bam_read_idx_compare_names(bri->name_order, qname, readname);
+        if(cmp > 0) {
+            break;
+        } else if(cmp < 0 || strcmp(qname, readname) != 0) {
+            continue;
+        }
+
+        if((size_t)n == *capacity) {
+            size_t new_capacity = *capacity > 0 ? 2 * *capacity : 16;
+            bam_read_idx_record* new_records = realloc(*records, new_capacity * sizeof(bam_read_idx_record));
+            if(new_records == NULL) {
+                n = -1;
+                break;
+            }
+            *records = new_records;
+            *capacity = new_capacity;
+        }
+
+        (*records)[n].read_name.ptr = readname;
+        (*records)[n].file_offset = offset;
+        n += 1;
+    }
+
+    bam_destroy1(b);
+    if(ret < -1) {
+        fprintf(stderr, "[bri] sam_read1 failed\n");
+        return -1;
+    }
+    return n;
+}
@@ -0,0 +1,68 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+// Sparse indices for bam files sorted by read name. As the alignments
+// of each read are together and the reads are in order, the index only
+// needs a record for the first alignment of every Kth read. The records
+// are kept in file order, which is name order, so a lookup finds the
+// last sampled read before the name and scans forward from there.
+//
+#ifndef BAM_READ_IDX_SPARSE
+#define BAM_READ_IDX_SPARSE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <htslib/sam.h>
+#include <htslib/hts.h>
+#include "bri_index.h"
+
+// The order of the reads in a name sorted file. samtools sort -n
+// uses natural order, where runs of digits compare as numbers,
+// and samtools sort -N uses lexicographic (strcmp) order.
+#define BRI_NAME_ORDER_LEXICOGRAPHIC 0
+#define BRI_NAME_ORDER_NATURAL 1
+
+// State for building a sparse index while scanning a file,
+// used as the data of bam_read_idx_sparse_build_add
+typedef struct bam_read_idx_sparse_builder
+{
+    bam_read_idx* bri;
+    size_t interval;
+
+    // number of reads seen and the name of the last one
+    size_t reads;
+    char* last_name;
+    size_t last_name_capacity;
+
+    // whether the reads seen so far are in each order
+    int lexicographic;
+    int natural;
+} bam_read_idx_sparse_builder;
+
+// compare two read names in order, as strcmp
+int bam_read_idx_compare_names(int order, const char* n1, const char* n2);
+
+//
+void bam_read_idx_sparse_builder_init(bam_read_idx_sparse_builder* builder, bam_read_idx* bri, size_t interval);
+
+// add a record to the sparse index for the first alignment of every
+// interval reads, see bam_read_idx_scan_fn
+void bam_read_idx_sparse_build_add(void* data, const bam1_t* b, size_t file_offset);
+
+// set the sparse interval and name order of the index once the file has been
+// scanned. Returns -1 if the reads weren't sorted by name in either order.
+int bam_read_idx_sparse_builder_finish(bam_read_idx_sparse_builder* builder);
+
+// find the alignments of readname in fp, a bam file with a sparse index,
+// by scanning from the nearest sampled read. The records for the alignments
+// are stored in *records, which is grown as needed. Returns the number of
+// alignments or -1 on error.
+int bam_read_idx_sparse_find(htsFile* fp, bam_hdr_t* hdr, const bam_read_idx* bri, const char* readname,
+                             bam_read_idx_record** records, size_t* capacity);
+
+#endif
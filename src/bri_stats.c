@@ -0,0 +1,295 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+
+// for clock_gettime
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <htslib/hfile.h>
+#include <htslib/cram.h>
+#include "bri_index.h"
+#include "bri_stats.h"
+
+// the most data htslib puts in one bgzf block, used to estimate how
+// many blocks a long alignment was spread over
+#define BRI_STATS_BGZF_BLOCK_SIZE 0xff00
+
+static const char* phase_names[BRI_NUM_PHASES] = {
+    "scan",
+    "sort",
+    "name_write",
+    "record_write",
+    "load",
+    "fixup",
+    "search",
+    "seek",
+    "decode",
+    "output"
+};
+
+static const char* counter_names[BRI_NUM_COUNTERS] = {
+    "bytes_read",
+    "bytes_inflated",
+    "bgzf_blocks",
+    "seeks",
+    "arena_reserved",
+    "arena_used"
+};
+
+static int stats_enabled = 0;
+static double stats_enabled_time = 0.0;
+
+// Phases can be timed from any thread. Each thread has its own start
+// times, and the totals (in nanoseconds) and counters are added to
+// atomically, so the reader library can be used from many threads.
+static __thread double phase_started[BRI_NUM_PHASES];
+static __thread double phase_cpu_started[BRI_NUM_PHASES];
+static uint64_t phase_elapsed_ns[BRI_NUM_PHASES];
+static uint64_t phase_cpu_elapsed_ns[BRI_NUM_PHASES];
+static uint64_t counters[BRI_NUM_COUNTERS];
+
+// add to a total shared by all threads
+static void bri_stats_add(uint64_t* total, uint64_t n)
+{
+    __atomic_fetch_add(total, n, __ATOMIC_RELAXED);
+}
+
+// add an interval in seconds to a total in nanoseconds
+static void bri_stats_add_seconds(uint64_t* total_ns, double seconds)
+{
+    bri_stats_add(total_ns, seconds > 0.0 ? (uint64_t)(seconds * 1e9) : 0);
+}
+
+// cpu seconds used by the calling thread. Phases can be timed by several
+// threads at once, and each only adds the cpu time it used itself.
+static double bri_stats_cpu_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//
+void bri_stats_enable(int enabled)
+{
+    if(enabled && stats_enabled_time == 0.0) {
+        stats_enabled_time = bri_stats_now();
+    }
+    stats_enabled = enabled;
+}
+
+//
+int bri_stats_enabled(void)
+{
+    return stats_enabled;
+}
+
+//
+double bri_stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//
+void bri_stats_start(int phase)
+{
+    assert(phase >= 0 && phase < BRI_NUM_PHASES);
+    if(stats_enabled) {
+        phase_started[phase] = bri_stats_now();
+        phase_cpu_started[phase] = bri_stats_cpu_now();
+    }
+}
+
+//
+void bri_stats_stop(int phase)
+{
+    assert(phase >= 0 && phase < BRI_NUM_PHASES);
+    if(stats_enabled) {
+        bri_stats_add_seconds(&phase_elapsed_ns[phase], bri_stats_now() - phase_started[phase]);
+        bri_stats_add_seconds(&phase_cpu_elapsed_ns[phase], bri_stats_cpu_now() - phase_cpu_started[phase]);
+    }
+}
+
+//
+double bri_stats_elapsed(int phase)
+{
+    assert(phase >= 0 && phase < BRI_NUM_PHASES);
+    return __atomic_load_n(&phase_elapsed_ns[phase], __ATOMIC_RELAXED) / 1e9;
+}
+
+//
+double bri_stats_cpu(int phase)
+{
+    assert(phase >= 0 && phase < BRI_NUM_PHASES);
+    return __atomic_load_n(&phase_cpu_elapsed_ns[phase], __ATOMIC_RELAXED) / 1e9;
+}
+
+//
+const char* bri_stats_phase_name(int phase)
+{
+    assert(phase >= 0 && phase < BRI_NUM_PHASES);
+    return phase_names[phase];
+}
+
+//
+void bri_stats_count(int counter, uint64_t n)
+{
+    assert(counter >= 0 && counter < BRI_NUM_COUNTERS);
+    if(stats_enabled) {
+        bri_stats_add(&counters[counter], n);
+    }
+}
+
+//
+uint64_t bri_stats_counter(int counter)
+{
+    assert(counter >= 0 && counter < BRI_NUM_COUNTERS);
+    return __atomic_load_n(&counters[counter], __ATOMIC_RELAXED);
+}
+
+//
+void bri_stats_bgzf_mark_position(BGZF* fp, bri_stats_bgzf_mark* mark)
+{
+    if(stats_enabled) {
+        mark->raw_offset = fp->mt == NULL ? htell(fp->fp) : -1;
+        mark->block_length = fp->block_length;
+        mark->block_offset = fp->block_offset;
+    }
+}
+
+//
+void bri_stats_bgzf_read(BGZF* fp, const bri_stats_bgzf_mark* mark, size_t bytes)
+{
+    if(!stats_enabled) {
+        return;
+    }
+
+    // with threads the stream is read ahead in the background
+    // so its position can't be used
+    if(fp->mt == NULL && mark->raw_offset >= 0) {
+        int64_t raw_offset = htell(fp->fp);
+        if(raw_offset > mark->raw_offset) {
+            bri_stats_add(&counters[BRI_COUNTER_BYTES_READ], raw_offset - mark->raw_offset);
+        }
+    }
+
+    // Nothing new was inflated if the read was satisfied by the block the
+    // stream was already in (which is empty after a seek). Otherwise the read
+    // ended in a newly inflated block, possibly passing through others.
+    size_t remaining = mark->block_length > mark->block_offset ? mark->block_length - mark->block_offset : 0;
+    if(bytes <= remaining) {
+        return;
+    }
+
+    size_t passed = bytes - remaining;
+    passed = passed > (size_t)fp->block_offset ? passed - fp->block_offset : 0;
+    bri_stats_add(&counters[BRI_COUNTER_BGZF_BLOCKS], 1 + (passed + BRI_STATS_BGZF_BLOCK_SIZE - 1) / BRI_STATS_BGZF_BLOCK_SIZE);
+    bri_stats_add(&counters[BRI_COUNTER_BYTES_INFLATED], fp->block_length + passed);
+}
+
+//
+int bri_stats_sam_read1(htsFile* fp, bam_hdr_t* h, bam1_t* b)
+{
+    if(!stats_enabled) {
+        return sam_read1(fp, h, b);
+    }
+
+    bri_stats_start(BRI_PHASE_DECODE);
+    int ret;
+    if(fp->format.format == cram) {
+        hFILE* hfp = cram_fd_get_fp(fp->fp.cram);
+        off_t start_offset = htell(hfp);
+        ret = sam_read1(fp, h, b);
+        bri_stats_add(&counters[BRI_COUNTER_BYTES_READ], htell(hfp) - start_offset);
+    } else {
+        bri_stats_bgzf_mark mark;
+        bri_stats_bgzf_mark_position(fp->fp.bgzf, &mark);
+        ret = sam_read1(fp, h, b);
+        if(ret >= 0) {
+            // on disk a record is its length, the fixed fields then the variable length data
+            bri_stats_bgzf_read(fp->fp.bgzf, &mark, 4 + 32 + b->l_data);
+        }
+    }
+    bri_stats_stop(BRI_PHASE_DECODE);
+    return ret;
+}
+
+//
+int bri_stats_bgzf_seek(BGZF* fp, int64_t offset)
+{
+    bri_stats_start(BRI_PHASE_SEEK);
+    int ret = bgzf_seek(fp, offset, SEEK_SET);
+    bri_stats_stop(BRI_PHASE_SEEK);
+    bri_stats_count(BRI_COUNTER_SEEKS, 1);
+    return ret;
+}
+
+//
+void bri_stats_reset(void)
+{
+    for(int i = 0; i < BRI_NUM_PHASES; ++i) {
+        phase_elapsed_ns[i] = 0;
+        phase_started[i] = 0.0;
+        phase_cpu_elapsed_ns[i] = 0;
+        phase_cpu_started[i] = 0.0;
+    }
+
+    for(int i = 0; i < BRI_NUM_COUNTERS; ++i) {
+        counters[i] = 0;
+    }
+}
+
+//
+int bri_stats_write_json(const char* filename, const char* command)
+{
+    FILE* out = fopen(filename, "w");
+    if(out == NULL) {
+        fprintf(stderr, "[bri] could not open %s for writing\n", filename);
+        return -1;
+    }
+
+    // ru_maxrss is in kilobytes on linux
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+                 usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"version\": \"%s\",\n", BRI_VERSION);
+    fprintf(out, "  \"command\": \"%s\",\n", command);
+    fprintf(out, "  \"wall_s\": %.6f,\n", bri_stats_now() - stats_enabled_time);
+    fprintf(out, "  \"cpu_s\": %.6f,\n", cpu);
+    fprintf(out, "  \"peak_rss_kb\": %ld,\n", usage.ru_maxrss);
+    fprintf(out, "  \"phases\": {\n");
+    for(int p = 0; p < BRI_NUM_PHASES; ++p) {
+        fprintf(out, "    \"%s\": { \"wall_s\": %.6f, \"cpu_s\": %.6f }%s\n",
+            phase_names[p], bri_stats_elapsed(p), bri_stats_cpu(p), p + 1 < BRI_NUM_PHASES ? "," : "");
+    }
+    fprintf(out, "  },\n");
+    fprintf(out, "  \"io\": {\n");
+    for(int c = 0; c < BRI_NUM_COUNTERS; ++c) {
+        fprintf(out, "    \"%s\": %llu%s\n",
+            counter_names[c], (unsigned long long)bri_stats_counter(c), c + 1 < BRI_NUM_COUNTERS ? "," : "");
+    }
+    fprintf(out, "  }\n");
+    fprintf(out, "}\n");
+
+    if(fclose(out) != 0) {
+        fprintf(stderr, "[bri] could not write %s\n", filename);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,102 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+// Process-wide timers for the phases of building, loading and
+// querying an index, and counters for the I/O done. Nothing is
+// recorded until bri_stats_enable is called. Phases can be timed and
+// counters increased from any thread, with the time of each phase
+// summed over the threads. The cpu time of a phase is that of the
+// threads timing it, so work handed to other threads (such as htslib's
+// decompression threads) only appears in the total for the process.
+//
+#ifndef BAM_READ_IDX_STATS
+#define BAM_READ_IDX_STATS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <htslib/bgzf.h>
+#include <htslib/sam.h>
+
+enum bri_stats_phase
+{
+    BRI_PHASE_SCAN = 0,     // reading the input files when building
+    BRI_PHASE_SORT,         // sorting the records by name
+    BRI_PHASE_NAME_WRITE,   // writing the distinct names, and building the bloom filter
+    BRI_PHASE_RECORD_WRITE, // writing the records and optional sections
+    BRI_PHASE_LOAD,         // reading an index from disk
+    BRI_PHASE_FIXUP,        // converting the loaded name offsets to pointers
+    BRI_PHASE_SEARCH,       // finding the records for a name
+    BRI_PHASE_SEEK,         // seeking to an alignment
+    BRI_PHASE_DECODE,       // reading and decoding an alignment
+    BRI_PHASE_OUTPUT,       // writing alignments out
+    BRI_NUM_PHASES
+};
+
+enum bri_stats_counter
+{
+    BRI_COUNTER_BYTES_READ = 0, // compressed bytes read from the input files
+    BRI_COUNTER_BYTES_INFLATED, // bytes produced by decompressing bgzf blocks
+    BRI_COUNTER_BGZF_BLOCKS,    // bgzf blocks read from
+    BRI_COUNTER_SEEKS,          // seeks within the input files
+    BRI_COUNTER_ARENA_RESERVED, // bytes reserved for names and records while building
+    BRI_COUNTER_ARENA_USED,     // bytes of the reserved memory holding names and records
+    BRI_NUM_COUNTERS
+};
+
+// the position of a bgzf stream before reading an alignment
+typedef struct bri_stats_bgzf_mark
+{
+    int64_t raw_offset;
+    int block_length;
+    int block_offset;
+} bri_stats_bgzf_mark;
+
+// start or stop recording, the process start time for the
+// totals is taken the first time stats are enabled
+void bri_stats_enable(int enabled);
+int bri_stats_enabled(void);
+
+// seconds on a monotonic clock, for measuring intervals
+double bri_stats_now(void);
+
+// start and stop timing a phase, time accumulates over repeated calls
+void bri_stats_start(int phase);
+void bri_stats_stop(int phase);
+
+// total wall clock and cpu seconds spent in a phase
+double bri_stats_elapsed(int phase);
+double bri_stats_cpu(int phase);
+
+// the name of a phase, for reporting
+const char* bri_stats_phase_name(int phase);
+
+// increase a counter
+void bri_stats_count(int counter, uint64_t n);
+uint64_t bri_stats_counter(int counter);
+
+// Record the I/O done by reading bytes (uncompressed) from fp since mark was
+// taken. Bytes are exact for unthreaded streams but the number of blocks a long
+// alignment passes through is estimated from its length, and blocks found in
+// htslib's block cache are counted as inflated again.
+void bri_stats_bgzf_mark_position(BGZF* fp, bri_stats_bgzf_mark* mark);
+void bri_stats_bgzf_read(BGZF* fp, const bri_stats_bgzf_mark* mark, size_t bytes);
+
+// sam_read1 and bgzf_seek, timed as the decode and seek phases
+// and with their I/O counted
+int bri_stats_sam_read1(htsFile* fp, bam_hdr_t* h, bam1_t* b);
+int bri_stats_bgzf_seek(BGZF* fp, int64_t offset);
+
+// clear all accumulated time and counts, only when no other thread is recording
+void bri_stats_reset(void);
+
+// write the phase times, counters and peak memory use as JSON
+// to filename. Returns 0 on success and -1 on error.
+int bri_stats_write_json(const char* filename, const char* command);
+
+#endif
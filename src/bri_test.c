@@ -6,33 +6,273 @@
 // bri - simple utility to provide random access to
 //       bam records by read name
 //
+
+// avoid warnings in qsort_r
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <assert.h>
 #include <getopt.h>
 #include "bri_index.h"
 #include "bri_get.h"
+#include "bri_stats.h"
+#include "sort_r.h"
+
+// at most this many problems of each kind are printed
+#define BRI_TEST_MAX_REPORTS 10
 
 enum {
     OPT_HELP = 1,
+    OPT_STATS,
+    OPT_SEEK,
 };
 
-static const char* shortopts = ":i:"; // placeholder
+static const char* shortopts = ":i:r:t:"; // placeholder
 static const struct option longopts[] = {
     { "help",                      no_argument,       NULL, OPT_HELP },
+    { "index",               required_argument,       NULL,      'i' },
+    { "reference",           required_argument,       NULL,      'r' },
+    { "threads",             required_argument,       NULL,      't' },
+    { "seek",                      no_argument,       NULL, OPT_SEEK },
+    { "stats",               required_argument,       NULL, OPT_STATS },
     { NULL, 0, NULL, 0 }
 };
 
 void print_usage_test()
 {
-    fprintf(stderr, "usage: bri test [-i <index_filename.bri>] <input.bam>\n");
+    fprintf(stderr, "usage: bri test [-t <threads>] [--seek] [-i <index_filename.bri>] [-r <reference.fa>] [--stats <stats.json>] <input.bam|input.cram>\n");
+    fprintf(stderr, "       bri test [-t <threads>] [--seek] -i <multi_file_index.bri> [-r <reference.fa>] [--stats <stats.json>]\n");
+    fprintf(stderr, "  check that the index has a record for every alignment in the input files and nothing else\n");
+    fprintf(stderr, "  -t, --threads N     use N extra threads to decompress bam files\n");
+    fprintf(stderr, "  --seek              fetch every record through the index instead of scanning the files (slow)\n");
+}
+
+// the outcome of checking an index against its files
+typedef struct bri_test_state
+{
+    const bam_read_idx* bri;
+    const char* filename;
+
+    // indices of the records of the file being scanned, in
+    // file order, and the next one expected in the file
+    const size_t* order;
+    size_t next;
+    size_t end;
+
+    // one bit per record, set when the record has been verified
+    uint8_t* verified;
+
+    size_t alignments;
+    size_t missing;
+    size_t mismatched;
+} bri_test_state;
+
+static void bri_test_set_verified(bri_test_state* state, size_t ri)
+{
+    state->verified[ri / 8] |= 1 << (ri % 8);
+}
+
+static int bri_test_is_verified(const bri_test_state* state, size_t ri)
+{
+    return (state->verified[ri / 8] >> (ri % 8)) & 1;
+}
+
+// record a record whose name doesn't match the alignment at its offset
+static void bri_test_mismatch(bri_test_state* state, const char* filename, const bam_read_idx_record* record, const char* qname)
+{
+    if(state->mismatched++ < BRI_TEST_MAX_REPORTS) {
+        fprintf(stderr, "[bri-test] %s: index record for %s at offset %zu found alignment %s\n",
+            filename, record->read_name.ptr, record->file_offset, qname);
+    }
+}
+
+// order record indices by file then by offset within the file
+static int compare_record_indices_by_position(const void* a, const void* b, void* data)
+{
+    const bam_read_idx* bri = (const bam_read_idx*)data;
+    const bam_read_idx_record* r1 = &bri->records[*(const size_t*)a];
+    const bam_read_idx_record* r2 = &bri->records[*(const size_t*)b];
+
+    size_t f1 = bam_read_idx_record_file_id(bri, r1);
+    size_t f2 = bam_read_idx_record_file_id(bri, r2);
+    if(f1 != f2) {
+        return f1 < f2 ? -1 : 1;
+    }
+    return r1->file_offset < r2->file_offset ? -1 : (r1->file_offset > r2->file_offset);
+}
+
+// called for each alignment while scanning a file, the records for the
+// file are visited in the same order so this is a merge of the two
+static void bri_test_check_alignment(void* data, const bam1_t* b, size_t file_offset)
+{
+    bri_test_state* state = (bri_test_state*)data;
+    const bam_read_idx_record* records = state->bri->records;
+
+    // alignments without the key tag aren't indexed
+    char buffer[BRI_KEY_BUFFER_SIZE];
+    const char* qname = bam_read_idx_key(b, state->bri->key_tag, buffer);
+    if(qname == NULL) {
+        return;
+    }
+    state->alignments += 1;
+
+    // records before this alignment don't point to the start of
+    // any alignment, they are reported as unverified at the end
+    while(state->next < state->end && records[state->order[state->next]].file_offset < file_offset) {
+        state->next += 1;
+    }
+
+    if(state->next < state->end && records[state->order[state->next]].file_offset == file_offset) {
+        size_t ri = state->order[state->next++];
+        if(strcmp(records[ri].read_name.ptr, qname) == 0) {
+            bri_test_set_verified(state, ri);
+        } else {
+            bri_test_mismatch(state, state->filename, &records[ri], qname);
+        }
+    } else if(state->bri->sparse_interval > 0) {
+        // a sparse index only has records for some of the alignments
+    } else if(state->missing++ < BRI_TEST_MAX_REPORTS) {
+        fprintf(stderr, "[bri-test] %s: alignment %s at offset %zu is not in the index\n", state->filename, qname, file_offset);
+    }
+}
+
+// scan every file sequentially, checking each alignment against the index
+static void bri_test_scan(bri_test_state* state, const char** filenames, size_t num_files, int threads)
+{
+    const bam_read_idx* bri = state->bri;
+    size_t* order = malloc(bri->record_count * sizeof(size_t));
+    if(order == NULL) {
+        fprintf(stderr, "[bri] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(size_t ri = 0; ri < bri->record_count; ++ri) {
+        order[ri] = ri;
+    }
+    sort_r(order, bri->record_count, sizeof(size_t), compare_record_indices_by_position, (void*)bri);
+    state->order = order;
+
+    size_t start = 0;
+    for(size_t fi = 0; fi < num_files; ++fi) {
+
+        // the records for this file
+        size_t end = start;
+        while(end < bri->record_count && bam_read_idx_record_file_id(bri, &bri->records[order[end]]) == fi) {
+            end += 1;
+        }
+
+        htsFile* fp = hts_open(filenames[fi], "r");
+        if(fp == NULL) {
+            fprintf(stderr, "[bri] could not open %s\n", filenames[fi]);
+            exit(EXIT_FAILURE);
+        }
+
+        // cram offsets are found from the position of the underlying stream,
+        // which is read ahead when using threads
+        if(threads > 0 && fp->format.format != cram) {
+            hts_set_threads(fp, threads);
+        }
+
+        bam_hdr_t* h = sam_hdr_read(fp);
+        bam1_t* b = bam_init1();
+        if(h == NULL || b == NULL) {
+            fprintf(stderr, "[bri] could not read the header of %s\n", filenames[fi]);
+            exit(EXIT_FAILURE);
+        }
+
+        state->filename = filenames[fi];
+        state->next = start;
+        state->end = end;
+        bam_read_idx_scan(filenames[fi], fp, h, b, &bri->filter, bri->key_tag, NULL, bri_test_check_alignment, state);
+
+        bam_destroy1(b);
+        bam_hdr_destroy(h);
+        hts_close(fp);
+        start = end;
+    }
+
+    free(order);
+    state->order = NULL;
+}
+
+// fetch every record through the index, as bri get does
+static void bri_test_seek(bri_test_state* state, const char* input_bam, const char* reference)
+{
+    const bam_read_idx* bri = state->bri;
+    bam_read_idx_handles* handles = bam_read_idx_handles_init(bri, input_bam, reference);
+    if(handles == NULL) {
+        fprintf(stderr, "[bri] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+    // the position of each file's stream, so records that follow each other
+    // (or share a cram container) aren't sought
+    size_t* positions = malloc(handles->count * sizeof(size_t));
+    if(positions == NULL) {
+        fprintf(stderr, "[bri] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+    for(size_t fi = 0; fi < handles->count; ++fi) {
+        positions[fi] = BRI_NO_POSITION;
+    }
+
+    bam1_t* b = bam_init1();
+    char buffer[BRI_KEY_BUFFER_SIZE];
+    const char* key = NULL;
+
+    const char* prev_readname = NULL;
+    for(size_t ri = 0; ri < bri->record_count; ++ri) {
+        const char* readname = bri->records[ri].read_name.ptr;
+
+        // skip if same as previous readname
+        if(readname == prev_readname) {
+            continue;
+        }
+        prev_readname = readname;
+
+        // the names of a sparse index are distinct, and may not be in strcmp order
+        bam_read_idx_record* start = &bri->records[ri];
+        bam_read_idx_record* end = start + 1;
+        if(bri->sparse_interval == 0) {
+            bri_stats_start(BRI_PHASE_SEARCH);
+            bam_read_idx_get_range(bri, readname, &start, &end);
+            bri_stats_stop(BRI_PHASE_SEARCH);
+        }
+
+        for(; start != end; ++start) {
+            size_t file_id = bam_read_idx_record_file_id(bri, start);
+            bam_hdr_t* h;
+            if(bam_read_idx_handles_get(handles, file_id, &h) == NULL) {
+                exit(EXIT_FAILURE);
+            }
+
+            state->alignments += 1;
+            const char* filename = handles->filenames[file_id];
+            if(bam_read_idx_handles_read(handles, file_id, b, start, &positions[file_id]) != 0) {
+                bri_test_mismatch(state, filename, start, "(unreadable)");
+            } else if((key = bam_read_idx_key(b, bri->key_tag, buffer)) == NULL || strcmp(readname, key) != 0) {
+                bri_test_mismatch(state, filename, start, key != NULL ? key : "(no key tag)");
+            } else {
+                bri_test_set_verified(state, start - bri->records);
+            }
+        }
+    }
+
+    bam_destroy1(b);
+    free(positions);
+    bam_read_idx_handles_destroy(handles);
 }
 
 //
 int bam_read_idx_test_main(int argc, char** argv)
 {
     char* input_bri = NULL;
+    char* reference = NULL;
+    char* stats_file = NULL;
+    int threads = 0;
+    int seek = 0;
 
     int die = 0;
     for (char c; (c = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1;) {
@@ -40,12 +280,25 @@ int bam_read_idx_test_main(int argc, char** argv)
             case OPT_HELP:
                 print_usage_test();
                 exit(EXIT_SUCCESS);
+            case OPT_STATS:
+                stats_file = optarg;
+                break;
+            case OPT_SEEK:
+                seek = 1;
+                break;
             case 'i':
                 input_bri = optarg;
+                break;
+            case 'r':
+                reference = optarg;
+                break;
+            case 't':
+                threads = atoi(optarg);
+                break;
         }
     }
-    
-    if (argc - optind < 1) {
+
+    if (argc - optind < 1 && input_bri == NULL) {
         fprintf(stderr, "bri test: not enough arguments\n");
         die = 1;
     }
@@ -55,52 +308,70 @@ int bam_read_idx_test_main(int argc, char** argv)
         exit(EXIT_FAILURE);
     }
 
-    char* input_bam = argv[optind++];
-
-    // open files
-    bam_read_idx* bri = bam_read_idx_load(input_bam, input_bri);
-    htsFile* bam_fp = hts_open(input_bam, "r");
-    bam_hdr_t* h = sam_hdr_read(bam_fp);
-    bam1_t* b = bam_init1();
-
-    // iterate over each record and run get on each readname
-    const char* prev_readname = NULL;
-    for(size_t ri = 0; ri < bri->record_count; ++ri) {
-        const char* readname = bri->records[ri].read_name.ptr;
+    bri_stats_enable(stats_file != NULL);
 
-        // skip if same as previous readname
-        if(readname == prev_readname) {
-            continue;
+    // open files, an index covering multiple files stores their paths
+    char* input_bam = NULL;
+    bam_read_idx* bri = NULL;
+    if(input_bri == NULL) {
+        input_bam = argv[optind++];
+        bri = bam_read_idx_load(input_bam, input_bri);
+    } else {
+        bri = bam_read_idx_load(NULL, input_bri);
+        if(bri->file_count == 0) {
+            if(optind >= argc) {
+                fprintf(stderr, "bri test: the input bam must be given for a single file index\n");
+                exit(EXIT_FAILURE);
+            }
+            input_bam = argv[optind++];
         }
+    }
 
-        bam_read_idx_record* start;
-        bam_read_idx_record* end;
-        bam_read_idx_get_range(bri, readname, &start, &end);
-        while(start != end) {
-        
-            bam_read_idx_get_by_record(bam_fp, h, b, start);
-            fprintf(stderr, "[bri-test] %s %s\n", readname, bam_get_qname(b));
-            assert(strcmp(readname, bam_get_qname(b)) == 0);
-
-            // mark this record as used so we can make sure every record is present in the bam
-            // this destroys the index
-            start->file_offset = 0;
-            start++;
-        }
+    if(bri->format == BRI_FORMAT_FASTQ) {
+        fprintf(stderr, "bri test: indices of fastq files can't be tested\n");
+        exit(EXIT_FAILURE);
+    }
 
-        prev_readname = readname;
+    bri_test_state state;
+    memset(&state, 0, sizeof(state));
+    state.bri = bri;
+    state.verified = calloc((bri->record_count + 7) / 8, 1);
+    if(state.verified == NULL) {
+        fprintf(stderr, "[bri] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(seek) {
+        bri_test_seek(&state, input_bam, reference);
+    } else if(bri->file_count > 0) {
+        bri_test_scan(&state, (const char**)bri->file_names, bri->file_count, threads);
+    } else {
+        bri_test_scan(&state, (const char**)&input_bam, 1, threads);
     }
 
-    // check that all records were accessed
+    // every record should have been matched to an alignment
+    size_t unverified = 0;
     for(size_t ri = 0; ri < bri->record_count; ++ri) {
-        assert(bri->records[ri].file_offset == 0);
+        if(!bri_test_is_verified(&state, ri) && unverified++ < BRI_TEST_MAX_REPORTS) {
+            fprintf(stderr, "[bri-test] index record for %s at offset %zu in file %zu was not verified\n",
+                bri->records[ri].read_name.ptr, bri->records[ri].file_offset, bam_read_idx_record_file_id(bri, &bri->records[ri]));
+        }
     }
-    
-    bam_destroy1(b);
-    bam_hdr_destroy(h);
-    hts_close(bam_fp);
+
+    fprintf(stderr, "[bri-test] checked %zu alignments against %zu index records: %zu alignments missing from the index, %zu mismatched records, %zu records not verified\n",
+        state.alignments, bri->record_count, state.missing, state.mismatched, unverified);
+    int failed = state.missing > 0 || state.mismatched > 0 || unverified > 0;
+
+    free(state.verified);
     bam_read_idx_destroy(bri);
     bri = NULL;
 
+    if(stats_file != NULL && bri_stats_write_json(stats_file, "test") != 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    if(failed) {
+        exit(EXIT_FAILURE);
+    }
     return 0;
 }
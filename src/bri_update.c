@@ -0,0 +1,419 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+
+// for fseeko and strdup
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "bri_update.h"
+#include "bri_bloom.h"
+#include "bri_stats.h"
+#include "sort_r.h"
+
+extern char verbose;
+
+// the size of filename, or -1 if it doesn't exist
+static int64_t bam_read_idx_file_bytes(const char* filename)
+{
+    struct stat st;
+    return stat(filename, &st) == 0 ? (int64_t)st.st_size : -1;
+}
+
+// continue the FNV-1a hash h over the bytes in [start, end) of fp,
+// returns -1 if they can't be read
+static int bam_read_idx_hash_bytes(FILE* fp, off_t start, off_t end, uint64_t* h)
+{
+    unsigned char buffer[4096];
+    if(fseeko(fp, start, SEEK_SET) != 0) {
+        return -1;
+    }
+
+    while(start < end) {
+        size_t n = (size_t)(end - start) < sizeof(buffer) ? (size_t)(end - start) : sizeof(buffer);
+        if(fread(buffer, 1, n, fp) != n) {
+            return -1;
+        }
+
+        for(size_t i = 0; i < n; ++i) {
+            *h ^= buffer[i];
+            *h *= 1099511628211ull;
+        }
+        start += n;
+    }
+    return 0;
+}
+
+// Hash the start of the file, which was written before it was scanned,
+// and the compressed blocks before the one the scan ended in. Neither
+// changes when a file is appended to. Returns -1 if the file can't be read.
+static int bam_read_idx_fingerprint(const char* filename, const bam_read_idx_source* source, uint64_t* fingerprint)
+{
+    FILE* fp = fopen(filename, "rb");
+    if(fp == NULL) {
+        return -1;
+    }
+
+    off_t end = source->end_offset >> 16;
+    off_t head_end = source->file_bytes < BRI_UPDATE_FINGERPRINT_BYTES ? (off_t)source->file_bytes : BRI_UPDATE_FINGERPRINT_BYTES;
+    off_t tail_start = end - BRI_UPDATE_FINGERPRINT_BYTES > head_end ? end - BRI_UPDATE_FINGERPRINT_BYTES : head_end;
+
+    uint64_t h = 14695981039346656037ull;
+    int ret = bam_read_idx_hash_bytes(fp, 0, head_end, &h);
+    if(ret == 0 && tail_start < end) {
+        ret = bam_read_idx_hash_bytes(fp, tail_start, end, &h);
+    }
+    fclose(fp);
+
+    *fingerprint = h;
+    return ret;
+}
+
+//
+void bam_read_idx_source_start(bam_read_idx_source* source, const char* filename)
+{
+    int64_t bytes = bam_read_idx_file_bytes(filename);
+    if(bytes < 0) {
+        fprintf(stderr, "[bri] could not open %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    source->file_bytes = bytes;
+    source->end_offset = 0;
+    source->fingerprint = 0;
+}
+
+//
+void bam_read_idx_source_finish(bam_read_idx_source* source, const char* filename, size_t end_offset)
+{
+    source->end_offset = end_offset;
+    if(bam_read_idx_fingerprint(filename, source, &source->fingerprint) != 0) {
+        fprintf(stderr, "[bri] could not read %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// the false positive rate that gives a filter with the same number of
+// hashes as bloom, see bam_read_idx_bloom_init
+static double bam_read_idx_update_bloom_fpr(const bam_read_idx_bloom* bloom)
+{
+    return pow(2.0, 1.0 - (double)bloom->num_hashes);
+}
+
+// whether bri is an index of exactly input_files
+static int bam_read_idx_update_same_files(const bam_read_idx* bri, const char** input_files, size_t num_files)
+{
+    if(num_files == 1) {
+        return bri->file_count == 0;
+    }
+
+    if(bri->file_count != num_files) {
+        return 0;
+    }
+
+    // the index stores absolute paths, compare them with the resolved input paths
+    int same = 1;
+    for(size_t fi = 0; fi < num_files && same; ++fi) {
+        char* path = realpath(input_files[fi], NULL);
+        same = path != NULL && strcmp(bri->file_names[fi], path) == 0;
+        free(path);
+    }
+    return same;
+}
+
+// Check that the indexed part of each file is unchanged, returning the
+// number of files that have grown or -1 if one has changed
+static int64_t bam_read_idx_update_check_sources(const bam_read_idx* bri, const char** input_files, size_t num_files)
+{
+    int64_t grown = 0;
+    for(size_t fi = 0; fi < num_files; ++fi) {
+        const bam_read_idx_source* source = &bri->sources[fi];
+        int64_t bytes = bam_read_idx_file_bytes(input_files[fi]);
+        uint64_t fingerprint = 0;
+        if(bytes < (int64_t)source->file_bytes ||
+           bam_read_idx_fingerprint(input_files[fi], source, &fingerprint) != 0 ||
+           fingerprint != source->fingerprint) {
+            fprintf(stderr, "[bri] %s has changed since it was indexed\n", input_files[fi]);
+            return -1;
+        }
+        grown += bytes > (int64_t)source->file_bytes;
+    }
+    return grown;
+}
+
+// index the alignments appended to each file that has grown, updating
+// its source, and return them in a new index being built
+static bam_read_idx* bam_read_idx_update_scan(bam_read_idx* bri, const char** input_files, size_t num_files,
+                                              bam_read_idx_source* sources, const bam_read_idx_build_options* opts)
+{
+    bam_read_idx* added = bam_read_idx_init();
+    if(added == NULL) {
+        fprintf(stderr, "[bri] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(added->key_tag, bri->key_tag, BRI_KEY_TAG_SIZE);
+
+    if(bri->file_count > 0) {
+        added->file_count = bri->file_count;
+        added->file_name_starts = malloc(bri->file_count * sizeof(size_t));
+        if(added->file_name_starts == NULL) {
+            fprintf(stderr, "[bri] malloc failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    bri_stats_start(BRI_PHASE_SCAN);
+    for(size_t fi = 0; fi < num_files; ++fi) {
+        const char* filename = input_files[fi];
+        if(added->file_count > 0) {
+            added->file_name_starts[fi] = added->name_arena.next;
+        }
+
+        if(bam_read_idx_file_bytes(filename) == (int64_t)sources[fi].file_bytes) {
+            continue;
+        }
+
+        htsFile* fp = hts_open(filename, "r");
+        if(fp == NULL || fp->format.format != bam) {
+            fprintf(stderr, "[bri] could not open %s as a bam file\n", filename);
+            exit(EXIT_FAILURE);
+        }
+
+        bri_io_stream stream_data;
+        bri_io_stream* stream = NULL;
+        if(opts->io_policy == BRI_IO_STREAM && bri_io_stream_open(&stream_data, filename, fp) == 0) {
+            stream = &stream_data;
+        }
+
+        bam1_t* b = bam_init1();
+        bam_hdr_t* h = sam_hdr_read(fp);
+        if(h == NULL || bri_stats_bgzf_seek(fp->fp.bgzf, sources[fi].end_offset) != 0) {
+            fprintf(stderr, "[bri] could not seek to the end of the indexed part of %s\n", filename);
+            exit(EXIT_FAILURE);
+        }
+
+        size_t first = added->record_count;
+        bam_read_idx_source_start(&sources[fi], filename);
+        size_t end_offset = bam_read_idx_scan(filename, fp, h, b, &bri->filter, added->key_tag, stream, bam_read_idx_build_add, added);
+        bam_read_idx_source_finish(&sources[fi], filename, end_offset);
+
+        if(verbose) {
+            fprintf(stderr, "[bri-build] indexed %zu alignments appended to %s\n", added->record_count - first, filename);
+        }
+
+        bam_hdr_destroy(h);
+        bam_destroy1(b);
+        hts_close(fp);
+        if(stream != NULL) {
+            bri_io_stream_close(stream);
+        }
+    }
+    bri_stats_stop(BRI_PHASE_SCAN);
+    return added;
+}
+
+// Records are ordered by name then by their position in the files, which is
+// the order bam_read_idx_save sorts a new index into, as the records of a
+// new index are added in file order.
+static int bam_read_idx_update_compare(const char* name1, size_t file1, size_t offset1,
+                                       const char* name2, size_t file2, size_t offset2)
+{
+    int cmp = strcmp(name1, name2);
+    if(cmp != 0) {
+        return cmp;
+    }
+
+    if(file1 != file2) {
+        return file1 < file2 ? -1 : 1;
+    }
+    return (offset1 > offset2) - (offset1 < offset2);
+}
+
+// merge the sorted records of the loaded index bri with the new records in
+// added into a new index being built, in name order
+static bam_read_idx* bam_read_idx_update_merge(bam_read_idx* bri, bam_read_idx* added)
+{
+    bam_read_idx* merged = bam_read_idx_init();
+    if(merged == NULL) {
+        fprintf(stderr, "[bri] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+    merged->records_sorted = 1;
+
+    // the file names and filter are moved to the merged index
+    merged->file_count = bri->file_count;
+    merged->file_names = bri->file_names;
+    merged->filter = bri->filter;
+    memcpy(merged->key_tag, bri->key_tag, BRI_KEY_TAG_SIZE);
+    bri->file_count = 0;
+    bri->file_names = NULL;
+    bam_read_idx_filter_init(&bri->filter);
+
+    size_t record_count = bri->record_count + added->record_count;
+    if(merged->file_count > 0) {
+        merged->file_ids = malloc(record_count * sizeof(uint16_t));
+        if(merged->file_ids == NULL && record_count > 0) {
+            fprintf(stderr, "[bri] malloc failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    size_t i = 0;
+    size_t j = 0;
+    while(i < bri->record_count || j < added->record_count) {
+        const char* name;
+        size_t file_id;
+        size_t file_offset;
+
+        const bam_read_idx_record* old_record = i < bri->record_count ? &bri->records[i] : NULL;
+        size_t old_file = old_record != NULL ? bam_read_idx_record_file_id(bri, old_record) : 0;
+
+        const bam_read_idx_record* new_record = j < added->record_count ? &added->records[j] : NULL;
+        const char* new_name = new_record != NULL ? bam_read_idx_build_name(added, new_record->read_name.offset) : NULL;
+        size_t new_file = new_record != NULL && added->file_count > 0 ? bam_read_idx_build_file_id(added, new_record->read_name.offset) : 0;
+
+        if(new_record == NULL || (old_record != NULL &&
+           bam_read_idx_update_compare(old_record->read_name.ptr, old_file, old_record->file_offset,
+                                       new_name, new_file, new_record->file_offset) < 0)) {
+            name = old_record->read_name.ptr;
+            file_id = old_file;
+            file_offset = old_record->file_offset;
+            i += 1;
+        } else {
+            name = new_name;
+            file_id = new_file;
+            file_offset = new_record->file_offset;
+            j += 1;
+        }
+
+        if(merged->file_ids != NULL) {
+            merged->file_ids[merged->record_count] = file_id;
+        }
+        bam_read_idx_add(merged, name, file_offset);
+    }
+    return merged;
+}
+
+//
+void bam_read_idx_update_files(const char** input_files, size_t num_files, const char* output_bri, const bam_read_idx_build_options* opts)
+{
+    // the index keeps the filter it was built with
+    if(opts->sparse_interval > 0 || opts->shard_count > 0 || opts->checkpoint_dir != NULL || bam_read_idx_filter_is_set(&opts->filter)) {
+        fprintf(stderr, "[bri] filters, sparse indices, shards and checkpoints can't be used when updating an index\n");
+        exit(EXIT_FAILURE);
+    }
+
+    char* index_fn = generate_key_index_filename(input_files[0], output_bri, opts->key_tag);
+    if(index_fn == NULL) {
+        fprintf(stderr, "[bri] malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    bam_read_idx* bri = NULL;
+    int rebuild = 0;
+    if(access(index_fn, F_OK) != 0) {
+        rebuild = 1;
+    } else {
+        bri = bam_read_idx_try_load_sharded(NULL, index_fn);
+        if(bri == NULL) {
+            exit(EXIT_FAILURE);
+        }
+
+        if(strcmp(bri->key_tag, opts->key_tag) != 0) {
+            fprintf(stderr, "[bri] %s is keyed on %s, not %s\n", index_fn,
+                bri->key_tag[0] != '\0' ? bri->key_tag : "read names", opts->key_tag[0] != '\0' ? opts->key_tag : "read names");
+            exit(EXIT_FAILURE);
+        }
+
+        if(bri->sparse_interval > 0 || bri->shard_count > 0) {
+            fprintf(stderr, "[bri] %s is a sparse or sharded index, which can't be updated\n", index_fn);
+            exit(EXIT_FAILURE);
+        }
+
+        if(bri->format != BRI_FORMAT_BAM || bri->sources == NULL || bri->source_count != num_files) {
+            fprintf(stderr, "[bri] %s doesn't record how much of its files were indexed\n", index_fn);
+            rebuild = 1;
+        } else if(!bam_read_idx_update_same_files(bri, input_files, num_files)) {
+            fprintf(stderr, "[bri] %s is an index of different files\n", index_fn);
+            rebuild = 1;
+        }
+    }
+
+    int64_t grown = rebuild ? 0 : bam_read_idx_update_check_sources(bri, input_files, num_files);
+    if(rebuild || grown < 0) {
+        fprintf(stderr, "[bri] building %s from scratch\n", index_fn);
+
+        bam_read_idx_build_options build_opts = *opts;
+        build_opts.update = 0;
+        if(bri != NULL) {
+            build_opts.filter = bri->filter;
+            if(build_opts.bloom_fpr == 0.0 && bri->bloom != NULL) {
+                build_opts.bloom_fpr = bam_read_idx_update_bloom_fpr(bri->bloom);
+            }
+        }
+        bam_read_idx_build_files(input_files, num_files, output_bri, &build_opts);
+    } else if(grown == 0) {
+        if(verbose) {
+            fprintf(stderr, "[bri-build] %s is up to date\n", index_fn);
+        }
+    } else {
+        bam_read_idx_source* sources = malloc(num_files * sizeof(bam_read_idx_source));
+        if(sources == NULL) {
+            fprintf(stderr, "[bri] malloc failed\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(sources, bri->sources, num_files * sizeof(bam_read_idx_source));
+
+        bam_read_idx* added = bam_read_idx_update_scan(bri, input_files, num_files, sources, opts);
+        bam_read_idx_compact_records(added);
+        sort_r(added->records, added->record_count, sizeof(bam_read_idx_record), compare_records_by_readname_offset, &added->name_arena);
+
+        bam_read_idx* merged = bam_read_idx_update_merge(bri, added);
+        merged->source_count = num_files;
+        merged->sources = sources;
+        merged->bloom_fpr = opts->bloom_fpr;
+        if(merged->bloom_fpr == 0.0 && bri->bloom != NULL) {
+            merged->bloom_fpr = bam_read_idx_update_bloom_fpr(bri->bloom);
+        }
+        bam_read_idx_destroy(added);
+
+        // write a new file and replace the index with it, so the
+        // index isn't lost if the update is interrupted
+        size_t tmp_len = strlen(index_fn) + 5;
+        char* tmp_fn = malloc(tmp_len);
+        if(tmp_fn == NULL) {
+            fprintf(stderr, "[bri] malloc failed\n");
+            exit(EXIT_FAILURE);
+        }
+        snprintf(tmp_fn, tmp_len, "%s.tmp", index_fn);
+
+        size_t record_count = merged->record_count;
+        bam_read_idx_save(merged, tmp_fn);
+        if(rename(tmp_fn, index_fn) != 0) {
+            fprintf(stderr, "[bri] could not replace %s with %s\n", index_fn, tmp_fn);
+            exit(EXIT_FAILURE);
+        }
+
+        if(verbose) {
+            fprintf(stderr, "[bri-build] added %zu records to %s, which now has %zu records\n",
+                record_count - bri->record_count, index_fn, record_count);
+        }
+        free(tmp_fn);
+        bam_read_idx_destroy(merged);
+    }
+
+    if(bri != NULL) {
+        bam_read_idx_destroy(bri);
+    }
+    free(index_fn);
+}
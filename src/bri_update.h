@@ -0,0 +1,42 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+// Incremental updates of the index of bam files that are still being
+// written to, such as the output of live basecalling. The index records
+// how much of each file was indexed (see bam_read_idx_source) so an
+// update only reads the alignments appended since. These are sorted and
+// merged with the records of the existing index, giving the same index
+// as rebuilding it from scratch.
+//
+// An appended file is recognized by its size, which only grows, and a
+// fingerprint of the compressed bytes at the start and the end of the
+// part of it that was indexed. When no file has grown the index is left
+// as it is. A file that shrank or whose fingerprint changed was replaced,
+// and the index is rebuilt, as it is when it doesn't record its sources.
+//
+#ifndef BAM_READ_IDX_UPDATE
+#define BAM_READ_IDX_UPDATE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "bri_index.h"
+
+// bytes hashed at the start and at the end of the indexed part of a file
+#define BRI_UPDATE_FINGERPRINT_BYTES 65536
+
+// record the size of filename before it is scanned
+void bam_read_idx_source_start(bam_read_idx_source* source, const char* filename);
+
+// record that filename was scanned up to end_offset and fingerprint it
+void bam_read_idx_source_finish(bam_read_idx_source* source, const char* filename, size_t end_offset);
+
+// update the index of input_files, writing it to output_bri, as
+// bam_read_idx_build_files does for a new index. Exits on error.
+void bam_read_idx_update_files(const char** input_files, size_t num_files, const char* output_bri, const bam_read_idx_build_options* opts);
+
+#endif
@@ -0,0 +1,88 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "bri_writer.h"
+
+//
+bri_writer* bri_writer_open(const char* output_bri, const bam_read_idx_build_options* opts)
+{
+    if(opts != NULL && bam_read_idx_filter_is_set(&opts->filter)) {
+        fprintf(stderr, "[bri] filters can't be used when writing an index\n");
+        return NULL;
+    }
+
+    if(opts != NULL && (opts->sparse_interval > 0 || opts->shard_count > 0)) {
+        fprintf(stderr, "[bri] sparse and sharded indices can't be built when writing an index\n");
+        return NULL;
+    }
+
+    // fail early, rather than after the bam has been written, if the index can't be created
+    FILE* fp = fopen(output_bri, "wb");
+    if(fp == NULL) {
+        fprintf(stderr, "[bri] could not open %s for writing\n", output_bri);
+        return NULL;
+    }
+    fclose(fp);
+
+    bri_writer* writer = malloc(sizeof(bri_writer));
+    if(writer == NULL) {
+        return NULL;
+    }
+
+    writer->bri = bam_read_idx_init();
+    writer->filename = malloc(strlen(output_bri) + 1);
+    if(writer->filename != NULL) {
+        strcpy(writer->filename, output_bri);
+    }
+
+    if(writer->bri == NULL || writer->filename == NULL || pthread_mutex_init(&writer->lock, NULL) != 0) {
+        if(writer->bri != NULL) {
+            bam_read_idx_destroy(writer->bri);
+        }
+        free(writer->filename);
+        free(writer);
+        return NULL;
+    }
+
+    writer->bri->bloom_fpr = opts != NULL ? opts->bloom_fpr : 0.0;
+    if(opts != NULL) {
+        memcpy(writer->bri->key_tag, opts->key_tag, BRI_KEY_TAG_SIZE);
+    }
+    writer->bri->name_arena.huge_pages = opts != NULL && opts->huge_pages;
+    writer->bri->record_arena.huge_pages = opts != NULL && opts->huge_pages;
+    return writer;
+}
+
+//
+void bri_writer_add(bri_writer* writer, const bam1_t* b, uint64_t voffset)
+{
+    // records without the key tag aren't indexed
+    char buffer[BRI_KEY_BUFFER_SIZE];
+    const char* key = bam_read_idx_key(b, writer->bri->key_tag, buffer);
+    if(key == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    bam_read_idx_add(writer->bri, key, voffset);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+//
+void bri_writer_close(bri_writer* writer)
+{
+    bam_read_idx_save(writer->bri, writer->filename);
+    bam_read_idx_destroy(writer->bri);
+    pthread_mutex_destroy(&writer->lock);
+    free(writer->filename);
+    free(writer);
+}
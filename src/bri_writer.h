@@ -0,0 +1,60 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+// Build an index while writing a bam file, for programs that
+// write bam through htslib. Call bri_writer_add with each record
+// and its virtual offset in the output, which is the value of
+// bgzf_tell(fp->fp.bgzf) just before the record is passed to
+// sam_write1, then bri_writer_close after closing the bam:
+//
+//   bri_writer* w = bri_writer_open("out.bam.bri", NULL);
+//   ...
+//   uint64_t voffset = bgzf_tell(out->fp.bgzf);
+//   sam_write1(out, hdr, b);
+//   bri_writer_add(w, b, voffset);
+//   ...
+//   hts_close(out);
+//   bri_writer_close(w);
+//
+// Records can be added in any order, and from multiple threads. The
+// output itself must not be compressed with hts_set_threads, as then
+// block addresses are only known once blocks are compressed and
+// bgzf_tell doesn't give the final offset.
+//
+#ifndef BAM_READ_IDX_WRITER
+#define BAM_READ_IDX_WRITER
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <htslib/sam.h>
+#include "bri_index.h"
+
+typedef struct bri_writer
+{
+    bam_read_idx* bri;
+    char* filename;
+
+    // serializes calls to bri_writer_add
+    pthread_mutex_t lock;
+} bri_writer;
+
+// start an index that will be saved to output_bri. Only the bloom filter
+// and key tag of the options are used, as the caller chooses which records
+// to add, and opts can be NULL for the defaults. Returns NULL on failure.
+bri_writer* bri_writer_open(const char* output_bri, const bam_read_idx_build_options* opts);
+
+// add the record b, written to the bam at virtual offset voffset,
+// to the index. Safe to call from multiple threads. Exits if out of memory.
+void bri_writer_add(bri_writer* writer, const bam1_t* b, uint64_t voffset);
+
+// save the index to disk and free the writer. Exits if the index can't be written.
+void bri_writer_close(bri_writer* writer);
+
+#endif
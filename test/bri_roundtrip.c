@@ -0,0 +1,295 @@
+//---------------------------------------------------------
+// Copyright 2019 Ontario Institute for Cancer Research
+// Written by Jared Simpson (jared.simpson@oicr.on.ca)
+//---------------------------------------------------------
+//
+// bri - simple utility to provide random access to
+//       bam records by read name
+//
+// Round trip tests of building an index, run by make test. Synthetic
+// bam files are indexed, and the index written by a build resumed from
+// a checkpoint, and by updating the index of files that were appended
+// to, must be byte for byte the same as an uninterrupted build.
+//
+
+// for mkdtemp
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <htslib/sam.h>
+#include <htslib/bgzf.h>
+#include "bri_index.h"
+#include "bri_update.h"
+
+// each test indexes this many files of this many alignments, with
+// every name used by several alignments in each file
+#define ROUNDTRIP_NUM_FILES 2
+#define ROUNDTRIP_NUM_ALIGNMENTS 20000
+#define ROUNDTRIP_NUM_NAMES 7000
+
+// exit status of a build stopped part way through
+#define ROUNDTRIP_STOPPED 42
+
+static char tmp_dir[] = "/tmp/bri_roundtrip.XXXXXX";
+
+// the path of name in the temporary directory, in a static buffer
+static const char* roundtrip_path(const char* name)
+{
+    static char paths[8][256];
+    static int next = 0;
+    char* path = paths[next++ % 8];
+    snprintf(path, sizeof(paths[0]), "%s/%s", tmp_dir, name);
+    return path;
+}
+
+// write the alignments of file to filename, unmapped with names shared
+// within and between files. The stream is flushed after flush_after
+// alignments and the size of the file at that point written to
+// flushed_bytes, so the file can be cut there to be appended to later.
+static void roundtrip_write_bam(const char* filename, size_t file, size_t flush_after, size_t* flushed_bytes)
+{
+    htsFile* fp = hts_open(filename, "wb");
+    if(fp == NULL) {
+        fprintf(stderr, "[bri-roundtrip] could not open %s for writing\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    const char* header_text = "@HD\tVN:1.6\tSO:unsorted\n";
+    bam_hdr_t* h = sam_hdr_parse(strlen(header_text), header_text);
+    if(h == NULL || sam_hdr_write(fp, h) < 0) {
+        fprintf(stderr, "[bri-roundtrip] could not write header\n");
+        exit(EXIT_FAILURE);
+    }
+
+    bam1_t* b = bam_init1();
+    char name[64];
+    const char* seq = "ACGTACGTAC";
+    const char* qual = "IIIIIIIIII";
+    for(size_t i = 0; i < ROUNDTRIP_NUM_ALIGNMENTS; ++i) {
+        if(i == flush_after) {
+            if(bgzf_flush(fp->fp.bgzf) != 0) {
+                fprintf(stderr, "[bri-roundtrip] could not flush %s\n", filename);
+                exit(EXIT_FAILURE);
+            }
+            *flushed_bytes = bgzf_tell(fp->fp.bgzf) >> 16;
+        }
+
+        sprintf(name, "read%zu", (i * 7919 + file * 104729) % ROUNDTRIP_NUM_NAMES);
+        if(bam_set1(b, strlen(name), name, BAM_FUNMAP, -1, -1, 0, 0, NULL, -1, -1, 0,
+                    strlen(seq), seq, qual, 0) < 0 || sam_write1(fp, h, b) < 0) {
+            fprintf(stderr, "[bri-roundtrip] failed to write record\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    bam_destroy1(b);
+    bam_hdr_destroy(h);
+    if(hts_close(fp) != 0) {
+        fprintf(stderr, "[bri-roundtrip] could not write %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// copy the first bytes of src to dst, or all of it if bytes is SIZE_MAX
+static void roundtrip_copy(const char* src, const char* dst, size_t bytes)
+{
+    int whole = bytes == SIZE_MAX;
+    FILE* in = fopen(src, "rb");
+    FILE* out = fopen(dst, "wb");
+    if(in == NULL || out == NULL) {
+        fprintf(stderr, "[bri-roundtrip] could not copy %s to %s\n", src, dst);
+        exit(EXIT_FAILURE);
+    }
+
+    char buffer[65536];
+    while(bytes > 0) {
+        size_t n = fread(buffer, 1, bytes < sizeof(buffer) ? bytes : sizeof(buffer), in);
+        if(n == 0 || fwrite(buffer, 1, n, out) != n) {
+            break;
+        }
+        bytes -= n;
+    }
+
+    if((!whole && bytes > 0) || ferror(in) || fclose(out) != 0) {
+        fprintf(stderr, "[bri-roundtrip] could not copy %s to %s\n", src, dst);
+        exit(EXIT_FAILURE);
+    }
+    fclose(in);
+}
+
+// returns 1 if the two files have the same contents
+static int roundtrip_same_contents(const char* fn1, const char* fn2)
+{
+    FILE* f1 = fopen(fn1, "rb");
+    FILE* f2 = fopen(fn2, "rb");
+    int same = f1 != NULL && f2 != NULL;
+    while(same) {
+        int c1 = fgetc(f1);
+        int c2 = fgetc(f2);
+        same = c1 == c2;
+        if(c1 == EOF) {
+            break;
+        }
+    }
+
+    if(f1 != NULL) {
+        fclose(f1);
+    }
+    if(f2 != NULL) {
+        fclose(f2);
+    }
+    return same;
+}
+
+// the checkpoint callback of the build, which the Makefile wraps with
+// the linker so a build can be stopped as if it crashed
+void __real_bam_read_idx_checkpoint_add(void* data, const bam1_t* b, size_t file_offset);
+
+static size_t stop_after = 0;
+static size_t checkpoint_adds = 0;
+
+//
+void __wrap_bam_read_idx_checkpoint_add(void* data, const bam1_t* b, size_t file_offset)
+{
+    if(stop_after > 0 && ++checkpoint_adds > stop_after) {
+        _exit(ROUNDTRIP_STOPPED);
+    }
+    __real_bam_read_idx_checkpoint_add(data, b, file_offset);
+}
+
+// a build stopped part way through the second file and resumed from its
+// checkpoint writes the same index as a build that wasn't interrupted
+static int roundtrip_test_checkpoint(const char** files)
+{
+    const char* reference_bri = roundtrip_path("reference.bri");
+    const char* resumed_bri = roundtrip_path("resumed.bri");
+    const char* checkpoint_dir = roundtrip_path("checkpoint");
+
+    bam_read_idx_build_options opts;
+    bam_read_idx_build_options_init(&opts);
+    bam_read_idx_build_files(files, ROUNDTRIP_NUM_FILES, reference_bri, &opts);
+
+    // checkpoint as often as possible, and stop the build in a child process
+    opts.checkpoint_dir = checkpoint_dir;
+    opts.checkpoint_interval = 0;
+    pid_t pid = fork();
+    if(pid < 0) {
+        fprintf(stderr, "[bri-roundtrip] fork failed\n");
+        return 1;
+    }
+
+    if(pid == 0) {
+        stop_after = ROUNDTRIP_NUM_ALIGNMENTS + ROUNDTRIP_NUM_ALIGNMENTS / 2;
+        bam_read_idx_build_files(files, ROUNDTRIP_NUM_FILES, resumed_bri, &opts);
+        _exit(EXIT_SUCCESS);
+    }
+
+    int status = 0;
+    if(waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != ROUNDTRIP_STOPPED) {
+        fprintf(stderr, "[bri-roundtrip] the checkpointed build wasn't stopped\n");
+        return 1;
+    }
+
+    if(access(roundtrip_path("checkpoint/state"), F_OK) != 0) {
+        fprintf(stderr, "[bri-roundtrip] the stopped build didn't write a checkpoint\n");
+        return 1;
+    }
+
+    bam_read_idx_build_files(files, ROUNDTRIP_NUM_FILES, resumed_bri, &opts);
+    if(!roundtrip_same_contents(reference_bri, resumed_bri)) {
+        fprintf(stderr, "[bri-roundtrip] the resumed build differs from the uninterrupted build\n");
+        return 1;
+    }
+
+    remove(reference_bri);
+    remove(resumed_bri);
+    rmdir(checkpoint_dir);
+    return 0;
+}
+
+// updating the index of files that were appended to writes the same
+// index as building it again from the complete files
+static int roundtrip_test_update(const char** files, const char** complete_files, const size_t* cut_bytes)
+{
+    const char* reference_bri = roundtrip_path("reference.bri");
+    const char* updated_bri = roundtrip_path("updated.bri");
+
+    bam_read_idx_build_options opts;
+    bam_read_idx_build_options_init(&opts);
+
+    // index the start of each file, then append the rest of it
+    for(size_t fi = 0; fi < ROUNDTRIP_NUM_FILES; ++fi) {
+        roundtrip_copy(complete_files[fi], files[fi], cut_bytes[fi]);
+    }
+    bam_read_idx_build_files(files, ROUNDTRIP_NUM_FILES, updated_bri, &opts);
+
+    for(size_t fi = 0; fi < ROUNDTRIP_NUM_FILES; ++fi) {
+        roundtrip_copy(complete_files[fi], files[fi], SIZE_MAX);
+    }
+    bam_read_idx_build_files(files, ROUNDTRIP_NUM_FILES, reference_bri, &opts);
+
+    opts.update = 1;
+    bam_read_idx_update_files(files, ROUNDTRIP_NUM_FILES, updated_bri, &opts);
+    if(!roundtrip_same_contents(reference_bri, updated_bri)) {
+        fprintf(stderr, "[bri-roundtrip] the updated index differs from a rebuilt index\n");
+        return 1;
+    }
+
+    remove(reference_bri);
+    remove(updated_bri);
+    return 0;
+}
+
+//
+int main(void)
+{
+    if(mkdtemp(tmp_dir) == NULL) {
+        fprintf(stderr, "[bri-roundtrip] could not create a temporary directory\n");
+        return EXIT_FAILURE;
+    }
+
+    char filenames[ROUNDTRIP_NUM_FILES][256];
+    char complete_filenames[ROUNDTRIP_NUM_FILES][256];
+    const char* files[ROUNDTRIP_NUM_FILES];
+    const char* complete_files[ROUNDTRIP_NUM_FILES];
+    size_t cut_bytes[ROUNDTRIP_NUM_FILES];
+    for(size_t fi = 0; fi < ROUNDTRIP_NUM_FILES; ++fi) {
+        snprintf(filenames[fi], sizeof(filenames[fi]), "%s/reads%zu.bam", tmp_dir, fi);
+        snprintf(complete_filenames[fi], sizeof(complete_filenames[fi]), "%s/complete%zu.bam", tmp_dir, fi);
+        files[fi] = filenames[fi];
+        complete_files[fi] = complete_filenames[fi];
+        roundtrip_write_bam(complete_files[fi], fi, ROUNDTRIP_NUM_ALIGNMENTS / 2, &cut_bytes[fi]);
+        roundtrip_copy(complete_files[fi], files[fi], SIZE_MAX);
+    }
+
+    int failed = 0;
+    if(roundtrip_test_checkpoint(files) != 0) {
+        failed += 1;
+    } else {
+        fprintf(stderr, "[bri-roundtrip] checkpoint: ok\n");
+    }
+
+    if(roundtrip_test_update(files, complete_files, cut_bytes) != 0) {
+        failed += 1;
+    } else {
+        fprintf(stderr, "[bri-roundtrip] update: ok\n");
+    }
+
+    // leave the files of a failed test to be inspected
+    if(failed > 0) {
+        fprintf(stderr, "[bri-roundtrip] %d test(s) failed, files are in %s\n", failed, tmp_dir);
+        return EXIT_FAILURE;
+    }
+
+    for(size_t fi = 0; fi < ROUNDTRIP_NUM_FILES; ++fi) {
+        remove(files[fi]);
+        remove(complete_files[fi]);
+    }
+    rmdir(tmp_dir);
+    return EXIT_SUCCESS;
+}